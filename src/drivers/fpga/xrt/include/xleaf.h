@@ -158,6 +158,7 @@ int xleaf_destroy_group(struct xrt_device *xdev, int instance);
 void xleaf_get_root_res(struct xrt_device *xdev, u32 region_id, struct resource **res);
 void xleaf_get_root_id(struct xrt_device *xdev, unsigned short *vendor, unsigned short *device,
 		       unsigned short *subvendor, unsigned short *subdevice);
+int xleaf_get_root_irq(struct xrt_device *xdev, u32 vector);
 void xleaf_hot_reset(struct xrt_device *xdev);
 int xleaf_put_leaf(struct xrt_device *xdev, struct xrt_device *leaf);
 struct device *xleaf_register_hwmon(struct xrt_device *xdev, const char *name, void *drvdata,
@@ -17,13 +17,46 @@ enum xrt_mailbox_leaf_cmd {
 	XRT_MAILBOX_POST = XRT_XLEAF_CUSTOM_BASE, /* See comments in xleaf.h */
 	XRT_MAILBOX_REQUEST,
 	XRT_MAILBOX_LISTEN,
+	XRT_MAILBOX_REQUEST_ASYNC,
+	XRT_MAILBOX_GET_CAPS,
+	XRT_MAILBOX_SET_CAPS,
+	XRT_MAILBOX_PEER_DOWN,
 };
 
+/*
+ * Arg of XRT_MAILBOX_GET_CAPS and XRT_MAILBOX_SET_CAPS is a u32 * pointing to
+ * XCL_MB_CAP_* bits. GET_CAPS returns all caps the mailbox supports. SET_CAPS
+ * turns on the ones agreed with peer and turns off the rest.
+ *
+ * XRT_MAILBOX_PEER_DOWN (no arg) tells mailbox that peer is known to be gone,
+ * e.g. it has announced going offline. All msgs in flight fail right away with
+ * -ENOTCONN instead of waiting for their TTL. Mailbox does the same on its own
+ * when peer stops answering heartbeat.
+ */
+
+typedef	void (*mailbox_msg_cb_t)(void *arg, void *data, size_t len,
+	u64 msgid, int err, bool sw_ch);
+
+/*
+ * TX priority of a msg. Control msgs are always sent first, bulk msgs last.
+ * Bulk msgs can be preempted at packet boundary by msgs of higher priority.
+ * Interactive msgs larger than XRT_MAILBOX_BULK_SIZE are sent as bulk msgs.
+ */
+enum xrt_mailbox_prio {
+	XRT_MAILBOX_PRIO_INTERACTIVE = 0, /* default */
+	XRT_MAILBOX_PRIO_CONTROL,
+	XRT_MAILBOX_PRIO_BULK,
+	XRT_MAILBOX_PRIO_MAX
+};
+
+#define XRT_MAILBOX_BULK_SIZE	(16 * 1024)
+
 struct xrt_mailbox_post {
 	u64 xmip_req_id; /* 0 means response */
 	bool xmip_sw_ch;
 	void *xmip_data;
 	size_t xmip_data_size;
+	enum xrt_mailbox_prio xmip_prio;
 };
 
 struct xrt_mailbox_request {
@@ -33,13 +66,76 @@ struct xrt_mailbox_request {
 	size_t xmir_req_size;
 	void *xmir_resp;
 	size_t xmir_resp_size;
+	enum xrt_mailbox_prio xmir_prio;
 };
 
-typedef	void (*mailbox_msg_cb_t)(void *arg, void *data, size_t len,
-	u64 msgid, int err, bool sw_ch);
+/*
+ * Same as struct xrt_mailbox_request, but the leaf call returns as soon as the
+ * request is queued. Request buffer is copied and can be reused right away.
+ * Response buffer must stay valid till xmira_cb is called with the response
+ * (data/len) or an error. The callback is called from mailbox worker thread,
+ * it should not block or issue another synchronous request. If the leaf call
+ * itself fails, the callback will not be called.
+ */
+struct xrt_mailbox_request_async {
+	bool xmira_sw_ch;
+	u32 xmira_resp_ttl;
+	void *xmira_req;
+	size_t xmira_req_size;
+	void *xmira_resp;
+	size_t xmira_resp_size;
+	mailbox_msg_cb_t xmira_cb;
+	void *xmira_cb_arg;
+	enum xrt_mailbox_prio xmira_prio;
+};
+
+/*
+ * Returns true if the request in data/len can be handled concurrently with
+ * other requests. Must be quick and not block.
+ */
+typedef bool (*mailbox_req_class_t)(void *arg, void *data, size_t len);
+
+/*
+ * A chunk of a request too big to be buffered by mailbox. Chunks come in
+ * order, xmis_offset is where xmis_data starts in the whole request of
+ * xmis_total bytes. The last call has xmis_last set and may carry data. Its
+ * xmis_err is non-zero if the request did not fully arrive, or listener has
+ * failed an earlier chunk.
+ */
+struct xrt_mailbox_stream {
+	u64 xmis_req_id;
+	bool xmis_sw_ch;
+	size_t xmis_total;
+	size_t xmis_offset;
+	void *xmis_data;
+	size_t xmis_len;
+	bool xmis_last;
+	int xmis_err;
+};
+
+/*
+ * Called for each chunk of a streamed request. Error returned makes mailbox
+ * drop the rest, but the last call is still made. Calls for one request are
+ * serialized, but may run in parallel with xmil_cb. The last call is treated
+ * as a request not classified as concurrent, see below.
+ */
+typedef int (*mailbox_stream_cb_t)(void *arg, struct xrt_mailbox_stream *st);
+
+/*
+ * Requests are passed to xmil_cb one at a time, unless xmil_concurrent says
+ * otherwise. Then xmil_cb is called for them from several threads at once, so
+ * it has to be re-entrant for such requests. A request not classified as
+ * concurrent starts after concurrent ones received before it are done, and
+ * never runs in parallel with another such request. Concurrent requests
+ * received after it may run while it does. Setting a new listener waits for
+ * all running callbacks to return. Requests too big to be buffered go to
+ * xmil_stream, or are dropped if it is not set.
+ */
 struct xrt_mailbox_listen {
 	mailbox_msg_cb_t xmil_cb;
 	void *xmil_cb_arg;
+	mailbox_req_class_t xmil_concurrent; /* optional */
+	mailbox_stream_cb_t xmil_stream; /* optional */
 };
 
 #endif	/* _XRT_MAILBOX_H_ */
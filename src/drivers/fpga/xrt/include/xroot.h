@@ -39,6 +39,7 @@ enum xrt_root_cmd {
 	/* Device info. */
 	XRT_ROOT_GET_RESOURCE,
 	XRT_ROOT_GET_ID,
+	XRT_ROOT_GET_IRQ,
 
 	/* Misc. */
 	XRT_ROOT_HOT_RESET,
@@ -82,6 +83,11 @@ struct xrt_root_get_id {
 	unsigned short  xpigi_sub_device_id;
 };
 
+struct xrt_root_get_irq {
+	u32 xpigq_vector;
+	int xpigq_irq;
+};
+
 struct xrt_root_hwmon {
 	bool xpih_register;
 	const char *xpih_name;
@@ -104,6 +110,7 @@ int xrt_subdev_root_request(struct xrt_device *self, u32 cmd, void *arg);
 struct xroot_physical_function_callback {
 	void (*xpc_get_id)(struct device *dev, struct xrt_root_get_id *rid);
 	int (*xpc_get_resource)(struct device *dev, struct xrt_root_get_res *res);
+	int (*xpc_get_irq)(struct device *dev, struct xrt_root_get_irq *irq);
 	void (*xpc_hot_reset)(struct device *dev);
 };
 
@@ -830,6 +830,19 @@ void xleaf_get_root_id(struct xrt_device *xdev, unsigned short *vendor, unsigned
 		*subdevice = id.xpigi_sub_device_id;
 }
 
+int xleaf_get_root_irq(struct xrt_device *xdev, u32 vector)
+{
+	struct xrt_root_get_irq arg = { 0 };
+	int ret;
+
+	arg.xpigq_vector = vector;
+	ret = xrt_subdev_root_request(xdev, XRT_ROOT_GET_IRQ, &arg);
+	if (ret)
+		return ret;
+
+	return arg.xpigq_irq;
+}
+
 struct device *xleaf_register_hwmon(struct xrt_device *xdev, const char *name, void *drvdata,
 				    const struct attribute_group **grps)
 {
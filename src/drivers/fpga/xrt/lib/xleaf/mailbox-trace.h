@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Xilinx Alveo FPGA Mailbox IP Leaf Driver Tracepoints
+ *
+ * Copyright (C) 2020 Xilinx, Inc.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xrt_mailbox
+
+#if !defined(_XRT_MAILBOX_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _XRT_MAILBOX_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(xrt_mailbox_msg,
+	TP_PROTO(const char *dev, const char *ch, bool sw, u64 id, size_t len),
+	TP_ARGS(dev, ch, sw, id, len),
+	TP_STRUCT__entry(
+		__string(dev, dev)
+		__string(ch, ch)
+		__field(bool, sw)
+		__field(u64, id)
+		__field(size_t, len)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev);
+		__assign_str(ch, ch);
+		__entry->sw = sw;
+		__entry->id = id;
+		__entry->len = len;
+	),
+	TP_printk("%s %s(%s) id=0x%llx len=%zu", __get_str(dev), __get_str(ch),
+		  __entry->sw ? "SW" : "HW", __entry->id, __entry->len)
+);
+
+/* Msg is queued for TX, or response slot is queued for RX. */
+DEFINE_EVENT(xrt_mailbox_msg, xrt_mailbox_msg_enqueue,
+	TP_PROTO(const char *dev, const char *ch, bool sw, u64 id, size_t len),
+	TP_ARGS(dev, ch, sw, id, len)
+);
+
+DEFINE_EVENT(xrt_mailbox_msg, xrt_mailbox_msg_first_pkt,
+	TP_PROTO(const char *dev, const char *ch, bool sw, u64 id, size_t len),
+	TP_ARGS(dev, ch, sw, id, len)
+);
+
+DEFINE_EVENT(xrt_mailbox_msg, xrt_mailbox_msg_last_pkt,
+	TP_PROTO(const char *dev, const char *ch, bool sw, u64 id, size_t len),
+	TP_ARGS(dev, ch, sw, id, len)
+);
+
+TRACE_EVENT(xrt_mailbox_msg_done,
+	TP_PROTO(const char *dev, const char *ch, bool sw, u64 id, size_t len, u64 pkts,
+		 u64 lat_ns, int err),
+	TP_ARGS(dev, ch, sw, id, len, pkts, lat_ns, err),
+	TP_STRUCT__entry(
+		__string(dev, dev)
+		__string(ch, ch)
+		__field(bool, sw)
+		__field(u64, id)
+		__field(size_t, len)
+		__field(u64, pkts)
+		__field(u64, lat_ns)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev);
+		__assign_str(ch, ch);
+		__entry->sw = sw;
+		__entry->id = id;
+		__entry->len = len;
+		__entry->pkts = pkts;
+		__entry->lat_ns = lat_ns;
+		__entry->err = err;
+	),
+	TP_printk("%s %s(%s) id=0x%llx len=%zu pkts=%llu lat=%lluns err=%d",
+		  __get_str(dev), __get_str(ch), __entry->sw ? "SW" : "HW", __entry->id,
+		  __entry->len, __entry->pkts, __entry->lat_ns, __entry->err)
+);
+
+#endif /* _XRT_MAILBOX_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mailbox-trace
+#include <trace/define_trace.h>
@@ -25,14 +25,51 @@
  * The driver implemented two transport layers - packet and message layer (see
  * below). A packet is a fixed size chunk of data that can be sent through TX
  * channel or retrieved from RX channel. The driver will not attempt to send
- * next packet until the previous one is read by peer. Similarly, the driver
+ * next packet until TX FIFO has room for a whole packet. Similarly, the driver
  * will not attempt to read the data from HW until a full packet has been
  * written to HW by peer.
  *
- * Interrupt is not enabled and driver will poll the HW periodically to see if
- * FIFO is ready for reading or writing. When there is outstanding msg to be
- * sent or received, driver will poll at high frequency. Otherwise, driver polls
- * HW at very low frequency so that it will not consume much CPU cycles.
+ * The FIFO depth of the mailbox IP is a HW build time option, which can be
+ * configured through sysfs (mailbox_fifo_depth, in DWORDs, default to one
+ * packet). SIT is set to leave room for exactly one packet, so STA tells
+ * that one more packet can be pushed into TX FIFO. RIT is set to one packet,
+ * so RTA tells that one more full packet is ready in RX FIFO. On each pass,
+ * the channel worker keeps pushing or draining packets for as long as the
+ * FIFO status allows it, up to MBX_MAX_BURST_PKTS packets, before it waits for
+ * next intr or poll.
+ *
+ * When the mailbox endpoint has an interrupt assigned in metadata, the driver
+ * enables both the send threshold (STI) and receive threshold (RTI) interrupts.
+ * With above thresholds, RTI fires as soon as a full packet has landed in RX
+ * FIFO and STI fires when peer has drained enough of TX FIFO for next packet.
+ * The threaded IRQ handler acknowledges the interrupt and wakes up the channel
+ * worker, which then moves on to the next packet(s) immediately.
+ *
+ * Without an interrupt, or when interrupt mode is turned off via sysfs, the
+ * driver will poll the HW periodically to see if FIFO is ready for reading or
+ * writing. When there is outstanding msg to be sent or received, driver will
+ * poll at high frequency, backing off when peer is not making progress.
+ * Otherwise, driver polls HW at very low frequency so that it will not consume
+ * much CPU cycles. In interrupt mode, the low frequency poll timer only runs
+ * while there are msgs in flight, to catch lost interrupts. SW only mailbox
+ * never polls.
+ *
+ * Msgs are not aged by the poll timer. Each msg which can time out carries an
+ * absolute deadline, and every channel arms a hrtimer for the earliest one of
+ * its msgs. When it fires, the channel worker fails the expired msgs and arms
+ * the timer again for the next deadline, if any. An idle mailbox has no timer
+ * running at all.
+ *
+ * Once peer has agreed on XCL_MB_CAP_HEARTBEAT, peer is probed with a ping
+ * packet after MBX_HB_INTERVAL_MS of silence on HW channel, which it answers
+ * with a pong. Any packet or msg from peer counts as a sign of life. After
+ * MBX_HB_MAX_MISSED probes in a row go unanswered, peer is considered down and
+ * all msgs in flight are failed with -ENOTCONN, so caller waits for detection
+ * time instead of the whole TTL. Agreed caps are dropped along with peer, so
+ * no more pings are sent till peer agrees on heartbeat again in a new
+ * USER_PROBE. The first packet from peer brings it back up. Upper layer can also report peer
+ * down (XRT_MAILBOX_PEER_DOWN) when it knows better, and a hot reset of the
+ * card (XRT_EVENT_PRE_HOT_RESET) takes peer down as well.
  *
  * A packet is defined as struct mailbox_pkt. There are mainly two types of
  * packets: start-of-msg and msg-body packets. Both can carry end-of-msg flag to
@@ -44,7 +81,10 @@
  * incoming msg payload after seeing the 1st packet instead of the whole msg.
  * It is an optimization for msg receiving.
  *
- * The body-of-msg packet contains only msg payload.
+ * The body-of-msg packet contains only msg payload. Once peer has agreed on
+ * XCL_MB_CAP_COMPACT_HDR, body packets are sent in compact form, which packs
+ * payload size into packet type and carries 4 more bytes of payload. Compact
+ * body packets are always accepted on RX side.
  *
  *
  * Message layer
@@ -60,9 +100,45 @@
  * layer, there is an assumption that adjacent packets belong to the same
  * message unless the next one is another start-of-msg packet. So, at message
  * layer, the driver will not attempt to send the next message until the
- * transmitting of current one is done. I.E., we implement a FIFO for message
- * TX channel. All messages are sent by driver in the order of received from
- * upper layer. We can implement msgs of different priority later, if needed.
+ * transmitting of current one is done, with one exception described below.
+ *
+ * When peer has agreed on XCL_MB_CAP_LZ4, msgs of at least MBX_LZ4_MIN_SIZE
+ * bytes going thru HW channel are LZ4 compressed when they are queued, and
+ * sent with MSG_FLAG_LZ4 if it makes them smaller. Compressed payload starts
+ * with original size in 4 bytes (LE). Receiver decompresses it once the whole
+ * msg is in, so upper layer never sees compressed data. SW channel always
+ * carries msgs as they are. Msgs too big to be buffered on RX side (see below)
+ * are never compressed.
+ *
+ * When peer has agreed on XCL_MB_CAP_CSUM, msgs going thru HW channel are sent
+ * with MSG_FLAG_CSUM and crc32c of the payload on the wire, computed when they
+ * are queued, is carried in the first 4 bytes of start-of-msg packet payload.
+ * Receiver accumulates crc32c as packets come in and fails the msg with
+ * -EBADMSG on mismatch. No checksum is computed or checked otherwise.
+ *
+ * A request of MAX_REQ_MSG_SZ bytes or more is not buffered as a whole. When
+ * listener takes streams, it is received into two MBX_STREAM_CHUNK_SZ buffers
+ * in turn, and each full one is handed over to listener on REQ pool while the
+ * other is being filled. So, listener consumes one chunk while the next one is
+ * arriving. Without a stream listener, such a request is dropped.
+ *
+ * Msgs in TX channel are queued by priority: control (notifications), then
+ * interactive (the default), then bulk (large transfers). Within one priority
+ * msgs are sent in the order of received from upper layer. Interactive msgs
+ * larger than XRT_MAILBOX_BULK_SIZE are queued as bulk ones. Senders never
+ * take a lock to queue a msg. They push it onto a lock-free submission list,
+ * which TX thread moves into the priority queues before picking next msg, so
+ * the priority queues are only touched by TX thread.
+ *
+ * A bulk msg on HW channel can be preempted at packet boundary when a msg of
+ * higher priority shows up. The bulk msg is parked and the new msg is sent
+ * with a start-of-msg-preempt packet, telling the receiver to park its
+ * partially received msg as well. Once the new msg is fully sent, the parked
+ * msg is resumed with its next body packet. Only one msg can be parked at a
+ * time. Since old peers do not understand start-of-msg-preempt packets, this
+ * is disabled by default. It is enabled when peer agrees on XCL_MB_CAP_PREEMPT
+ * or via sysfs (mailbox_preempt). A bulk msg can always make room for a higher
+ * priority msg going through SW channel, which does not affect HW channel.
  *
  * On the RX side, there is no certain order for receiving messages. It's up to
  * the peer to decide which message gets enqueued into its own TX queue first,
@@ -95,13 +171,22 @@
  * session ID.
  *
  * A request or notification msg will automatically be assigned a msg ID when
- * it's enqueued into TX channel for transmitting. A response msg must match a
- * request msg by msg ID, or it'll be silently dropped. A communication session
- * starts with a request and finishes with 0 or 1 response, always.
+ * it's enqueued into TX channel for transmitting. IDs are taken from a per
+ * mailbox sequence number, so they are unique among all outstanding requests.
+ * A response msg must match a request msg by msg ID, or it'll be silently
+ * dropped. A communication session starts with a request and finishes with 0
+ * or 1 response, always.
+ *
+ * Any number of sessions can be in flight at the same time. The buffers waiting
+ * for responses are kept in a hash table keyed by msg ID in RX channel, so the
+ * matching cost does not grow with the number of outstanding requests. Caller
+ * can either block until the response arrives (XRT_MAILBOX_REQUEST) or get a
+ * callback when it does (XRT_MAILBOX_REQUEST_ASYNC). The TTL of a response
+ * starts ticking once its request has been sent out.
  *
  * Currently, the driver implements one kernel thread for RX channel (RX thread)
  * , one for TX channel (TX thread) and one thread for processing incoming
- * request (REQ thread).
+ * request (REQ thread), backed by a small pool of workers (REQ pool).
  *
  * The RX thread is responsible for receiving incoming msgs. If it's a request
  * or notification msg, it'll punt it to REQ thread for processing, which, in
@@ -109,9 +194,25 @@
  * further process it. If it's a response, it'll simply wake up the waiting
  * thread.
  *
+ * The listener tells REQ thread which requests can be handled concurrently,
+ * normally read-only queries. Those are handed over to REQ pool, so a slow one
+ * does not hold up others. Any other request is serial and is handed over to
+ * an ordered queue (SERIAL queue), so REQ thread goes on with what comes
+ * next. A serial request starts once concurrent ones received before it are
+ * done and never runs in parallel with another serial one. New concurrent
+ * requests are held back only while it waits for REQ pool to drain, so a query
+ * arriving behind a long serial request, e.g. xclbin download, is answered
+ * while the latter is still going on.
+ *
  * The TX thread is responsible for sending out msgs. When it's done, the TX
  * thread will simply wake up the waiting thread.
  *
+ * For testing without hardware or daemon, SW channel can be looped back thru
+ * debugfs, either to the same mailbox instance or to another one. Msgs sent
+ * on SW channel then go straight to RX channel of the loopback peer. On top
+ * of it, a built-in benchmark drives requests of given sizes, concurrency and
+ * opcodes, which are echoed back by the peer without going to its listener.
+ *
  *
  * Software communication channel
  *
@@ -145,6 +246,16 @@
  * which sees only request and response buffers. It should only implement the
  * protocol defined in mailbox_proto.h.
  *
+ * Daemon carries msgs of software channel thru read() and write() on mailbox
+ * device node, one msg per call, or several per call once batch mode is on
+ * (XCL_MB_IOC_SW_BATCH). Msgs are queued in each direction up to a depth set
+ * via sysfs, so one stalled msg does not hold up the others.
+ *
+ * Alternatively, daemon can set up a pair of rings with XCL_MB_IOC_RING_SETUP
+ * and mmap() them. Msgs are then copied once between msg buffer and ring slot,
+ * and daemon is notified thru eventfd or poll(), so no syscall is needed per
+ * msg. Msgs too big for a ring slot still go thru read() and write().
+ *
  * The current protocol defined at communication layer followed a rule as below:
  * All requests initiated from user pf requires a response and all requests from
  * mgmt pf does not require a response. This should avoid any possible deadlock
@@ -163,8 +274,22 @@
 
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/completion.h>
 #include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/hashtable.h>
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/eventfd.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/semaphore.h>
+#include <linux/random.h>
+#include <linux/sort.h>
 #include <linux/poll.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
@@ -172,13 +297,21 @@
 #include <linux/io.h>
 #include <linux/ioctl.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 #include <linux/crc32c.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
 #include <linux/xrt/mailbox_transport.h>
+#include <linux/xrt/mailbox_proto.h>
 #include "metadata.h"
 #include "xleaf.h"
 #include "xleaf/mailbox.h"
 #include "xmgmt-main.h"
 
+#define CREATE_TRACE_POINTS
+#include "mailbox-trace.h"
+
 #define FLAG_STI		BIT(0)
 #define FLAG_RTI		BIT(1)
 
@@ -193,16 +326,82 @@
 #define MBX_INFO(mbx, fmt, arg...) xrt_info((mbx)->mbx_xdev, fmt "\n", ##arg)
 #define MBX_DBG(mbx, fmt, arg...) xrt_dbg((mbx)->mbx_xdev, fmt "\n", ##arg)
 
-#define MAILBOX_TTL_TIMER	(HZ / 10) /* in jiffies */
-#define MAILBOX_SEC2TTL(s)	((s) * HZ / MAILBOX_TTL_TIMER)
-#define MSG_MAX_TTL		INT_MAX /* used to disable TTL checking */
+#define MAILBOX_POLL_TIMER	(HZ / 10) /* in jiffies */
+#define MSG_NO_DEADLINE		U64_MAX
+/* Deadlines close to each other are handled on one timer event. */
+#define MBX_TIMER_SLACK_NS	NSEC_PER_MSEC
+/* Peer is probed after this much silence, and is down after missing a few probes. */
+#define MBX_HB_INTERVAL_MS	500
+#define MBX_HB_MAX_MISSED	3
+/* Heartbeat packets due on TX channel, bits of mbx_hb_flags. */
+#define MBX_HB_BIT_PING		0
+#define MBX_HB_BIT_PONG		1
 
 #define INVALID_MSG_ID		((u64)-1)
 
 #define MAX_MSG_QUEUE_LEN	5
+/* Max concurrent requests running in REQ pool, and handed over to it. */
+#define MBX_REQ_MAX_ACTIVE	4
+#define MBX_REQ_MAX_INFLIGHT	(MBX_REQ_MAX_ACTIVE * 2)
+#define MSG_IS_START(type)	((type) == PKT_MSG_START || (type) == PKT_MSG_START_PREEMPT)
+#define MBX_RESP_HASH_BITS	6
 #define MAX_REQ_MSG_SZ		(1024 * 1024)
+#define MBX_STREAM_CHUNK_SZ	(256 * 1024)
+
+/*
+ * Msgs are allocated from per-device mempools so that RX path always makes
+ * progress. Reserve enough for every queued or in-flight request plus current
+ * and parked msg on both channels. Payload up to a page comes from the pool as well,
+ * anything bigger is vmalloc'ed.
+ */
+#define MBX_MSG_POOL_MIN	(MAX_MSG_QUEUE_LEN + MBX_REQ_MAX_INFLIGHT + 4)
+#define MBX_MSG_INLINE_MAX	PAGE_SIZE
+
+/* Depth of SW channel queue in each direction, in msgs. */
+#define MBX_SW_QUEUE_DEPTH	16
+#define MBX_SW_QUEUE_MAX_DEPTH	256
+
+/* Limits of SW channel rings shared with daemon. */
+#define MBX_RING_MAX_SLOTS	1024
+#define MBX_RING_MAX_SIZE	(16 * 1024 * 1024)
+#define MBX_RING_HDR_SIZE	offsetof(struct xcl_sw_chan, data)
+
+/* Latency histograms have log2 buckets in us, the last one takes the rest. */
+#define MBX_HIST_BUCKETS	24
+/* Opcodes beyond this are accounted as unknown. */
+#define MBX_STATS_OPCODES	32
+
+/* Limits of built-in benchmark. */
+#define MBX_BENCH_MAX_MSGS	(1024 * 1024)
+#define MBX_BENCH_MAX_WINDOW	64
+#define MBX_BENCH_MAX_OPS	8
+#define MBX_BENCH_TTL		5 /* in sec */
+
+enum mailbox_msg_buf {
+	MSG_BUF_NONE,		/* no payload or caller's buffer */
+	MSG_BUF_POOL,
+	MSG_BUF_VMALLOC,
+};
+
+/* Max FIFO depth supported by mailbox IP, in DWORDs. */
+#define MBX_MAX_FIFO_DEPTH	8192
+/* Max packets pushed or drained on one worker pass. */
+#define MBX_MAX_BURST_PKTS	64
+/* Polling interval range (in us) when there is outstanding msg. */
+#define MBX_POLL_MIN_US		50
+#define MBX_POLL_MAX_US		1000
 
 #define MBX_SW_ONLY(mbx) (!(mbx)->mbx_regs)
+/* LZ4 compression is only offered when kernel has it. */
+#define MBX_LZ4_ENABLED		(IS_ENABLED(CONFIG_LZ4_COMPRESS) && \
+				 IS_ENABLED(CONFIG_LZ4_DECOMPRESS))
+#define MBX_LZ4_MIN_SIZE	1024
+#define MBX_LZ4_HDR_SIZE	sizeof(u32)
+
+/* Optional features this driver can negotiate with peer. */
+#define MBX_SUPPORTED_CAPS	(XCL_MB_CAP_PREEMPT | XCL_MB_CAP_COMPACT_HDR | \
+				 XCL_MB_CAP_HEARTBEAT | XCL_MB_CAP_CSUM | \
+				 (MBX_LZ4_ENABLED ? XCL_MB_CAP_LZ4 : 0))
 /*
  * Mailbox IP register layout
  */
@@ -226,36 +425,206 @@ struct mailbox_reg {
  */
 #define MSG_FLAG_RESPONSE	BIT(0)
 #define MSG_FLAG_REQUEST	BIT(1)
+/* Benchmark request, only honored on loopback. */
+#define MSG_FLAG_BENCH		BIT(2)
+/* Payload is LZ4 compressed, HW channel only. */
+#define MSG_FLAG_LZ4		BIT(3)
+/* crc32c of payload on the wire is in start packet, HW channel only. */
+#define MSG_FLAG_CSUM		BIT(4)
+#define MSG_FLAG_HW_ONLY	(MSG_FLAG_LZ4 | MSG_FLAG_CSUM)
 struct mailbox_msg {
 	struct list_head	mbm_list;
+	struct llist_node	mbm_lnode; /* on TX submission list */
+	struct hlist_node	mbm_hnode;
+	struct mailbox		*mbm_parent;
 	struct mailbox_channel	*mbm_ch;
 	u64			mbm_req_id;
 	char			*mbm_data;
 	size_t			mbm_len;
+	/* Compressed payload as sent or received on HW channel, if any. */
+	char			*mbm_zbuf;
+	size_t			mbm_zlen;
+	/* With MSG_FLAG_CSUM, crc32c as sent and as accumulated on RX. */
+	u32			mbm_csum;
+	u32			mbm_rx_csum;
+	enum mailbox_msg_buf	mbm_buf_type;
 	int			mbm_error;
 	struct completion	mbm_complete;
 	mailbox_msg_cb_t	mbm_cb;
 	void			*mbm_cb_arg;
 	u32			mbm_flags;
-	atomic_t		mbm_ttl;
+	u64			mbm_deadline; /* in ns, protected by mbc_mutex */
 	bool			mbm_chan_sw;
+	/* For request msg only, TTL of the response once request is sent. */
+	bool			mbm_wait_resp;
+	u32			mbm_resp_ttl;
+	/* For incoming request msg handled by REQ pool only. */
+	struct work_struct	mbm_work;
+	/* For TX msg only. */
+	enum xrt_mailbox_prio	mbm_prio;
+	bool			mbm_preempt;
+	/* For TX msg and response slot, when it is queued. */
+	u64			mbm_enqueue_ts;
+	/* For response slot only, opcode of the request. */
+	u32			mbm_opcode;
+
+	/* For incoming request too big to be buffered. */
+	struct mailbox_stream	*mbm_stream;
 
 	/* Statistics for debugging. */
 	u64			mbm_num_pkts;
 	u64			mbm_start_ts;
+	u64			mbm_first_pkt_ts;
 	u64			mbm_end_ts;
 };
 
+struct mailbox_hist {
+	u64			mh_cnt[MBX_HIST_BUCKETS];
+};
+
+/* A request being streamed to listener, double buffered. */
+struct mailbox_stream {
+	struct mailbox		*ms_parent;
+	struct work_struct	ms_work;
+	/* Args of the call in flight, or next one. */
+	struct xrt_mailbox_stream ms_st;
+	char			*ms_buf[2];
+	int			ms_cur; /* buffer being filled */
+	size_t			ms_fill;
+	size_t			ms_off; /* offset in request of current buffer */
+	int			ms_err; /* set by listener, rest is dropped */
+};
+
+/* Stats of msgs going thru one type of channel, RX/TX and HW/SW. */
+struct mailbox_class_stats {
+	u64			mcls_msgs;
+	u64			mcls_bytes;
+	u64			mcls_pkts;
+	u64			mcls_errors;
+	u64			mcls_timeouts;
+	/* From being queued to first packet, TX only. */
+	struct mailbox_hist	mcls_queue_lat;
+	/* From first packet to last one. */
+	struct mailbox_hist	mcls_xfer_lat;
+};
+
+struct mailbox_op_stats {
+	u64			mos_tx_reqs;
+	u64			mos_rx_reqs;
+	u64			mos_timeouts;
+	/* From request being queued to response being received. */
+	struct mailbox_hist	mos_rtt;
+};
+
+/* Compressed msgs, sizes are in bytes and time is in ns. */
+struct mailbox_lz4_stats {
+	u64			mls_msgs;
+	u64			mls_raw;
+	u64			mls_wire;
+	u64			mls_ns;
+	/* TX msgs not sent compressed since it did not make them smaller. */
+	u64			mls_skipped;
+};
+
+/* Aggregated stats exported thru debugfs, protected by ms_lock. */
+struct mailbox_stats {
+	spinlock_t		ms_lock; /* stats lock */
+	struct mailbox_class_stats ms_class[2][2]; /* [is_rx][is_sw] */
+	struct mailbox_op_stats	ms_op[MBX_STATS_OPCODES];
+	u32			ms_max_resp_pending;
+	u32			ms_max_req_pending;
+	u32			ms_max_req_inflight;
+	u32			ms_max_sw_q[2]; /* [is_rx] */
+	struct mailbox_lz4_stats ms_lz4[2]; /* [is_rx] */
+	u64			ms_csum_errors;
+};
+
+/* A msg queued in SW channel, laid out as seen by daemon. */
+struct mailbox_sw_rec {
+	struct list_head	msr_list;
+	struct xcl_sw_chan	msr_chan; /* must be the last, payload follows */
+};
+
+/* Result of last benchmark run. Latency percentiles are in ns. */
+enum mailbox_bench_pct {
+	MBX_BENCH_P50,
+	MBX_BENCH_P90,
+	MBX_BENCH_P99,
+	MBX_BENCH_P999,
+	MBX_BENCH_MAX,
+	MBX_BENCH_PCT_NUM
+};
+
+struct mailbox_bench_res {
+	u32			mbr_msgs;
+	u32			mbr_min_size;
+	u32			mbr_max_size;
+	u32			mbr_window;
+	u64			mbr_errors;
+	u64			mbr_bytes;
+	u64			mbr_elapsed_ns;
+	u64			mbr_lat[MBX_BENCH_PCT_NUM];
+};
+
+/*
+ * SW channel rings shared with daemon. Geometry is kept here, never trusting
+ * what is in the shared header. Driver is the producer of TX ring and the
+ * consumer of RX ring, so it also keeps its own copy of those indices.
+ */
+struct mailbox_ring {
+	void			*mr_buf;
+	size_t			mr_size;
+	u32			mr_nr_slots;
+	u32			mr_slot_size;
+	struct xcl_sw_ring	*mr_tx;
+	struct xcl_sw_ring	*mr_rx;
+	u32			mr_tx_prod;
+	u32			mr_rx_cons;
+	bool			mr_broken;
+	struct eventfd_ctx	*mr_evt;
+};
+
 /* Mailbox communication channel state. */
 #define MBXCS_BIT_READY		0
 #define MBXCS_BIT_STOP		1
 #define MBXCS_BIT_TICK		2
+#define MBXCS_BIT_PEER_DOWN	3
 
 enum mailbox_chan_type {
 	MBXCT_RX,
 	MBXCT_TX
 };
 
+/* Transfer statistics, only updated by channel worker. */
+struct mailbox_chan_stats {
+	u64			mcs_msgs;
+	u64			mcs_pkts;
+	u64			mcs_bytes;
+	u64			mcs_busy_ns;
+};
+
+/* TX queue statistics per priority, only updated by TX worker. */
+struct mailbox_prio_stats {
+	u32			mps_depth;
+	u32			mps_max_depth;
+	u64			mps_msgs;
+	u64			mps_wait_ns;
+	u64			mps_max_wait_ns;
+};
+
+/* Order in which TX queues are served. */
+static const enum xrt_mailbox_prio tx_prio_order[] = {
+	XRT_MAILBOX_PRIO_CONTROL,
+	XRT_MAILBOX_PRIO_INTERACTIVE,
+	XRT_MAILBOX_PRIO_BULK,
+};
+
+static const char * const tx_prio_names[] = {
+	[XRT_MAILBOX_PRIO_INTERACTIVE] = "interactive",
+	[XRT_MAILBOX_PRIO_CONTROL] = "control",
+	[XRT_MAILBOX_PRIO_BULK] = "bulk",
+};
+
 struct mailbox_channel;
 typedef	bool (*chan_func_t)(struct mailbox_channel *ch);
 struct mailbox_channel {
@@ -267,25 +636,39 @@ struct mailbox_channel {
 	struct completion	mbc_worker;
 	chan_func_t		mbc_tran;
 	unsigned long		mbc_state;
+	u32			mbc_poll_us;
+
+	/* Fires at the earliest deadline of all msgs in the channel. */
+	struct hrtimer		mbc_timer;
+	u64			mbc_deadline;
 
 	struct mutex		mbc_mutex; /* lock for hw channel */
-	struct list_head	mbc_msgs;
+	/* Msgs submitted to TX channel, not yet in mbc_msgs. */
+	struct llist_head	mbc_submit;
+	atomic_t		mbc_submitting; /* submitters past STOP check */
+	/* Msgs to be sent on TX channel, one queue per priority, TX worker only. */
+	struct list_head	mbc_msgs[XRT_MAILBOX_PRIO_MAX];
+	struct mailbox_prio_stats mbc_prio_stats[XRT_MAILBOX_PRIO_MAX];
+	/* Buffers waiting for responses on RX channel, keyed by msg ID. */
+	DECLARE_HASHTABLE(mbc_resp_tbl, MBX_RESP_HASH_BITS);
+	u32			mbc_resp_cnt;
 
 	struct mailbox_msg	*mbc_cur_msg;
 	int			mbc_bytes_done;
+	/* Msg put aside by a preempting msg and its progress. */
+	struct mailbox_msg	*mbc_parked_msg;
+	int			mbc_parked_bytes_done;
 	struct mailbox_pkt	mbc_packet;
+	struct mailbox_chan_stats mbc_stats;
 
 	/*
 	 * Software channel settings
 	 */
 	wait_queue_head_t	sw_chan_wq;
 	struct mutex		sw_chan_mutex; /* lock for sw channel */
-	void			*sw_chan_buf;
-	size_t			sw_chan_buf_sz;
-	u64			sw_chan_msg_id;
-	u64			sw_chan_msg_flags;
-
-	atomic_t		sw_num_pending_msg;
+	struct list_head	sw_chan_q;
+	u32			sw_chan_q_len;
+	u32			sw_chan_q_depth;
 };
 
 /*
@@ -296,15 +679,41 @@ struct mailbox {
 	struct timer_list	mbx_poll_timer;
 	struct mailbox_reg	*mbx_regs;
 
+	/* Linux irq number, negative if interrupt is not available. */
+	int			mbx_irq;
+	bool			mbx_intr_on;
+	/* HW FIFO depth in DWORDs. */
+	u32			mbx_fifo_depth;
+	/* Peer understands PKT_MSG_START_PREEMPT. */
+	bool			mbx_preempt;
+	/* XCL_MB_CAP_* agreed with peer. */
+	u32			mbx_caps;
+
+	/* Peer liveness, see MBX_HB_INTERVAL_MS. */
+	struct delayed_work	mbx_hb_work;
+	u64			mbx_hb_seen_ns; /* last sign of life from peer */
+	u32			mbx_hb_missed;
+	unsigned long		mbx_hb_flags;
+	bool			mbx_peer_down;
+
 	struct mailbox_channel	mbx_rx;
 	struct mailbox_channel	mbx_tx;
 
 	/* For listening to peer's request. */
 	mailbox_msg_cb_t	mbx_listen_cb;
+	mailbox_req_class_t	mbx_listen_concurrent;
+	mailbox_stream_cb_t	mbx_listen_stream;
 	void			*mbx_listen_cb_arg;
-	struct mutex		mbx_listen_cb_lock; /* listen callback lock */
+	struct rw_semaphore	mbx_listen_cb_lock; /* listen callback lock */
 	struct workqueue_struct	*mbx_listen_wq;
 	struct work_struct	mbx_listen_worker;
+	/* REQ pool for requests which can be handled concurrently. */
+	struct workqueue_struct	*mbx_req_wq;
+	atomic_t		mbx_req_inflight;
+	wait_queue_head_t	mbx_req_wait;
+	/* Ordered queue for serial requests, draining REQ pool before each. */
+	struct workqueue_struct	*mbx_serial_wq;
+	atomic_t		mbx_serial_draining;
 
 	/*
 	 * For testing basic intr and mailbox comm functionality via sysfs.
@@ -312,16 +721,41 @@ struct mailbox {
 	 */
 	struct mailbox_pkt	mbx_tst_pkt;
 
+	/* Source of msg IDs. */
+	atomic64_t		mbx_next_req_id;
+
 	/* Req list for all incoming request message */
 	struct completion	mbx_comp;
 	struct mutex		mbx_lock; /* incoming request list lock */
+	mempool_t		*mbx_msg_pool;
+	mempool_t		*mbx_buf_pool;
 	struct list_head	mbx_req_list;
 	u32			mbx_req_cnt;
 	bool			mbx_listen_stop;
 
 	u64			mbx_opened;
+	/* Daemon moves multiple msgs per read() and write(). */
+	bool			mbx_sw_batch;
+
+	/* SW channel rings, set up by daemon after open. */
+	struct mutex		mbx_ring_lock; /* ring setup and access lock */
+	struct mailbox_ring	*mbx_ring;
+	wait_queue_head_t	mbx_ring_wq;
+
+	struct mailbox_stats	mbx_stats;
+	struct dentry		*mbx_debugfs;
+
+	/* On mailbox_list, SW channel loopback peer is protected by its lock. */
+	struct list_head	mbx_node;
+	struct mailbox		*mbx_lb_peer;
+	struct mutex		mbx_bench_lock; /* one benchmark run at a time */
+	struct mailbox_bench_res mbx_bench_res;
 };
 
+/* All mailbox instances, for pairing up loopback peers. */
+static LIST_HEAD(mailbox_list);
+static DEFINE_MUTEX(mailbox_list_lock);
+
 static inline const char *reg2name(struct mailbox *mbx, u32 *reg)
 {
 	static const char * const reg_names[] = {
@@ -367,6 +801,22 @@ static inline bool valid_pkt(struct mailbox_pkt *pkt)
 	return (pkt->hdr.type != PKT_INVALID);
 }
 
+static inline bool is_compact_pkt(struct mailbox_pkt *pkt)
+{
+	return (pkt->hdr.type & PKT_TYPE_MASK) == PKT_MSG_BODY_COMPACT;
+}
+
+static inline u32 pkt_payload_size(struct mailbox_pkt *pkt)
+{
+	return is_compact_pkt(pkt) ? PKT_COMPACT_SIZE(pkt->hdr.type) : pkt->hdr.payload_size;
+}
+
+/* Compact body packet has its payload right after type. */
+static inline void *pkt_body_payload(struct mailbox_pkt *pkt)
+{
+	return is_compact_pkt(pkt) ? (void *)&pkt->hdr.payload_size : pkt->body.msg_body.payload;
+}
+
 static inline bool is_rx_chan(struct mailbox_channel *ch)
 {
 	return ch->mbc_type == MBXCT_RX;
@@ -382,47 +832,486 @@ static bool is_rx_msg(struct mailbox_msg *msg)
 	return is_rx_chan(msg->mbm_ch);
 }
 
-static void chan_tick(struct mailbox_channel *ch)
+static inline const char *mbx_name(struct mailbox *mbx)
 {
-	mutex_lock(&ch->mbc_mutex);
+	return dev_name(DEV(mbx->mbx_xdev));
+}
+
+static void hist_add(struct mailbox_hist *h, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	h->mh_cnt[min_t(u32, fls64(us), MBX_HIST_BUCKETS - 1)]++;
+}
+
+/* Opcode of a request msg, taken from the payload. */
+static u32 msg_req_opcode(struct mailbox_msg *msg)
+{
+	struct xcl_mailbox_req *req = (struct xcl_mailbox_req *)msg->mbm_data;
+
+	/* Streamed request is never seen as a whole. */
+	if (!req || msg->mbm_len < offsetof(struct xcl_mailbox_req, data) ||
+	    req->req >= MBX_STATS_OPCODES)
+		return XCL_MAILBOX_REQ_UNKNOWN;
+	return req->req;
+}
+
+static void stats_hwm(struct mailbox *mbx, u32 *hwm, u32 val)
+{
+	spin_lock(&mbx->mbx_stats.ms_lock);
+	*hwm = max(*hwm, val);
+	spin_unlock(&mbx->mbx_stats.ms_lock);
+}
+
+static void stats_msg_done(struct mailbox *mbx, struct mailbox_msg *msg, int err)
+{
+	struct mailbox_stats *st = &mbx->mbx_stats;
+	bool rx = is_rx_msg(msg);
+	bool req = msg->mbm_flags & MSG_FLAG_REQUEST;
+	struct mailbox_class_stats *cls = &st->ms_class[rx][msg->mbm_chan_sw];
+	struct mailbox_op_stats *op = NULL;
+
+	/* RX msg w/o request flag is a response slot. */
+	if (req && (!rx || !err))
+		op = &st->ms_op[msg_req_opcode(msg)];
+	else if (rx && !req)
+		op = &st->ms_op[msg->mbm_opcode];
+
+	spin_lock(&st->ms_lock);
+	if (err) {
+		cls->mcls_errors++;
+		if (err == -ETIMEDOUT)
+			cls->mcls_timeouts++;
+	} else {
+		cls->mcls_msgs++;
+		cls->mcls_bytes += msg->mbm_len;
+		cls->mcls_pkts += msg->mbm_num_pkts;
+		if (msg->mbm_first_pkt_ts) {
+			if (!rx)
+				hist_add(&cls->mcls_queue_lat,
+					 msg->mbm_first_pkt_ts - msg->mbm_enqueue_ts);
+			hist_add(&cls->mcls_xfer_lat, msg->mbm_end_ts - msg->mbm_first_pkt_ts);
+		}
+	}
+	if (op && req) {
+		if (rx)
+			op->mos_rx_reqs++;
+		else
+			op->mos_tx_reqs++;
+	} else if (op) {
+		if (!err)
+			hist_add(&op->mos_rtt, msg->mbm_end_ts - msg->mbm_enqueue_ts);
+		else if (err == -ETIMEDOUT)
+			op->mos_timeouts++;
+	}
+	spin_unlock(&st->ms_lock);
+}
+
+static void msg_first_pkt(struct mailbox_channel *ch, struct mailbox_msg *msg)
+{
+	msg->mbm_first_pkt_ts = ktime_get_ns();
+	trace_xrt_mailbox_msg_first_pkt(mbx_name(ch->mbc_parent), ch_name(ch), msg->mbm_chan_sw,
+					msg->mbm_req_id, msg->mbm_len);
+}
+
+static void msg_last_pkt(struct mailbox_channel *ch, struct mailbox_msg *msg)
+{
+	trace_xrt_mailbox_msg_last_pkt(mbx_name(ch->mbc_parent), ch_name(ch), msg->mbm_chan_sw,
+				       msg->mbm_req_id, msg->mbm_len);
+}
+
+/* Deadline of a msg is reached, let channel worker check all msgs. */
+static enum hrtimer_restart chan_timer(struct hrtimer *timer)
+{
+	struct mailbox_channel *ch = container_of(timer, struct mailbox_channel, mbc_timer);
 
 	set_bit(MBXCS_BIT_TICK, &ch->mbc_state);
 	complete(&ch->mbc_worker);
+	return HRTIMER_NORESTART;
+}
 
-	mutex_unlock(&ch->mbc_mutex);
+/* Make sure channel timer fires no later than deadline. */
+static void chan_timer_arm(struct mailbox_channel *ch, u64 deadline)
+{
+	WARN_ON(!mutex_is_locked(&ch->mbc_mutex));
+
+	if (deadline >= ch->mbc_deadline)
+		return;
+	ch->mbc_deadline = deadline;
+	hrtimer_start_range_ns(&ch->mbc_timer, ns_to_ktime(deadline), MBX_TIMER_SLACK_NS,
+			       HRTIMER_MODE_ABS);
+}
+
+/* Wake up channel worker without checking deadlines. */
+static inline void chan_kick(struct mailbox_channel *ch)
+{
+	complete(&ch->mbc_worker);
+}
+
+/* Racy, only used to decide whether to keep polling or not. */
+static bool chan_busy(struct mailbox_channel *ch)
+{
+	int i;
+
+	if (READ_ONCE(ch->mbc_cur_msg) || READ_ONCE(ch->mbc_resp_cnt) ||
+	    !llist_empty(&ch->mbc_submit))
+		return true;
+	for (i = 0; i < XRT_MAILBOX_PRIO_MAX; i++) {
+		if (READ_ONCE(ch->mbc_prio_stats[i].mps_depth))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * HW needs to be polled when interrupt is off. In interrupt mode, only poll
+ * while msgs are in flight in case an interrupt is lost.
+ */
+static bool mailbox_need_poll(struct mailbox *mbx)
+{
+	if (MBX_SW_ONLY(mbx))
+		return false;
+	return !READ_ONCE(mbx->mbx_intr_on) || chan_busy(&mbx->mbx_tx) ||
+		chan_busy(&mbx->mbx_rx);
+}
+
+static void mailbox_poll_start(struct mailbox *mbx)
+{
+	if (mailbox_need_poll(mbx) && !timer_pending(&mbx->mbx_poll_timer))
+		mod_timer(&mbx->mbx_poll_timer, jiffies + MAILBOX_POLL_TIMER);
 }
 
 static void mailbox_poll_timer(struct timer_list *t)
 {
 	struct mailbox *mbx = from_timer(mbx, t, mbx_poll_timer);
 
-	chan_tick(&mbx->mbx_tx);
-	chan_tick(&mbx->mbx_rx);
+	chan_kick(&mbx->mbx_tx);
+	chan_kick(&mbx->mbx_rx);
 
-	/* We're a periodic timer. */
-	mutex_lock(&mbx->mbx_lock);
-	mod_timer(&mbx->mbx_poll_timer, jiffies + MAILBOX_TTL_TIMER);
-	mutex_unlock(&mbx->mbx_lock);
+	if (mailbox_need_poll(mbx))
+		mod_timer(&mbx->mbx_poll_timer, jiffies + MAILBOX_POLL_TIMER);
 }
 
+/* Shared by all mailbox instances, each of which keeps its own reserve. */
+static struct kmem_cache *mailbox_msg_cache;
+
 static void free_msg(struct mailbox_msg *msg)
 {
-	vfree(msg);
+	struct mailbox *mbx = msg->mbm_parent;
+
+	kvfree(msg->mbm_zbuf);
+
+	if (msg->mbm_buf_type == MSG_BUF_POOL)
+		mempool_free(msg->mbm_data, mbx->mbx_buf_pool);
+	else if (msg->mbm_buf_type == MSG_BUF_VMALLOC)
+		vfree(msg->mbm_data);
+	mempool_free(msg, mbx->mbx_msg_pool);
+}
+
+/* Payload as it goes thru HW channel, compressed or not. */
+static inline char *msg_wire_data(struct mailbox_msg *msg)
+{
+	return msg->mbm_zbuf ? msg->mbm_zbuf : msg->mbm_data;
+}
+
+static inline size_t msg_wire_len(struct mailbox_msg *msg)
+{
+	return msg->mbm_zbuf ? msg->mbm_zlen : msg->mbm_len;
+}
+
+static inline void msg_set_wire_len(struct mailbox_msg *msg, size_t len)
+{
+	if (msg->mbm_zbuf)
+		msg->mbm_zlen = len;
+	else
+		msg->mbm_len = len;
+}
+
+static void stats_lz4(struct mailbox *mbx, bool is_rx, size_t raw, size_t wire, u64 ns)
+{
+	struct mailbox_lz4_stats *st = &mbx->mbx_stats.ms_lz4[is_rx];
+
+	spin_lock(&mbx->mbx_stats.ms_lock);
+	if (wire) {
+		st->mls_msgs++;
+		st->mls_raw += raw;
+		st->mls_wire += wire;
+	} else {
+		st->mls_skipped++;
+	}
+	st->mls_ns += ns;
+	spin_unlock(&mbx->mbx_stats.ms_lock);
+}
+
+/*
+ * Compress TX msg going thru HW channel, if peer takes it. Msg is sent as it
+ * is when compression fails or does not save anything.
+ */
+static void msg_compress(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	size_t bound = LZ4_compressBound(msg->mbm_len) + MBX_LZ4_HDR_SIZE;
+	u64 start = ktime_get_ns();
+	void *wrkmem;
+	char *zbuf;
+	int zlen = 0;
+
+	if (!MBX_LZ4_ENABLED || !(READ_ONCE(mbx->mbx_caps) & XCL_MB_CAP_LZ4) ||
+	    msg->mbm_chan_sw || msg->mbm_len < MBX_LZ4_MIN_SIZE || msg->mbm_len >= MAX_REQ_MSG_SZ)
+		return;
+
+	zbuf = kvmalloc(bound, GFP_KERNEL);
+	wrkmem = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+	if (zbuf && wrkmem) {
+		zlen = LZ4_compress_default(msg->mbm_data, zbuf + MBX_LZ4_HDR_SIZE, msg->mbm_len,
+					    bound - MBX_LZ4_HDR_SIZE, wrkmem);
+	}
+	kvfree(wrkmem);
+
+	if (zlen <= 0 || zlen + MBX_LZ4_HDR_SIZE >= msg->mbm_len) {
+		kvfree(zbuf);
+		stats_lz4(mbx, false, msg->mbm_len, 0, ktime_get_ns() - start);
+		return;
+	}
+
+	put_unaligned_le32(msg->mbm_len, zbuf);
+	msg->mbm_zbuf = zbuf;
+	msg->mbm_zlen = zlen + MBX_LZ4_HDR_SIZE;
+	msg->mbm_flags |= MSG_FLAG_LZ4;
+	stats_lz4(mbx, false, msg->mbm_len, msg->mbm_zlen, ktime_get_ns() - start);
+}
+
+/* Checksum TX msg going thru HW channel, if peer checks it. */
+static void msg_csum(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	if (!(READ_ONCE(mbx->mbx_caps) & XCL_MB_CAP_CSUM) || msg->mbm_chan_sw)
+		return;
+
+	msg->mbm_csum = crc32c(~0, msg_wire_data(msg), msg_wire_len(msg));
+	msg->mbm_flags |= MSG_FLAG_CSUM;
+}
+
+/*
+ * Decompress fully received RX msg. Request gets a buffer of original size,
+ * response must fit in the one provided by caller.
+ */
+static int msg_decompress(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	u64 start = ktime_get_ns();
+	size_t len;
+	int ret;
+
+	if (!MBX_LZ4_ENABLED || msg->mbm_zlen <= MBX_LZ4_HDR_SIZE)
+		return -EBADMSG;
+
+	len = get_unaligned_le32(msg->mbm_zbuf);
+	if (msg->mbm_flags & MSG_FLAG_REQUEST) {
+		if (!len || len >= MAX_REQ_MSG_SZ)
+			return -EMSGSIZE;
+		msg->mbm_data = vmalloc(len);
+		if (!msg->mbm_data)
+			return -ENOMEM;
+		msg->mbm_buf_type = MSG_BUF_VMALLOC;
+	} else if (len > msg->mbm_len) {
+		return -EMSGSIZE;
+	}
+
+	ret = LZ4_decompress_safe(msg->mbm_zbuf + MBX_LZ4_HDR_SIZE, msg->mbm_data,
+				  msg->mbm_zlen - MBX_LZ4_HDR_SIZE, len);
+	if (ret != len)
+		return -EBADMSG;
+	msg->mbm_len = len;
+
+	stats_lz4(mbx, true, len, msg->mbm_zlen, ktime_get_ns() - start);
+	return 0;
+}
+
+static void mailbox_serial_drain(struct mailbox *mbx);
+
+/*
+ * Hand a chunk of streamed request over to listener. Runs on REQ pool, calls
+ * for one stream never overlap. Stream is freed after the last call, which
+ * completes the request, so it runs on SERIAL queue as any serial request.
+ */
+static void stream_work(struct work_struct *work)
+{
+	struct mailbox_stream *ms = container_of(work, struct mailbox_stream, ms_work);
+	struct mailbox *mbx = ms->ms_parent;
+	struct xrt_mailbox_stream *st = &ms->ms_st;
+	int rc = -ESHUTDOWN;
+
+	if (st->xmis_last)
+		mailbox_serial_drain(mbx);
+
+	down_read(&mbx->mbx_listen_cb_lock);
+	if (mbx->mbx_listen_stream)
+		rc = mbx->mbx_listen_stream(mbx->mbx_listen_cb_arg, st);
+	up_read(&mbx->mbx_listen_cb_lock);
+
+	if (st->xmis_last) {
+		kvfree(ms->ms_buf[0]);
+		kvfree(ms->ms_buf[1]);
+		kfree(ms);
+		return;
+	}
+
+	if (rc) {
+		MBX_ERR(mbx, "stream (id 0x%llx) stopped at %zu: %d",
+			st->xmis_req_id, st->xmis_offset, rc);
+		WRITE_ONCE(ms->ms_err, rc);
+	}
+}
+
+static struct mailbox_stream *stream_alloc(struct mailbox *mbx, u64 id, size_t sz)
+{
+	struct mailbox_stream *ms;
+	bool listening;
+
+	down_read(&mbx->mbx_listen_cb_lock);
+	listening = mbx->mbx_listen_stream;
+	up_read(&mbx->mbx_listen_cb_lock);
+	if (!listening)
+		return NULL;
+
+	ms = kzalloc(sizeof(*ms), GFP_KERNEL);
+	if (!ms)
+		return NULL;
+	ms->ms_buf[0] = kvmalloc(MBX_STREAM_CHUNK_SZ, GFP_KERNEL);
+	ms->ms_buf[1] = kvmalloc(MBX_STREAM_CHUNK_SZ, GFP_KERNEL);
+	if (!ms->ms_buf[0] || !ms->ms_buf[1]) {
+		kvfree(ms->ms_buf[0]);
+		kvfree(ms->ms_buf[1]);
+		kfree(ms);
+		return NULL;
+	}
+	ms->ms_parent = mbx;
+	ms->ms_st.xmis_req_id = id;
+	ms->ms_st.xmis_total = sz;
+	INIT_WORK(&ms->ms_work, stream_work);
+	return ms;
+}
+
+/*
+ * Queue the buffer being filled and switch to the other one, which is free
+ * once the previous call returns.
+ */
+static void stream_submit(struct mailbox_msg *msg, bool last, int err)
+{
+	struct mailbox_stream *ms = msg->mbm_stream;
+	struct xrt_mailbox_stream *st = &ms->ms_st;
+
+	flush_work(&ms->ms_work);
+
+	st->xmis_sw_ch = msg->mbm_chan_sw;
+	st->xmis_data = ms->ms_buf[ms->ms_cur];
+	st->xmis_offset = ms->ms_off;
+	st->xmis_len = ms->ms_fill;
+	st->xmis_last = last;
+	st->xmis_err = err;
+
+	ms->ms_off += ms->ms_fill;
+	ms->ms_fill = 0;
+	ms->ms_cur ^= 1;
+	queue_work(last ? ms->ms_parent->mbx_serial_wq : ms->ms_parent->mbx_req_wq,
+		   &ms->ms_work);
+}
+
+static void stream_write(struct mailbox_msg *msg, const char *data, size_t len)
+{
+	struct mailbox_stream *ms = msg->mbm_stream;
+
+	while (len) {
+		size_t cnt = min(len, MBX_STREAM_CHUNK_SZ - ms->ms_fill);
+
+		memcpy(ms->ms_buf[ms->ms_cur] + ms->ms_fill, data, cnt);
+		ms->ms_fill += cnt;
+		data += cnt;
+		len -= cnt;
+
+		if (ms->ms_fill < MBX_STREAM_CHUNK_SZ)
+			continue;
+		/* Listener has given up, just drain the rest. */
+		if (READ_ONCE(ms->ms_err))
+			ms->ms_fill = 0;
+		else
+			stream_submit(msg, false, 0);
+	}
+}
+
+/* Last call tells listener whether the whole request has made it. */
+static void stream_end(struct mailbox_msg *msg, int err)
+{
+	struct mailbox_stream *ms = msg->mbm_stream;
+
+	flush_work(&ms->ms_work);
+	if (!err)
+		err = READ_ONCE(ms->ms_err);
+	if (err)
+		ms->ms_fill = 0;
+	stream_submit(msg, true, err);
+	msg->mbm_stream = NULL;
+}
+
+/* Copy received payload to its place, msg buffer or stream. */
+static void msg_rx_copy(struct mailbox_msg *msg, size_t off, const void *data, size_t len)
+{
+	if (msg->mbm_stream)
+		stream_write(msg, data, len);
+	else
+		memcpy(msg_wire_data(msg) + off, data, len);
 }
 
+static void resp_timer_on(struct mailbox *mbx, struct mailbox_msg *reqmsg, int err);
+
 static void msg_done(struct mailbox_msg *msg, int err)
 {
 	struct mailbox_channel *ch = msg->mbm_ch;
 	struct mailbox *mbx = ch->mbc_parent;
 	u64 elapsed = (msg->mbm_end_ts - msg->mbm_start_ts) / 1000; /* in us. */
+	u64 begin = msg->mbm_enqueue_ts ? msg->mbm_enqueue_ts : msg->mbm_start_ts;
+
+	if (!err && is_rx_msg(msg) && (msg->mbm_flags & MSG_FLAG_CSUM) &&
+	    msg->mbm_rx_csum != msg->mbm_csum) {
+		MBX_ERR(mbx, "msg (id 0x%llx) checksum mismatch: 0x%x, expecting 0x%x",
+			msg->mbm_req_id, msg->mbm_rx_csum, msg->mbm_csum);
+		spin_lock(&mbx->mbx_stats.ms_lock);
+		mbx->mbx_stats.ms_csum_errors++;
+		spin_unlock(&mbx->mbx_stats.ms_lock);
+		err = -EBADMSG;
+	}
+
+	if (!err && is_rx_msg(msg) && msg->mbm_zbuf) {
+		err = msg_decompress(mbx, msg);
+		if (err)
+			MBX_ERR(mbx, "failed to decompress msg (id 0x%llx): %d",
+				msg->mbm_req_id, err);
+	}
+
+	stats_msg_done(mbx, msg, err);
+	trace_xrt_mailbox_msg_done(mbx_name(mbx), ch_name(ch), msg->mbm_chan_sw, msg->mbm_req_id,
+				   msg->mbm_len, msg->mbm_num_pkts,
+				   msg->mbm_end_ts ? msg->mbm_end_ts - begin : 0, err);
+
+	if (msg->mbm_stream) {
+		MBX_INFO(mbx, "streamed msg(id=0x%llx sz=%zuB): %s %lldpkts in %lldus: %d",
+			 msg->mbm_req_id, msg->mbm_len, ch_name(ch), msg->mbm_num_pkts,
+			 elapsed, err);
+		stream_end(msg, err);
+		free_msg(msg);
+		return;
+	}
 
-	MBX_INFO(ch->mbc_parent, "msg(id=0x%llx sz=%zuB crc=0x%x): %s %lldpkts in %lldus: %d",
-		 msg->mbm_req_id, msg->mbm_len,
-		 crc32c_le(~0, msg->mbm_data, msg->mbm_len),
-		 ch_name(ch), msg->mbm_num_pkts, elapsed, err);
+	MBX_INFO(ch->mbc_parent, "msg(id=0x%llx sz=%zuB): %s %lldpkts in %lldus: %d",
+		 msg->mbm_req_id, msg->mbm_len, ch_name(ch), msg->mbm_num_pkts, elapsed, err);
 
 	msg->mbm_error = err;
 
+	/* Request is out, start the clock for its response or fail it now. */
+	if (!is_rx_msg(msg) && msg->mbm_wait_resp) {
+		resp_timer_on(mbx, msg, err);
+		free_msg(msg);
+		return;
+	}
+
 	if (msg->mbm_cb) {
 		msg->mbm_cb(msg->mbm_cb_arg, msg->mbm_data, msg->mbm_len,
 			    msg->mbm_req_id, msg->mbm_error, msg->mbm_chan_sw);
@@ -441,6 +1330,7 @@ static void msg_done(struct mailbox_msg *msg, int err)
 			mutex_lock(&ch->mbc_parent->mbx_lock);
 			list_add_tail(&msg->mbm_list, &ch->mbc_parent->mbx_req_list);
 			mbx->mbx_req_cnt++;
+			stats_hwm(mbx, &mbx->mbx_stats.ms_max_req_pending, mbx->mbx_req_cnt);
 			mutex_unlock(&ch->mbc_parent->mbx_lock);
 			complete(&ch->mbc_parent->mbx_comp);
 		}
@@ -449,16 +1339,54 @@ static void msg_done(struct mailbox_msg *msg, int err)
 	}
 }
 
-static void reset_sw_ch(struct mailbox_channel *ch)
+static struct mailbox_sw_rec *sw_rec_alloc(size_t sz)
+{
+	return kvmalloc(sizeof(struct mailbox_sw_rec) + sz, GFP_KERNEL);
+}
+
+static void sw_rec_free(struct mailbox_sw_rec *rec)
+{
+	kvfree(rec);
+}
+
+static void sw_queue_push(struct mailbox_channel *ch, struct mailbox_sw_rec *rec)
+{
+	WARN_ON(!mutex_is_locked(&ch->sw_chan_mutex));
+
+	list_add_tail(&rec->msr_list, &ch->sw_chan_q);
+	WRITE_ONCE(ch->sw_chan_q_len, ch->sw_chan_q_len + 1);
+	stats_hwm(ch->mbc_parent, &ch->mbc_parent->mbx_stats.ms_max_sw_q[is_rx_chan(ch)],
+		  ch->sw_chan_q_len);
+}
+
+static struct mailbox_sw_rec *sw_queue_pop(struct mailbox_channel *ch)
 {
+	struct mailbox_sw_rec *rec;
+
 	WARN_ON(!mutex_is_locked(&ch->sw_chan_mutex));
 
-	vfree(ch->sw_chan_buf);
-	ch->sw_chan_buf = NULL;
-	ch->sw_chan_buf_sz = 0;
-	ch->sw_chan_msg_flags = 0;
-	ch->sw_chan_msg_id = 0;
-	atomic_dec_if_positive(&ch->sw_num_pending_msg);
+	rec = list_first_entry_or_null(&ch->sw_chan_q, struct mailbox_sw_rec, msr_list);
+	if (rec) {
+		list_del(&rec->msr_list);
+		WRITE_ONCE(ch->sw_chan_q_len, ch->sw_chan_q_len - 1);
+	}
+	return rec;
+}
+
+static inline bool sw_queue_full(struct mailbox_channel *ch)
+{
+	return READ_ONCE(ch->sw_chan_q_len) >= READ_ONCE(ch->sw_chan_q_depth);
+}
+
+static void reset_sw_ch(struct mailbox_channel *ch)
+{
+	struct mailbox_sw_rec *rec;
+
+	mutex_lock(&ch->sw_chan_mutex);
+	while ((rec = sw_queue_pop(ch)))
+		sw_rec_free(rec);
+	mutex_unlock(&ch->sw_chan_mutex);
+	wake_up_interruptible(&ch->sw_chan_wq);
 }
 
 static void reset_hw_ch(struct mailbox_channel *ch)
@@ -477,62 +1405,152 @@ static void chan_msg_done(struct mailbox_channel *ch, int err)
 		return;
 
 	ch->mbc_cur_msg->mbm_end_ts = ktime_get_ns();
-	if (err) {
-		if (ch->mbc_cur_msg->mbm_chan_sw) {
-			mutex_lock(&ch->sw_chan_mutex);
-			reset_sw_ch(ch);
-			mutex_unlock(&ch->sw_chan_mutex);
-		} else {
-			reset_hw_ch(ch);
-		}
+	if (!err) {
+		struct mailbox_msg *msg = ch->mbc_cur_msg;
+
+		/* Last packet of TX msg is traced when it is sent. */
+		if (is_rx_chan(ch))
+			msg_last_pkt(ch, msg);
+
+		ch->mbc_stats.mcs_msgs++;
+		ch->mbc_stats.mcs_bytes += msg_wire_len(msg);
+		ch->mbc_stats.mcs_busy_ns += msg->mbm_end_ts - msg->mbm_start_ts;
 	}
+	/* Msgs already queued in SW channel are not affected. */
+	if (err && !ch->mbc_cur_msg->mbm_chan_sw)
+		reset_hw_ch(ch);
 
 	msg_done(ch->mbc_cur_msg, err);
 	ch->mbc_cur_msg = NULL;
 	ch->mbc_bytes_done = 0;
+
+	/*
+	 * Resume the msg put aside by the one just finished. Any error leaves the
+	 * channel in unknown state, so parked msg can't be resumed either.
+	 */
+	if (ch->mbc_parked_msg) {
+		ch->mbc_cur_msg = ch->mbc_parked_msg;
+		ch->mbc_bytes_done = ch->mbc_parked_bytes_done;
+		ch->mbc_parked_msg = NULL;
+		ch->mbc_parked_bytes_done = 0;
+		if (err)
+			chan_msg_done(ch, err);
+	}
 }
 
-static void timeout_msg(struct mailbox_channel *ch)
+/* Put current msg aside to make room for a preempting one. */
+static void chan_park_msg(struct mailbox_channel *ch)
+{
+	WARN_ON(ch->mbc_parked_msg || !ch->mbc_cur_msg);
+
+	MBX_DBG(ch->mbc_parent, "%s parking msg, id=0x%llx", ch_name(ch),
+		ch->mbc_cur_msg->mbm_req_id);
+	ch->mbc_parked_msg = ch->mbc_cur_msg;
+	ch->mbc_parked_bytes_done = ch->mbc_bytes_done;
+	ch->mbc_cur_msg = NULL;
+	ch->mbc_bytes_done = 0;
+}
+
+/*
+ * Move msgs submitted since last time into TX queues, in the order they were
+ * submitted. TX worker is the only consumer of the submission list.
+ */
+static void tx_submit_drain(struct mailbox_channel *ch)
+{
+	struct llist_node *head = llist_reverse_order(llist_del_all(&ch->mbc_submit));
+	struct mailbox_msg *msg, *tmp;
+
+	llist_for_each_entry_safe(msg, tmp, head, mbm_lnode) {
+		struct mailbox_prio_stats *st = &ch->mbc_prio_stats[msg->mbm_prio];
+
+		list_add_tail(&msg->mbm_list, &ch->mbc_msgs[msg->mbm_prio]);
+		st->mps_depth++;
+		st->mps_max_depth = max(st->mps_max_depth, st->mps_depth);
+	}
+}
+
+/*
+ * Fail msgs past their deadlines with -ETIMEDOUT, or all msgs with -ENOTCONN
+ * when peer is down.
+ */
+static void timeout_msg(struct mailbox_channel *ch, bool peer_down)
 {
 	struct mailbox *mbx = ch->mbc_parent;
 	struct mailbox_msg *msg = NULL;
 	struct list_head *pos, *n;
 	struct list_head l = LIST_HEAD_INIT(l);
+	u64 now = peer_down ? MSG_NO_DEADLINE : ktime_get_ns();
+	u64 next = MSG_NO_DEADLINE;
+	int err = peer_down ? -ENOTCONN : -ETIMEDOUT;
+
+	mutex_lock(&ch->mbc_mutex);
 
 	/* Check outstanding msg first. */
 	msg = ch->mbc_cur_msg;
-	if (msg) {
-		if (atomic_dec_if_positive(&msg->mbm_ttl) < 0) {
-			MBX_WARN(mbx, "found outstanding msg time'd out");
-			chan_msg_done(ch, -ETIMEDOUT);
-		}
+	if (msg && msg->mbm_deadline <= now) {
+		mutex_unlock(&ch->mbc_mutex);
+		MBX_WARN(mbx, "found outstanding msg %s",
+			 peer_down ? "to dead peer" : "time'd out");
+		chan_msg_done(ch, err);
+		mutex_lock(&ch->mbc_mutex);
 	}
-
-	mutex_lock(&ch->mbc_mutex);
-
-	list_for_each_safe(pos, n, &ch->mbc_msgs) {
-		msg = list_entry(pos, struct mailbox_msg, mbm_list);
-		if (atomic_dec_if_positive(&msg->mbm_ttl) < 0) {
-			list_del(&msg->mbm_list);
-			list_add_tail(&msg->mbm_list, &l);
+	msg = ch->mbc_cur_msg;
+	if (msg)
+		next = min(next, msg->mbm_deadline);
+
+	if (is_rx_chan(ch)) {
+		struct hlist_node *tmp;
+		int bkt;
+
+		hash_for_each_safe(ch->mbc_resp_tbl, bkt, tmp, msg, mbm_hnode) {
+			if (msg->mbm_deadline <= now) {
+				hash_del(&msg->mbm_hnode);
+				ch->mbc_resp_cnt--;
+				list_add_tail(&msg->mbm_list, &l);
+			} else {
+				next = min(next, msg->mbm_deadline);
+			}
+		}
+	} else {
+		int i;
+
+		tx_submit_drain(ch);
+		for (i = 0; i < XRT_MAILBOX_PRIO_MAX; i++) {
+			list_for_each_safe(pos, n, &ch->mbc_msgs[i]) {
+				msg = list_entry(pos, struct mailbox_msg, mbm_list);
+				if (msg->mbm_deadline <= now) {
+					list_del(&msg->mbm_list);
+					ch->mbc_prio_stats[i].mps_depth--;
+					list_add_tail(&msg->mbm_list, &l);
+				} else {
+					next = min(next, msg->mbm_deadline);
+				}
+			}
 		}
 	}
 
+	/* Timer has fired, arm it again for what is left. */
+	ch->mbc_deadline = MSG_NO_DEADLINE;
+	if (next != MSG_NO_DEADLINE)
+		chan_timer_arm(ch, next);
+
 	mutex_unlock(&ch->mbc_mutex);
 
 	if (!list_empty(&l))
-		MBX_ERR(mbx, "found awaiting msg time'd out");
+		MBX_ERR(mbx, "found awaiting msg %s", peer_down ? "to dead peer" : "time'd out");
 
 	list_for_each_safe(pos, n, &l) {
 		msg = list_entry(pos, struct mailbox_msg, mbm_list);
 		list_del(&msg->mbm_list);
-		msg_done(msg, -ETIMEDOUT);
+		msg_done(msg, err);
 	}
 }
 
+/* Msg times out in ttl seconds from now, caller holds mbc_mutex of its channel. */
 static void msg_timer_on(struct mailbox_msg *msg, u32 ttl)
 {
-	atomic_set(&msg->mbm_ttl, MAILBOX_SEC2TTL(ttl));
+	msg->mbm_deadline = ktime_get_ns() + (u64)ttl * NSEC_PER_SEC;
+	chan_timer_arm(msg->mbm_ch, msg->mbm_deadline);
 }
 
 /*
@@ -547,34 +1565,100 @@ static void outstanding_msg_ttl_reset(struct mailbox_channel *ch)
 		return;
 
 	// outstanding msg will time out if no progress is made within 1 second.
+	mutex_lock(&ch->mbc_mutex);
 	msg_timer_on(msg, 1);
+	mutex_unlock(&ch->mbc_mutex);
 }
 
 static void handle_timer_event(struct mailbox_channel *ch)
 {
+	if (test_and_clear_bit(MBXCS_BIT_PEER_DOWN, &ch->mbc_state))
+		timeout_msg(ch, true);
 	if (!test_bit(MBXCS_BIT_TICK, &ch->mbc_state))
 		return;
-	timeout_msg(ch);
+	timeout_msg(ch, false);
 	clear_bit(MBXCS_BIT_TICK, &ch->mbc_state);
 }
 
+/*
+ * Let channel workers fail all msgs in flight. Whatever comes up next on the
+ * other side has to negotiate caps again, talk to it in old format till then.
+ */
+static void mailbox_peer_down(struct mailbox *mbx, const char *why)
+{
+	if (!READ_ONCE(mbx->mbx_peer_down))
+		MBX_WARN(mbx, "peer is down (%s), failing msgs in flight", why);
+	WRITE_ONCE(mbx->mbx_peer_down, true);
+	WRITE_ONCE(mbx->mbx_caps, 0);
+	WRITE_ONCE(mbx->mbx_preempt, false);
+	clear_bit(MBX_HB_BIT_PING, &mbx->mbx_hb_flags);
+	set_bit(MBXCS_BIT_PEER_DOWN, &mbx->mbx_tx.mbc_state);
+	set_bit(MBXCS_BIT_PEER_DOWN, &mbx->mbx_rx.mbc_state);
+	chan_kick(&mbx->mbx_tx);
+	chan_kick(&mbx->mbx_rx);
+}
+
+static void mailbox_peer_seen(struct mailbox *mbx)
+{
+	WRITE_ONCE(mbx->mbx_hb_seen_ns, ktime_get_ns());
+	if (READ_ONCE(mbx->mbx_peer_down)) {
+		WRITE_ONCE(mbx->mbx_peer_down, false);
+		MBX_INFO(mbx, "peer is up");
+	}
+}
+
+/*
+ * Probe peer when it has been silent for a while. Once peer is down, probing
+ * stops, since whatever driver comes up next on the other side may not know
+ * about heartbeat packets. It resumes when peer agrees on XCL_MB_CAP_HEARTBEAT
+ * in a new USER_PROBE.
+ */
+static void mailbox_hb_work(struct work_struct *work)
+{
+	struct mailbox *mbx = container_of(to_delayed_work(work), struct mailbox, mbx_hb_work);
+	u64 silent = ktime_get_ns() - READ_ONCE(mbx->mbx_hb_seen_ns);
+
+	if (!(READ_ONCE(mbx->mbx_caps) & XCL_MB_CAP_HEARTBEAT))
+		return;
+
+	if (silent < (u64)MBX_HB_INTERVAL_MS * NSEC_PER_MSEC) {
+		mbx->mbx_hb_missed = 0;
+	} else if (mbx->mbx_hb_missed >= MBX_HB_MAX_MISSED) {
+		/* Caps are gone with peer, no more pings. */
+		mailbox_peer_down(mbx, "no heartbeat");
+		return;
+	} else {
+		mbx->mbx_hb_missed++;
+		set_bit(MBX_HB_BIT_PING, &mbx->mbx_hb_flags);
+		chan_kick(&mbx->mbx_tx);
+	}
+	schedule_delayed_work(&mbx->mbx_hb_work, msecs_to_jiffies(MBX_HB_INTERVAL_MS));
+}
+
 static void chan_worker(struct work_struct *work)
 {
 	struct mailbox_channel *ch = container_of(work, struct mailbox_channel, mbc_work);
+	struct mailbox *mbx = ch->mbc_parent;
 	bool progress;
 
 	while (!test_bit(MBXCS_BIT_STOP, &ch->mbc_state)) {
-		if (ch->mbc_cur_msg) {
-			// fast poll (1000/s) to finish outstanding msg
-			usleep_range(1000, 2000);
+		if (ch->mbc_cur_msg &&
+		    (!READ_ONCE(mbx->mbx_intr_on) || READ_ONCE(mbx->mbx_lb_peer))) {
+			// fast poll to finish outstanding msg
+			usleep_range(ch->mbc_poll_us, ch->mbc_poll_us * 2);
 		} else {
-			// Wait for next poll timer trigger
+			// Wait for intr, new msg or next poll timer trigger
 			wait_for_completion_interruptible(&ch->mbc_worker);
 		}
 
 		progress = ch->mbc_tran(ch);
-		if (progress)
+		if (progress) {
 			outstanding_msg_ttl_reset(ch);
+			ch->mbc_poll_us = MBX_POLL_MIN_US;
+		} else {
+			// back off when peer is not keeping up
+			ch->mbc_poll_us = min(ch->mbc_poll_us * 2, (u32)MBX_POLL_MAX_US);
+		}
 
 		handle_timer_event(ch);
 	}
@@ -594,79 +1678,225 @@ static inline u32 mailbox_chk_err(struct mailbox *mbx)
 	return val;
 }
 
-static int chan_msg_enqueue(struct mailbox_channel *ch, struct mailbox_msg *msg)
+static void trace_msg_enqueue(struct mailbox_channel *ch, struct mailbox_msg *msg)
 {
-	int rv = 0;
+	trace_xrt_mailbox_msg_enqueue(mbx_name(ch->mbc_parent), ch_name(ch), msg->mbm_chan_sw,
+				      msg->mbm_req_id, msg->mbm_len);
+}
 
-	MBX_DBG(ch->mbc_parent, "%s enqueuing msg, id=0x%llx", ch_name(ch), msg->mbm_req_id);
-	WARN_ON(msg->mbm_req_id == INVALID_MSG_ID);
+static int resp_tbl_add(struct mailbox_channel *ch, struct mailbox_msg *msg)
+{
+	int rv = 0;
 
 	mutex_lock(&ch->mbc_mutex);
 	if (test_bit(MBXCS_BIT_STOP, &ch->mbc_state)) {
 		rv = -ESHUTDOWN;
 	} else {
-		list_add_tail(&msg->mbm_list, &ch->mbc_msgs);
+		msg->mbm_enqueue_ts = ktime_get_ns();
 		msg->mbm_ch = ch;
+		trace_msg_enqueue(ch, msg);
+		hash_add(ch->mbc_resp_tbl, &msg->mbm_hnode, msg->mbm_req_id);
+		ch->mbc_resp_cnt++;
+		stats_hwm(ch->mbc_parent, &ch->mbc_parent->mbx_stats.ms_max_resp_pending,
+			  ch->mbc_resp_cnt);
 	}
 	mutex_unlock(&ch->mbc_mutex);
+	return rv;
+}
+
+/*
+ * Hand msg over to TX worker without taking any lock. Msg may be sent and gone
+ * as soon as it is on the list. Submitters are counted, so that chan_fini() can
+ * wait for the ones which have not seen STOP flag.
+ */
+static int tx_submit(struct mailbox_channel *ch, struct mailbox_msg *msg)
+{
+	int rv = 0;
 
+	atomic_inc(&ch->mbc_submitting);
+	smp_mb__after_atomic(); /* pairs with chan_fini() */
+	if (test_bit(MBXCS_BIT_STOP, &ch->mbc_state)) {
+		rv = -ESHUTDOWN;
+	} else {
+		msg->mbm_enqueue_ts = ktime_get_ns();
+		msg->mbm_ch = ch;
+		trace_msg_enqueue(ch, msg);
+		llist_add(&msg->mbm_lnode, &ch->mbc_submit);
+	}
+	if (atomic_dec_and_test(&ch->mbc_submitting))
+		wake_up_var(&ch->mbc_submitting);
 	return rv;
 }
 
-static struct mailbox_msg *chan_msg_dequeue(struct mailbox_channel *ch, u64 req_id)
+static int chan_msg_enqueue(struct mailbox_channel *ch, struct mailbox_msg *msg)
 {
-	struct mailbox_msg *msg = NULL;
-	struct list_head *pos;
+	int rv;
 
-	mutex_lock(&ch->mbc_mutex);
+	MBX_DBG(ch->mbc_parent, "%s enqueuing msg, id=0x%llx", ch_name(ch), msg->mbm_req_id);
+	WARN_ON(msg->mbm_req_id == INVALID_MSG_ID);
+
+	if (is_rx_chan(ch)) {
+		rv = resp_tbl_add(ch, msg);
+	} else {
+		/* Compress before queuing, it can take a while. */
+		msg_compress(ch->mbc_parent, msg);
+		msg_csum(ch->mbc_parent, msg);
+		rv = tx_submit(ch, msg);
+	}
+	if (rv)
+		return rv;
+
+	/* Start sending right away instead of waiting for next poll. */
+	if (!is_rx_chan(ch))
+		chan_kick(ch);
+	mailbox_poll_start(ch->mbc_parent);
+
+	return 0;
+}
+
+static struct mailbox_msg *resp_tbl_find(struct mailbox_channel *ch, u64 req_id)
+{
+	struct mailbox_msg *msg;
+	int bkt;
+
+	WARN_ON(!mutex_is_locked(&ch->mbc_mutex));
 
-	/* Take the first msg. */
+	/* Take any msg. */
 	if (req_id == INVALID_MSG_ID) {
-		msg = list_first_entry_or_null(&ch->mbc_msgs, struct mailbox_msg, mbm_list);
+		hash_for_each(ch->mbc_resp_tbl, bkt, msg, mbm_hnode)
+			return msg;
+		return NULL;
+	}
+
 	/* Take the msg w/ specified ID. */
-	} else {
-		list_for_each(pos, &ch->mbc_msgs) {
-			struct mailbox_msg *temp;
+	hash_for_each_possible(ch->mbc_resp_tbl, msg, mbm_hnode, req_id) {
+		if (msg->mbm_req_id == req_id)
+			return msg;
+	}
+	return NULL;
+}
 
-			temp = list_entry(pos, struct mailbox_msg, mbm_list);
-			if (temp->mbm_req_id == req_id) {
-				msg = temp;
-				break;
-			}
+/* Take the first msg from TX queue of given priority, TX worker only. */
+static struct mailbox_msg *tx_queue_pop(struct mailbox_channel *ch, enum xrt_mailbox_prio prio)
+{
+	struct mailbox_prio_stats *st = &ch->mbc_prio_stats[prio];
+	struct mailbox_msg *msg;
+	u64 wait;
+
+	msg = list_first_entry_or_null(&ch->mbc_msgs[prio], struct mailbox_msg, mbm_list);
+	if (!msg)
+		return NULL;
+
+	list_del(&msg->mbm_list);
+	wait = ktime_get_ns() - msg->mbm_enqueue_ts;
+	st->mps_depth--;
+	st->mps_msgs++;
+	st->mps_wait_ns += wait;
+	st->mps_max_wait_ns = max(st->mps_max_wait_ns, wait);
+	return msg;
+}
+
+/*
+ * TX msgs can only be dequeued by TX worker, or after it is gone. Response
+ * buffers on RX channel can be taken by anyone.
+ */
+static struct mailbox_msg *chan_msg_dequeue(struct mailbox_channel *ch, u64 req_id)
+{
+	struct mailbox_msg *msg = NULL;
+	int i;
+
+	if (is_rx_chan(ch)) {
+		mutex_lock(&ch->mbc_mutex);
+		msg = resp_tbl_find(ch, req_id);
+		if (msg) {
+			hash_del(&msg->mbm_hnode);
+			ch->mbc_resp_cnt--;
 		}
+		mutex_unlock(&ch->mbc_mutex);
+	} else {
+		/* TX msgs are always sent in order of priority. */
+		WARN_ON(req_id != INVALID_MSG_ID);
+		tx_submit_drain(ch);
+		for (i = 0; i < ARRAY_SIZE(tx_prio_order) && !msg; i++)
+			msg = tx_queue_pop(ch, tx_prio_order[i]);
 	}
 
-	if (msg) {
+	if (msg)
 		MBX_DBG(ch->mbc_parent, "%s dequeued msg, id=0x%llx", ch_name(ch), msg->mbm_req_id);
-		list_del(&msg->mbm_list);
-	}
 
-	mutex_unlock(&ch->mbc_mutex);
 	return msg;
 }
 
-static struct mailbox_msg *alloc_msg(void *buf, size_t len)
+/*
+ * Called when a request msg is done on TX channel. Arm TTL for the buffer
+ * waiting for its response. If the request failed, so does the response. The
+ * response may have already arrived, in which case it's not in the table.
+ */
+static void resp_timer_on(struct mailbox *mbx, struct mailbox_msg *reqmsg, int err)
+{
+	struct mailbox_channel *ch = &mbx->mbx_rx;
+	struct mailbox_msg *respmsg;
+
+	mutex_lock(&ch->mbc_mutex);
+	respmsg = resp_tbl_find(ch, reqmsg->mbm_req_id);
+	if (respmsg) {
+		if (err) {
+			hash_del(&respmsg->mbm_hnode);
+			ch->mbc_resp_cnt--;
+		} else {
+			msg_timer_on(respmsg, reqmsg->mbm_resp_ttl);
+		}
+	}
+	mutex_unlock(&ch->mbc_mutex);
+
+	if (respmsg && err)
+		msg_done(respmsg, err);
+}
+
+static u64 mailbox_new_req_id(struct mailbox *mbx)
+{
+	u64 id;
+
+	/* 0 means empty slot for SW channel. */
+	do {
+		id = atomic64_inc_return(&mbx->mbx_next_req_id);
+	} while (id == 0 || id == INVALID_MSG_ID);
+
+	return id;
+}
+
+/*
+ * Allocate msg w/ payload of len bytes, or using caller's buffer if provided.
+ * Sleeping on mempool never fails, so only payload larger than a page can
+ * cause allocation failure.
+ */
+static struct mailbox_msg *alloc_msg(struct mailbox *mbx, void *buf, size_t len)
 {
-	char *newbuf = NULL;
+	char *newbuf = buf;
+	enum mailbox_msg_buf type = MSG_BUF_NONE;
 	struct mailbox_msg *msg = NULL;
-	/* Give MB*2 secs as time to live */
 
-	if (!buf) {
-		msg = vzalloc(sizeof(*msg) + len);
-		if (!msg)
-			return NULL;
-		newbuf = ((char *)msg) + sizeof(struct mailbox_msg);
-	} else {
-		msg = vzalloc(sizeof(*msg));
-		if (!msg)
+	if (!buf && len > MBX_MSG_INLINE_MAX) {
+		newbuf = vzalloc(len);
+		if (!newbuf)
 			return NULL;
-		newbuf = buf;
+		type = MSG_BUF_VMALLOC;
+	} else if (!buf && len) {
+		newbuf = mempool_alloc(mbx->mbx_buf_pool, GFP_KERNEL);
+		memset(newbuf, 0, len);
+		type = MSG_BUF_POOL;
 	}
 
+	msg = mempool_alloc(mbx->mbx_msg_pool, GFP_KERNEL);
+	memset(msg, 0, sizeof(*msg));
+
 	INIT_LIST_HEAD(&msg->mbm_list);
+	INIT_HLIST_NODE(&msg->mbm_hnode);
+	msg->mbm_parent = mbx;
 	msg->mbm_data = newbuf;
 	msg->mbm_len = len;
-	atomic_set(&msg->mbm_ttl, MSG_MAX_TTL);
+	msg->mbm_buf_type = type;
+	msg->mbm_deadline = MSG_NO_DEADLINE;
 	msg->mbm_chan_sw = false;
 	init_completion(&msg->mbm_complete);
 
@@ -687,18 +1917,20 @@ static void chan_fini(struct mailbox_channel *ch)
 	mutex_lock(&ch->mbc_mutex);
 	set_bit(MBXCS_BIT_STOP, &ch->mbc_state);
 	mutex_unlock(&ch->mbc_mutex);
+	/* TX submitters which missed the flag are done with the list after this. */
+	smp_mb__after_atomic(); /* pairs with tx_submit() */
+	wait_var_event(&ch->mbc_submitting, !atomic_read(&ch->mbc_submitting));
 
 	if (ch->mbc_wq) {
 		complete(&ch->mbc_worker);
 		cancel_work_sync(&ch->mbc_work);
 		destroy_workqueue(ch->mbc_wq);
 	}
+	hrtimer_cancel(&ch->mbc_timer);
 
-	mutex_lock(&ch->sw_chan_mutex);
-	if (ch->sw_chan_buf)
-		vfree(ch->sw_chan_buf);
-	mutex_unlock(&ch->sw_chan_mutex);
+	reset_sw_ch(ch);
 
+	/* Parked msg, if any, is failed along with current one. */
 	msg = ch->mbc_cur_msg;
 	if (msg)
 		chan_msg_done(ch, -ESHUTDOWN);
@@ -714,27 +1946,38 @@ static void chan_fini(struct mailbox_channel *ch)
 static int chan_init(struct mailbox *mbx, enum mailbox_chan_type type,
 		     struct mailbox_channel *ch, chan_func_t fn)
 {
+	int i;
+
 	ch->mbc_parent = mbx;
 	ch->mbc_type = type;
 	ch->mbc_tran = fn;
-	INIT_LIST_HEAD(&ch->mbc_msgs);
+	for (i = 0; i < XRT_MAILBOX_PRIO_MAX; i++)
+		INIT_LIST_HEAD(&ch->mbc_msgs[i]);
+	init_llist_head(&ch->mbc_submit);
+	atomic_set(&ch->mbc_submitting, 0);
+	memset(ch->mbc_prio_stats, 0, sizeof(ch->mbc_prio_stats));
+	hash_init(ch->mbc_resp_tbl);
 	init_completion(&ch->mbc_worker);
+	hrtimer_init(&ch->mbc_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ch->mbc_timer.function = chan_timer;
+	ch->mbc_deadline = MSG_NO_DEADLINE;
 	mutex_init(&ch->mbc_mutex);
 	mutex_init(&ch->sw_chan_mutex);
 
 	init_waitqueue_head(&ch->sw_chan_wq);
-	atomic_set(&ch->sw_num_pending_msg, 0);
+	INIT_LIST_HEAD(&ch->sw_chan_q);
+	ch->sw_chan_q_len = 0;
 	ch->mbc_cur_msg = NULL;
 	ch->mbc_bytes_done = 0;
+	ch->mbc_poll_us = MBX_POLL_MIN_US;
+	memset(&ch->mbc_stats, 0, sizeof(ch->mbc_stats));
 
 	/* Reset pkt buffer. */
 	reset_pkt(&ch->mbc_packet);
 	/* Reset HW channel. */
 	reset_hw_ch(ch);
 	/* Reset SW channel. */
-	mutex_lock(&ch->sw_chan_mutex);
 	reset_sw_ch(ch);
-	mutex_unlock(&ch->sw_chan_mutex);
 
 	/* One thread for one channel. */
 	ch->mbc_wq = create_singlethread_workqueue(dev_name(&mbx->mbx_xdev->dev));
@@ -760,34 +2003,50 @@ static void listen_wq_fini(struct mailbox *mbx)
 		destroy_workqueue(mbx->mbx_listen_wq);
 		mbx->mbx_listen_wq = NULL;
 	}
+	/* REQ thread is gone, nothing new can be handed over to REQ pool. */
+	if (mbx->mbx_serial_wq) {
+		destroy_workqueue(mbx->mbx_serial_wq);
+		mbx->mbx_serial_wq = NULL;
+	}
+	if (mbx->mbx_req_wq) {
+		destroy_workqueue(mbx->mbx_req_wq);
+		mbx->mbx_req_wq = NULL;
+	}
 }
 
+/*
+ * Caller should have seen RTA, which guarantees that a full packet is sitting
+ * in RX FIFO, so there is no need to wait for each DWORD here.
+ */
 static void chan_recv_pkt(struct mailbox_channel *ch)
 {
-	int i, retry = 10;
 	struct mailbox *mbx = ch->mbc_parent;
 	struct mailbox_pkt *pkt = &ch->mbc_packet;
+	int i;
 
 	WARN_ON(valid_pkt(pkt));
 
 	/* Picking up a packet from HW. */
-	for (i = 0; i < PACKET_SIZE; i++) {
-		while ((mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_status) & STATUS_EMPTY) &&
-		       (retry-- > 0))
-			msleep(100);
-
+	for (i = 0; i < PACKET_SIZE; i++)
 		*(((u32 *)pkt) + i) = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_rddata);
-	}
-	if ((mailbox_chk_err(mbx) & STATUS_EMPTY) != 0)
+
+	if ((mailbox_chk_err(mbx) & STATUS_EMPTY) != 0) {
 		reset_pkt(pkt);
-	else
+	} else {
 		MBX_DBG(mbx, "received pkt: type=0x%x", pkt->hdr.type);
+		ch->mbc_stats.mcs_pkts++;
+	}
 }
 
+/*
+ * Caller should have seen STA and is responsible for checking FIFO error
+ * after a burst of packets is pushed.
+ */
 static void chan_send_pkt(struct mailbox_channel *ch)
 {
 	struct mailbox_pkt *pkt = &ch->mbc_packet;
 	struct mailbox *mbx = ch->mbc_parent;
+	u32 cnt = pkt_payload_size(pkt);
 	int i;
 
 	WARN_ON(!valid_pkt(pkt));
@@ -798,10 +2057,11 @@ static void chan_send_pkt(struct mailbox_channel *ch)
 		mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_wrdata, *(((u32 *)pkt) + i));
 
 	reset_pkt(pkt);
-	if (ch->mbc_cur_msg)
-		ch->mbc_bytes_done += ch->mbc_packet.hdr.payload_size;
-
-	WARN_ON((mailbox_chk_err(mbx) & STATUS_FULL) != 0);
+	ch->mbc_stats.mcs_pkts++;
+	if (ch->mbc_cur_msg) {
+		ch->mbc_bytes_done += cnt;
+		ch->mbc_cur_msg->mbm_num_pkts++;
+	}
 }
 
 static int chan_pkt2msg(struct mailbox_channel *ch)
@@ -809,28 +2069,38 @@ static int chan_pkt2msg(struct mailbox_channel *ch)
 	struct mailbox *mbx = ch->mbc_parent;
 	struct mailbox_msg *msg = ch->mbc_cur_msg;
 	struct mailbox_pkt *pkt = &ch->mbc_packet;
-	size_t cnt = pkt->hdr.payload_size;
+	size_t cnt = pkt_payload_size(pkt);
 	u32 type = (pkt->hdr.type & PKT_TYPE_MASK);
-	void *msg_data, *pkt_data;
+	void *pkt_data;
 
-	WARN_ON(((type != PKT_MSG_START) && (type != PKT_MSG_BODY)) || !msg);
+	WARN_ON((!MSG_IS_START(type) && type != PKT_MSG_BODY && type != PKT_MSG_BODY_COMPACT) ||
+		!msg);
 
-	if (type == PKT_MSG_START) {
+	if (MSG_IS_START(type)) {
 		msg->mbm_req_id = pkt->body.msg_start.msg_req_id;
-		WARN_ON(msg->mbm_len < pkt->body.msg_start.msg_size);
-		msg->mbm_len = pkt->body.msg_start.msg_size;
+		WARN_ON(msg_wire_len(msg) < pkt->body.msg_start.msg_size);
+		msg_set_wire_len(msg, pkt->body.msg_start.msg_size);
 		pkt_data = pkt->body.msg_start.payload;
+		if (pkt->body.msg_start.msg_flags & MSG_FLAG_CSUM) {
+			msg->mbm_flags |= MSG_FLAG_CSUM;
+			msg->mbm_csum = pkt->body.msg_start.payload[0];
+			msg->mbm_rx_csum = ~0;
+			pkt_data += sizeof(u32);
+		} else {
+			msg->mbm_flags &= ~MSG_FLAG_CSUM;
+		}
 	} else {
-		pkt_data = pkt->body.msg_body.payload;
+		pkt_data = pkt_body_payload(pkt);
 	}
 
-	if (cnt > msg->mbm_len - ch->mbc_bytes_done) {
+	if (cnt > msg_wire_len(msg) - ch->mbc_bytes_done) {
 		MBX_ERR(mbx, "invalid mailbox packet size");
 		return -EBADMSG;
 	}
 
-	msg_data = msg->mbm_data + ch->mbc_bytes_done;
-	memcpy(msg_data, pkt_data, cnt);
+	msg_rx_copy(msg, ch->mbc_bytes_done, pkt_data, cnt);
+	if (msg->mbm_flags & MSG_FLAG_CSUM)
+		msg->mbm_rx_csum = crc32c(msg->mbm_rx_csum, pkt_data, cnt);
 	ch->mbc_bytes_done += cnt;
 	msg->mbm_num_pkts++;
 
@@ -855,10 +2125,35 @@ static void dequeue_rx_msg(struct mailbox_channel *ch, u32 flags, u64 id, size_t
 		} else if (msg->mbm_len < sz) {
 			MBX_ERR(mbx, "Response (id 0x%llx) is too big: %lu", id, sz);
 			err = -EMSGSIZE;
+		} else if (flags & MSG_FLAG_LZ4) {
+			/* Compressed response is no bigger than the buffer for it. */
+			msg->mbm_zbuf = kvmalloc(sz, GFP_KERNEL);
+			msg->mbm_zlen = sz;
+			if (!msg->mbm_zbuf)
+				err = -ENOMEM;
 		}
 	} else if (flags & MSG_FLAG_REQUEST) {
+		struct mailbox_stream *ms = NULL;
+
 		if (sz < MAX_REQ_MSG_SZ)
-			msg = alloc_msg(NULL, sz);
+			msg = alloc_msg(mbx, NULL, (flags & MSG_FLAG_LZ4) ? 0 : sz);
+		else if (!(flags & MSG_FLAG_LZ4))
+			ms = stream_alloc(mbx, id, sz);
+		if (ms) {
+			/* No buffer, payload goes to stream. */
+			msg = alloc_msg(mbx, NULL, 0);
+			msg->mbm_stream = ms;
+			msg->mbm_len = sz;
+		}
+		if (msg && (flags & MSG_FLAG_LZ4)) {
+			/* Buffer of original size is allocated once it's known. */
+			msg->mbm_zbuf = kvmalloc(sz, GFP_KERNEL);
+			msg->mbm_zlen = sz;
+			if (!msg->mbm_zbuf) {
+				free_msg(msg);
+				msg = NULL;
+			}
+		}
 		if (msg) {
 			msg->mbm_req_id = id;
 			msg->mbm_ch = ch;
@@ -875,6 +2170,7 @@ static void dequeue_rx_msg(struct mailbox_channel *ch, u32 flags, u64 id, size_t
 		msg->mbm_start_ts = ktime_get_ns();
 		msg->mbm_num_pkts = 0;
 		ch->mbc_cur_msg = msg;
+		msg_first_pkt(ch, msg);
 	}
 
 	/* Fail received msg now on error. */
@@ -882,11 +2178,153 @@ static void dequeue_rx_msg(struct mailbox_channel *ch, u32 flags, u64 id, size_t
 		chan_msg_done(ch, err);
 }
 
+static inline struct xcl_sw_chan *
+ring_slot(struct mailbox_ring *mr, struct xcl_sw_ring *ring, u32 idx)
+{
+	return (struct xcl_sw_chan *)((char *)ring + XCL_SW_RING_HDR_SIZE +
+		(size_t)(idx & (mr->mr_nr_slots - 1)) * mr->mr_slot_size);
+}
+
+static inline bool ring_msg_fits(struct mailbox_ring *mr, size_t len)
+{
+	return len <= mr->mr_slot_size - MBX_RING_HDR_SIZE;
+}
+
+/* Tell daemon there is new msg in TX ring or free slot in RX ring. */
+static void ring_notify(struct mailbox *mbx, struct mailbox_ring *mr)
+{
+	if (mr->mr_evt)
+		eventfd_signal(mr->mr_evt, 1);
+	wake_up_interruptible(&mbx->mbx_ring_wq);
+}
+
+/* Number of msgs in the ring, or -EINVAL if index from daemon is insane. */
+static int ring_used(struct mailbox_ring *mr, u32 prod, u32 cons)
+{
+	u32 used = prod - cons;
+
+	return used > mr->mr_nr_slots ? -EINVAL : used;
+}
+
+static void ring_set_broken(struct mailbox *mbx, struct mailbox_ring *mr)
+{
+	if (!mr->mr_broken)
+		MBX_ERR(mbx, "SW channel ring is corrupted by daemon, ignored");
+	mr->mr_broken = true;
+}
+
+/*
+ * Check if TX ring can take msg of len bytes. Return 1 if there is room, 0 if
+ * ring is full or -ENODEV if msg has to go thru read() instead.
+ */
+static int __ring_tx_room(struct mailbox *mbx, size_t len)
+{
+	struct mailbox_ring *mr = mbx->mbx_ring;
+	int used;
+
+	WARN_ON(!mutex_is_locked(&mbx->mbx_ring_lock));
+
+	if (!mr || mr->mr_broken || !ring_msg_fits(mr, len))
+		return -ENODEV;
+
+	/* Pairs with daemon releasing the slot, so we don't overwrite it too early. */
+	used = ring_used(mr, mr->mr_tx_prod, smp_load_acquire(&mr->mr_tx->consumer));
+	if (used < 0) {
+		ring_set_broken(mbx, mr);
+		return -ENODEV;
+	}
+	return used < mr->mr_nr_slots;
+}
+
+static int ring_tx_room(struct mailbox *mbx, size_t len)
+{
+	int ret;
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	ret = __ring_tx_room(mbx, len);
+	mutex_unlock(&mbx->mbx_ring_lock);
+	return ret;
+}
+
+/* Copy msg straight into next TX ring slot. Return false if it can't be done. */
+static bool ring_tx_push(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	struct mailbox_ring *mr;
+	struct xcl_sw_chan *slot;
+	bool pushed = false;
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	mr = mbx->mbx_ring;
+	if (__ring_tx_room(mbx, msg->mbm_len) > 0) {
+		slot = ring_slot(mr, mr->mr_tx, mr->mr_tx_prod);
+		slot->sz = msg->mbm_len;
+		slot->flags = msg->mbm_flags;
+		slot->id = msg->mbm_req_id;
+		memcpy(slot->data, msg->mbm_data, msg->mbm_len);
+		/* Slot content must be visible before daemon sees the index. */
+		smp_store_release(&mr->mr_tx->producer, ++mr->mr_tx_prod);
+		ring_notify(mbx, mr);
+		pushed = true;
+	}
+	mutex_unlock(&mbx->mbx_ring_lock);
+	return pushed;
+}
+
+/* Receive one msg from RX ring, copying it straight from the slot. */
+static bool do_sw_rx_ring(struct mailbox_channel *ch)
+{
+	struct mailbox *mbx = ch->mbc_parent;
+	struct mailbox_ring *mr;
+	struct xcl_sw_chan *slot;
+	u64 id, sz, flags;
+	bool was_full;
+	int used;
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	mr = mbx->mbx_ring;
+	if (!mr || mr->mr_broken) {
+		mutex_unlock(&mbx->mbx_ring_lock);
+		return false;
+	}
+
+	/* Pairs with daemon publishing the slot, so we see its content. */
+	used = ring_used(mr, smp_load_acquire(&mr->mr_rx->producer), mr->mr_rx_cons);
+	if (used <= 0) {
+		if (used < 0)
+			ring_set_broken(mbx, mr);
+		mutex_unlock(&mbx->mbx_ring_lock);
+		return false;
+	}
+	was_full = (used == mr->mr_nr_slots);
+
+	/* Daemon can change the slot under us, read header only once. */
+	slot = ring_slot(mr, mr->mr_rx, mr->mr_rx_cons);
+	sz = READ_ONCE(slot->sz);
+	flags = READ_ONCE(slot->flags);
+	id = READ_ONCE(slot->id);
+	if (id == 0 || sz == 0 || !ring_msg_fits(mr, sz)) {
+		MBX_ERR(mbx, "Software RX ring msg has malformed header");
+	} else {
+		dequeue_rx_msg(ch, flags & ~MSG_FLAG_HW_ONLY, id, sz);
+		if (ch->mbc_cur_msg) {
+			ch->mbc_cur_msg->mbm_chan_sw = true;
+			msg_rx_copy(ch->mbc_cur_msg, 0, slot->data, sz);
+		}
+	}
+
+	/* Done with the slot, daemon may reuse it once it sees the index. */
+	smp_store_release(&mr->mr_rx->consumer, ++mr->mr_rx_cons);
+	if (was_full)
+		ring_notify(mbx, mr);
+	mutex_unlock(&mbx->mbx_ring_lock);
+
+	chan_msg_done(ch, 0);
+	return true;
+}
+
 static bool do_sw_rx(struct mailbox_channel *ch)
 {
-	size_t len = 0;
-	u32 flags = 0;
-	u64 id = 0;
+	struct mailbox_sw_rec *rec;
 
 	/*
 	 * Don't receive new msg when a msg is being received from HW
@@ -896,72 +2334,79 @@ static bool do_sw_rx(struct mailbox_channel *ch)
 		return false;
 
 	mutex_lock(&ch->sw_chan_mutex);
-
-	flags = ch->sw_chan_msg_flags;
-	id = ch->sw_chan_msg_id;
-	len = ch->sw_chan_buf_sz;
-
+	rec = sw_queue_pop(ch);
 	mutex_unlock(&ch->sw_chan_mutex);
 
-	/* Nothing to receive. */
-	if (id == 0)
-		return false;
-
-	/* Prepare outstanding msg. */
-	dequeue_rx_msg(ch, flags, id, len);
-
-	mutex_lock(&ch->sw_chan_mutex);
+	/* Nothing to receive from write(), try the ring. */
+	if (!rec)
+		return do_sw_rx_ring(ch);
 
-	WARN_ON(id != ch->sw_chan_msg_id);
+	/* There is room for next msg from write(). */
+	wake_up_interruptible(&ch->sw_chan_wq);
 
+	/* Prepare outstanding msg. */
+	dequeue_rx_msg(ch, rec->msr_chan.flags & ~MSG_FLAG_HW_ONLY, rec->msr_chan.id,
+		       rec->msr_chan.sz);
 	if (ch->mbc_cur_msg) {
 		ch->mbc_cur_msg->mbm_chan_sw = true;
-		memcpy(ch->mbc_cur_msg->mbm_data, ch->sw_chan_buf, ch->sw_chan_buf_sz);
+		msg_rx_copy(ch->mbc_cur_msg, 0, rec->msr_chan.data, rec->msr_chan.sz);
 	}
 
 	/* Done with sw msg. */
-	reset_sw_ch(ch);
-
-	mutex_unlock(&ch->sw_chan_mutex);
-
-	wake_up_interruptible(&ch->sw_chan_wq);
-
+	sw_rec_free(rec);
 	chan_msg_done(ch, 0);
 
 	return true;
 }
 
-static bool do_hw_rx(struct mailbox_channel *ch)
+/* Check if a full packet is ready for reading in HW RX channel. */
+static bool rx_hw_chan_ready(struct mailbox_channel *ch)
 {
 	struct mailbox *mbx = ch->mbc_parent;
-	struct mailbox_pkt *pkt = &ch->mbc_packet;
-	u32 type;
-	bool eom = false, read_hw = false;
 	u32 st = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_status);
-	bool progress = false;
 
-	/* Check if a packet is ready for reading. */
-	if (st & ~STATUS_VALID) {
-		/* Device is still being reset or firewall tripped. */
-		read_hw = false;
-	} else {
-		read_hw = ((st & STATUS_RTA) != 0);
-	}
+	/* Device is still being reset or firewall tripped. */
+	if (st & ~STATUS_VALID)
+		return false;
+
+	return ((st & STATUS_RTA) != 0);
+}
 
-	if (!read_hw)
-		return progress;
+static bool do_hw_rx_pkt(struct mailbox_channel *ch)
+{
+	struct mailbox *mbx = ch->mbc_parent;
+	struct mailbox_pkt *pkt = &ch->mbc_packet;
+	bool eom = false;
+	bool progress = false;
+	u32 type;
 
 	chan_recv_pkt(ch);
 	type = pkt->hdr.type & PKT_TYPE_MASK;
 	eom = ((pkt->hdr.type & PKT_TYPE_MSG_END) != 0);
 
+	if (valid_pkt(pkt))
+		mailbox_peer_seen(mbx);
+
 	switch (type) {
 	case PKT_TEST:
 		memcpy(&mbx->mbx_tst_pkt, &ch->mbc_packet, sizeof(struct mailbox_pkt));
 		reset_pkt(pkt);
 		break;
+	case PKT_PING:
+		/* Answered by TX worker at next packet boundary. */
+		set_bit(MBX_HB_BIT_PONG, &mbx->mbx_hb_flags);
+		chan_kick(&mbx->mbx_tx);
+		reset_pkt(pkt);
+		break;
+	case PKT_PONG:
+		reset_pkt(pkt);
+		break;
 	case PKT_MSG_START:
-		if (ch->mbc_cur_msg) {
+	case PKT_MSG_START_PREEMPT:
+		if (ch->mbc_cur_msg && type == PKT_MSG_START_PREEMPT && !ch->mbc_parked_msg) {
+			/* Peer is interleaving a msg, resume current one after it. */
+			chan_park_msg(ch);
+		} else if (ch->mbc_cur_msg) {
 			MBX_ERR(mbx, "Received partial msg (id 0x%llx)",
 				ch->mbc_cur_msg->mbm_req_id);
 			chan_msg_done(ch, -EBADMSG);
@@ -975,6 +2420,7 @@ static bool do_hw_rx(struct mailbox_channel *ch)
 		}
 		break;
 	case PKT_MSG_BODY:
+	case PKT_MSG_BODY_COMPACT:
 		if (!ch->mbc_cur_msg) {
 			MBX_ERR(mbx, "got unexpected msg body pkt");
 			reset_pkt(pkt);
@@ -997,6 +2443,18 @@ static bool do_hw_rx(struct mailbox_channel *ch)
 	return progress;
 }
 
+/* Drain as many packets as peer has pushed into RX FIFO. */
+static bool do_hw_rx(struct mailbox_channel *ch)
+{
+	int budget = MBX_MAX_BURST_PKTS;
+	bool progress = false;
+
+	while (budget-- > 0 && rx_hw_chan_ready(ch))
+		progress |= do_hw_rx_pkt(ch);
+
+	return progress;
+}
+
 /*
  * Worker for RX channel.
  */
@@ -1006,6 +2464,8 @@ static bool chan_do_rx(struct mailbox_channel *ch)
 	bool progress = false;
 
 	progress = do_sw_rx(ch);
+	if (progress)
+		mailbox_peer_seen(mbx);
 	if (!MBX_SW_ONLY(mbx))
 		progress |= do_hw_rx(ch);
 
@@ -1017,6 +2477,7 @@ static void chan_msg2pkt(struct mailbox_channel *ch)
 	struct mailbox_msg *msg = ch->mbc_cur_msg;
 	struct mailbox_pkt *pkt = &ch->mbc_packet;
 	bool is_start = (ch->mbc_bytes_done == 0);
+	bool compact = !is_start && (READ_ONCE(ch->mbc_parent->mbx_caps) & XCL_MB_CAP_COMPACT_HDR);
 	void *msg_data, *pkt_data;
 	size_t payload_off = 0;
 	bool is_eom = false;
@@ -1024,52 +2485,120 @@ static void chan_msg2pkt(struct mailbox_channel *ch)
 
 	if (is_start)
 		payload_off = offsetof(struct mailbox_pkt, body.msg_start.payload);
+	else if (compact)
+		payload_off = offsetof(struct mailbox_pkt, hdr.payload_size);
 	else
 		payload_off = offsetof(struct mailbox_pkt, body.msg_body.payload);
+	/* Checksum takes the head of start packet payload. */
+	if (is_start && (msg->mbm_flags & MSG_FLAG_CSUM))
+		payload_off += sizeof(u32);
 	cnt = PACKET_SIZE * sizeof(u32) - payload_off;
-	if (cnt >= msg->mbm_len - ch->mbc_bytes_done) {
-		cnt = msg->mbm_len - ch->mbc_bytes_done;
+	if (cnt >= msg_wire_len(msg) - ch->mbc_bytes_done) {
+		cnt = msg_wire_len(msg) - ch->mbc_bytes_done;
 		is_eom = true;
 	}
 
-	pkt->hdr.type = is_start ? PKT_MSG_START : PKT_MSG_BODY;
+	if (is_start)
+		pkt->hdr.type = msg->mbm_preempt ? PKT_MSG_START_PREEMPT : PKT_MSG_START;
+	else if (compact)
+		pkt->hdr.type = PKT_MSG_BODY_COMPACT | (cnt << PKT_COMPACT_SIZE_SHIFT);
+	else
+		pkt->hdr.type = PKT_MSG_BODY;
 	pkt->hdr.type |= is_eom ? PKT_TYPE_MSG_END : 0;
-	pkt->hdr.payload_size = cnt;
+	if (!compact)
+		pkt->hdr.payload_size = cnt;
 
 	if (is_start) {
 		pkt->body.msg_start.msg_req_id = msg->mbm_req_id;
-		pkt->body.msg_start.msg_size = msg->mbm_len;
+		pkt->body.msg_start.msg_size = msg_wire_len(msg);
 		pkt->body.msg_start.msg_flags = msg->mbm_flags;
 		pkt_data = pkt->body.msg_start.payload;
+		if (msg->mbm_flags & MSG_FLAG_CSUM) {
+			pkt->body.msg_start.payload[0] = msg->mbm_csum;
+			pkt_data += sizeof(u32);
+		}
 	} else {
-		pkt_data = pkt->body.msg_body.payload;
+		pkt_data = pkt_body_payload(pkt);
 	}
-	msg_data = msg->mbm_data + ch->mbc_bytes_done;
+	msg_data = msg_wire_data(msg) + ch->mbc_bytes_done;
 	memcpy(pkt_data, msg_data, cnt);
+
+	if (is_start)
+		msg_first_pkt(ch, msg);
+	if (is_eom)
+		msg_last_pkt(ch, msg);
+}
+
+/*
+ * Loopback peer has no interrupt to tell us when its RX queue has room, TX
+ * worker keeps polling as long as SW channel is looped back.
+ */
+static bool lb_tx_room(struct mailbox *mbx)
+{
+	struct mailbox *peer;
+	bool room;
+
+	mutex_lock(&mailbox_list_lock);
+	peer = mbx->mbx_lb_peer;
+	room = !peer || !sw_queue_full(&peer->mbx_rx);
+	mutex_unlock(&mailbox_list_lock);
+
+	return room;
+}
+
+/* Hand over msg to RX channel of loopback peer, if there is still one. */
+static bool lb_tx_push(struct mailbox *mbx, struct mailbox_sw_rec *rec)
+{
+	struct mailbox *peer;
+
+	mutex_lock(&mailbox_list_lock);
+	peer = mbx->mbx_lb_peer;
+	if (peer) {
+		mutex_lock(&peer->mbx_rx.sw_chan_mutex);
+		sw_queue_push(&peer->mbx_rx, rec);
+		mutex_unlock(&peer->mbx_rx.sw_chan_mutex);
+		chan_kick(&peer->mbx_rx);
+	}
+	mutex_unlock(&mailbox_list_lock);
+
+	return peer;
 }
 
 static void do_sw_tx(struct mailbox_channel *ch)
 {
-	mutex_lock(&ch->sw_chan_mutex);
+	struct mailbox_msg *msg = ch->mbc_cur_msg;
+	struct mailbox_sw_rec *rec;
 
-	WARN_ON(!ch->mbc_cur_msg || !ch->mbc_cur_msg->mbm_chan_sw);
-	WARN_ON(ch->sw_chan_msg_id != 0);
+	WARN_ON(!msg || !msg->mbm_chan_sw);
 
-	ch->sw_chan_buf = vmalloc(ch->mbc_cur_msg->mbm_len);
-	if (!ch->sw_chan_buf) {
-		mutex_unlock(&ch->sw_chan_mutex);
+	if (!READ_ONCE(ch->mbc_parent->mbx_lb_peer) && ring_tx_push(ch->mbc_parent, msg)) {
+		ch->mbc_bytes_done = msg->mbm_len;
+		msg->mbm_num_pkts++;
+		msg_first_pkt(ch, msg);
+		msg_last_pkt(ch, msg);
 		return;
 	}
 
-	ch->sw_chan_buf_sz = ch->mbc_cur_msg->mbm_len;
-	ch->sw_chan_msg_id = ch->mbc_cur_msg->mbm_req_id;
-	ch->sw_chan_msg_flags = ch->mbc_cur_msg->mbm_flags;
-	memcpy(ch->sw_chan_buf, ch->mbc_cur_msg->mbm_data, ch->sw_chan_buf_sz);
-	ch->mbc_bytes_done = ch->mbc_cur_msg->mbm_len;
+	/* Retry later if out of memory. */
+	rec = sw_rec_alloc(msg->mbm_len);
+	if (!rec)
+		return;
 
-	/* Notify sw tx channel handler. */
-	atomic_inc(&ch->sw_num_pending_msg);
+	rec->msr_chan.sz = msg->mbm_len;
+	rec->msr_chan.id = msg->mbm_req_id;
+	rec->msr_chan.flags = msg->mbm_flags;
+	memcpy(rec->msr_chan.data, msg->mbm_data, msg->mbm_len);
+	ch->mbc_bytes_done = msg->mbm_len;
+	msg->mbm_num_pkts++;
+	msg_first_pkt(ch, msg);
+	msg_last_pkt(ch, msg);
+
+	if (lb_tx_push(ch->mbc_parent, rec))
+		return;
 
+	/* Notify sw tx channel handler. */
+	mutex_lock(&ch->sw_chan_mutex);
+	sw_queue_push(ch, rec);
 	mutex_unlock(&ch->sw_chan_mutex);
 	wake_up_interruptible(&ch->sw_chan_wq);
 }
@@ -1094,6 +2623,46 @@ static void dequeue_tx_msg(struct mailbox_channel *ch)
 	}
 }
 
+/*
+ * Preempt outstanding bulk msg on HW channel at packet boundary if a msg of
+ * higher priority is waiting. Return true if current msg is switched.
+ */
+static bool chan_preempt_msg(struct mailbox_channel *ch)
+{
+	struct mailbox *mbx = ch->mbc_parent;
+	struct mailbox_msg *cur = ch->mbc_cur_msg;
+	struct mailbox_msg *msg = NULL;
+	int i;
+
+	if (cur->mbm_prio != XRT_MAILBOX_PRIO_BULK || cur->mbm_chan_sw ||
+	    !cur->mbm_num_pkts || ch->mbc_parked_msg)
+		return false;
+
+	tx_submit_drain(ch);
+	for (i = 0; i < ARRAY_SIZE(tx_prio_order) && !msg; i++) {
+		enum xrt_mailbox_prio prio = tx_prio_order[i];
+
+		if (prio == XRT_MAILBOX_PRIO_BULK)
+			break;
+		msg = list_first_entry_or_null(&ch->mbc_msgs[prio], struct mailbox_msg, mbm_list);
+		/* Peer must understand preempt pkt unless msg goes thru SW channel. */
+		if (msg && !msg->mbm_chan_sw && !READ_ONCE(mbx->mbx_preempt))
+			msg = NULL;
+		if (msg)
+			msg = tx_queue_pop(ch, prio);
+	}
+
+	if (!msg)
+		return false;
+
+	chan_park_msg(ch);
+	msg->mbm_preempt = !msg->mbm_chan_sw;
+	msg->mbm_start_ts = ktime_get_ns();
+	msg->mbm_num_pkts = 0;
+	ch->mbc_cur_msg = msg;
+	return true;
+}
+
 /* Check if HW TX channel is ready for next msg. */
 static bool tx_hw_chan_ready(struct mailbox_channel *ch)
 {
@@ -1107,52 +2676,111 @@ static bool tx_hw_chan_ready(struct mailbox_channel *ch)
 /* Check if SW TX channel is ready for next msg. */
 static bool tx_sw_chan_ready(struct mailbox_channel *ch)
 {
-	bool ready;
+	struct mailbox_msg *msg = ch->mbc_cur_msg;
+	int room;
 
-	mutex_lock(&ch->sw_chan_mutex);
-	ready = (ch->sw_chan_msg_id == 0);
-	mutex_unlock(&ch->sw_chan_mutex);
-	return ready;
+	/* Msg is already handed over to daemon. */
+	if (msg->mbm_num_pkts)
+		return true;
+
+	if (READ_ONCE(ch->mbc_parent->mbx_lb_peer))
+		return lb_tx_room(ch->mbc_parent);
+
+	/* Msg goes to TX ring if it fits, or SW queue otherwise. */
+	room = ring_tx_room(ch->mbc_parent, msg->mbm_len);
+	if (room >= 0)
+		return room;
+	return !sw_queue_full(ch);
+}
+
+/* Push ping or pong into HW, outside of any msg. */
+static void chan_send_hb_pkt(struct mailbox_channel *ch, u32 type)
+{
+	struct mailbox *mbx = ch->mbc_parent;
+	struct mailbox_pkt pkt = { { 0 } };
+	int i;
+
+	pkt.hdr.type = type;
+	for (i = 0; i < PACKET_SIZE; i++)
+		mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_wrdata, *(((u32 *)&pkt) + i));
+	ch->mbc_stats.mcs_pkts++;
+}
+
+/* Heartbeat packets due go out ahead of next msg packet. */
+static bool do_hw_tx_hb(struct mailbox_channel *ch)
+{
+	static const u32 hb_pkts[] = {
+		[MBX_HB_BIT_PING] = PKT_PING,
+		[MBX_HB_BIT_PONG] = PKT_PONG,
+	};
+	struct mailbox *mbx = ch->mbc_parent;
+	bool sent = false;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hb_pkts); i++) {
+		if (!test_bit(i, &mbx->mbx_hb_flags) || !tx_hw_chan_ready(ch))
+			continue;
+		clear_bit(i, &mbx->mbx_hb_flags);
+		chan_send_hb_pkt(ch, hb_pkts[i]);
+		sent = true;
+	}
+	return sent;
 }
 
 /*
- * Worker for TX channel.
+ * Worker for TX channel. Keep pushing packets of outstanding msgs into the
+ * channel for as long as it has room for them.
  */
 static bool chan_do_tx(struct mailbox_channel *ch)
 {
-	struct mailbox_msg *curmsg = ch->mbc_cur_msg;
+	struct mailbox *mbx = ch->mbc_parent;
+	int budget = MBX_MAX_BURST_PKTS;
+	struct mailbox_msg *curmsg;
 	bool progress = false;
+	bool hw_sent = false;
 
-	/* Check if current outstanding msg is fully sent. */
-	if (curmsg) {
-		bool done = curmsg->mbm_chan_sw ? tx_sw_chan_ready(ch) : tx_hw_chan_ready(ch);
+	if (!MBX_SW_ONLY(mbx))
+		hw_sent = do_hw_tx_hb(ch);
+
+	for (;;) {
+		dequeue_tx_msg(ch);
+		curmsg = ch->mbc_cur_msg;
+		if (!curmsg)
+			break;
 
-		if (done) {
-			curmsg->mbm_num_pkts++;
-			if (curmsg->mbm_len == ch->mbc_bytes_done)
-				chan_msg_done(ch, 0);
-			progress = true;
+		if (curmsg->mbm_chan_sw) {
+			if (!tx_sw_chan_ready(ch))
+				break;
+		} else {
+			if (!tx_hw_chan_ready(ch))
+				break;
 		}
-	}
+		progress = true;
 
-	dequeue_tx_msg(ch);
-	curmsg = ch->mbc_cur_msg;
+		/* Current outstanding msg is fully sent, move on to next one. */
+		if (curmsg->mbm_num_pkts && msg_wire_len(curmsg) == ch->mbc_bytes_done) {
+			chan_msg_done(ch, 0);
+			continue;
+		}
+
+		/* Let msg of higher priority cut in before next packet goes out. */
+		if (chan_preempt_msg(ch))
+			continue;
+
+		if (budget-- <= 0)
+			break;
 
-	/* Send the next msg out. */
-	if (curmsg) {
 		if (curmsg->mbm_chan_sw) {
-			if (tx_sw_chan_ready(ch)) {
-				do_sw_tx(ch);
-				progress = true;
-			}
+			do_sw_tx(ch);
 		} else {
-			if (tx_hw_chan_ready(ch)) {
-				do_hw_tx(ch);
-				progress = true;
-			}
+			do_hw_tx(ch);
+			hw_sent = true;
 		}
 	}
 
+	if (hw_sent)
+		WARN_ON((mailbox_chk_err(mbx) & STATUS_FULL) != 0);
+
 	return progress;
 }
 
@@ -1257,15 +2885,240 @@ static ssize_t mailbox_pkt_store(struct device *dev,
 	memcpy(&mbx->mbx_tx.mbc_packet, &mbx->mbx_tst_pkt, sizeof(struct mailbox_pkt));
 	reset_pkt(&mbx->mbx_tst_pkt);
 	chan_send_pkt(&mbx->mbx_tx);
+	WARN_ON((mailbox_chk_err(mbx) & STATUS_FULL) != 0);
 	return count;
 }
 
 /* Packet test i/f. */
 static DEVICE_ATTR_RW(mailbox_pkt);
 
+static int mailbox_enable_intr(struct mailbox *mbx, bool enable);
+
+static ssize_t mailbox_intr_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+
+	return sprintf(buf, "%d\n", READ_ONCE(mbx->mbx_intr_on));
+}
+
+static ssize_t mailbox_intr_mode_store(struct device *dev,
+				       struct device_attribute *da, const char *buf, size_t count)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	bool enable;
+	int ret;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	ret = mailbox_enable_intr(mbx, enable);
+	return ret ? ret : count;
+}
+
+/* Switch between interrupt and polling mode, 1 for interrupt mode. */
+static DEVICE_ATTR_RW(mailbox_intr_mode);
+
+/* Leave room for exactly one packet, so STA means next packet can be pushed. */
+static inline void mailbox_set_sit(struct mailbox *mbx)
+{
+	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_sit, mbx->mbx_fifo_depth - PACKET_SIZE);
+}
+
+static ssize_t mailbox_fifo_depth_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+
+	return sprintf(buf, "%u\n", mbx->mbx_fifo_depth);
+}
+
+static ssize_t mailbox_fifo_depth_store(struct device *dev,
+					struct device_attribute *da, const char *buf, size_t count)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	u32 depth;
+
+	if (MBX_SW_ONLY(mbx))
+		return -ENODEV;
+
+	if (kstrtou32(buf, 0, &depth) || depth < PACKET_SIZE ||
+	    depth > MBX_MAX_FIFO_DEPTH || (depth % PACKET_SIZE)) {
+		MBX_ERR(mbx, "FIFO depth should be multiple of %d DWORDs, max %d",
+			PACKET_SIZE, MBX_MAX_FIFO_DEPTH);
+		return -EINVAL;
+	}
+
+	mbx->mbx_fifo_depth = depth;
+	mailbox_set_sit(mbx);
+	chan_kick(&mbx->mbx_tx);
+	return count;
+}
+
+/* HW FIFO depth in DWORDs, tells how many packets can be pushed in one go. */
+static DEVICE_ATTR_RW(mailbox_fifo_depth);
+
+static ssize_t chan_stats_show(struct mailbox_channel *ch, char *buf)
+{
+	struct mailbox_chan_stats *st = &ch->mbc_stats;
+	u64 kbps = 0;
+
+	if (st->mcs_busy_ns)
+		kbps = div64_u64(st->mcs_bytes * (NSEC_PER_SEC / 1024), st->mcs_busy_ns);
+
+	return sprintf(buf, "%s: %llu msgs %llu pkts %llu bytes %llu KB/s\n",
+		       ch_name(ch), st->mcs_msgs, st->mcs_pkts, st->mcs_bytes, kbps);
+}
+
+static ssize_t mailbox_throughput_show(struct device *dev, struct device_attribute *attr,
+				       char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	ssize_t n;
+
+	n = chan_stats_show(&mbx->mbx_tx, buf);
+	n += chan_stats_show(&mbx->mbx_rx, buf + n);
+	return n;
+}
+
+/* Bytes moved per second while there is msg outstanding on each channel. */
+static DEVICE_ATTR_RO(mailbox_throughput);
+
+static ssize_t mailbox_tx_queue_show(struct device *dev, struct device_attribute *attr,
+				     char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	struct mailbox_channel *ch = &mbx->mbx_tx;
+	ssize_t n = 0;
+	int i;
+
+	/* Updated by TX worker without lock, good enough for a snapshot. */
+	for (i = 0; i < ARRAY_SIZE(tx_prio_order); i++) {
+		enum xrt_mailbox_prio prio = tx_prio_order[i];
+		struct mailbox_prio_stats *st = &ch->mbc_prio_stats[prio];
+		u64 avg = st->mps_msgs ? div64_u64(st->mps_wait_ns, st->mps_msgs) : 0;
+
+		n += sprintf(buf + n, "%s: depth %u max_depth %u msgs %llu ",
+			     tx_prio_names[prio], st->mps_depth, st->mps_max_depth, st->mps_msgs);
+		n += sprintf(buf + n, "avg_wait %lluus max_wait %lluus\n",
+			     div_u64(avg, NSEC_PER_USEC),
+			     div_u64(st->mps_max_wait_ns, NSEC_PER_USEC));
+	}
+
+	return n;
+}
+
+/* Depth and wait time of TX queue of each priority. */
+static DEVICE_ATTR_RO(mailbox_tx_queue);
+
+static ssize_t mailbox_preempt_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+
+	return sprintf(buf, "%d\n", READ_ONCE(mbx->mbx_preempt));
+}
+
+static ssize_t mailbox_preempt_store(struct device *dev,
+				     struct device_attribute *da, const char *buf, size_t count)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	bool enable;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	WRITE_ONCE(mbx->mbx_preempt, enable);
+	return count;
+}
+
+/* Allow bulk msg on HW channel to be preempted, peer must support it. */
+static DEVICE_ATTR_RW(mailbox_preempt);
+
+static ssize_t mailbox_caps_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+
+	return sprintf(buf, "0x%x\n", READ_ONCE(mbx->mbx_caps));
+}
+
+/* XCL_MB_CAP_* agreed with peer. */
+static DEVICE_ATTR_RO(mailbox_caps);
+
+static ssize_t sw_queue_depth_show(struct mailbox_channel *ch, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(ch->sw_chan_q_depth));
+}
+
+static ssize_t sw_queue_depth_store(struct mailbox_channel *ch, const char *buf, size_t count)
+{
+	u32 depth;
+
+	if (kstrtou32(buf, 0, &depth) || depth == 0 || depth > MBX_SW_QUEUE_MAX_DEPTH)
+		return -EINVAL;
+
+	WRITE_ONCE(ch->sw_chan_q_depth, depth);
+	/* Waiters may have room now. */
+	wake_up_interruptible(&ch->sw_chan_wq);
+	chan_kick(ch);
+	return count;
+}
+
+static ssize_t mailbox_sw_tx_depth_show(struct device *dev, struct device_attribute *attr,
+					char *buf)
+{
+	struct mailbox *mbx = xrt_get_drvdata(to_xrt_dev(dev));
+
+	return sw_queue_depth_show(&mbx->mbx_tx, buf);
+}
+
+static ssize_t mailbox_sw_tx_depth_store(struct device *dev, struct device_attribute *da,
+					 const char *buf, size_t count)
+{
+	struct mailbox *mbx = xrt_get_drvdata(to_xrt_dev(dev));
+
+	return sw_queue_depth_store(&mbx->mbx_tx, buf, count);
+}
+
+/* Max number of msgs queued in SW channel for daemon to read. */
+static DEVICE_ATTR_RW(mailbox_sw_tx_depth);
+
+static ssize_t mailbox_sw_rx_depth_show(struct device *dev, struct device_attribute *attr,
+					char *buf)
+{
+	struct mailbox *mbx = xrt_get_drvdata(to_xrt_dev(dev));
+
+	return sw_queue_depth_show(&mbx->mbx_rx, buf);
+}
+
+static ssize_t mailbox_sw_rx_depth_store(struct device *dev, struct device_attribute *da,
+					 const char *buf, size_t count)
+{
+	struct mailbox *mbx = xrt_get_drvdata(to_xrt_dev(dev));
+
+	return sw_queue_depth_store(&mbx->mbx_rx, buf, count);
+}
+
+/* Max number of msgs written by daemon and queued in SW channel. */
+static DEVICE_ATTR_RW(mailbox_sw_rx_depth);
+
 static struct attribute *mailbox_attrs[] = {
 	&dev_attr_mailbox_ctl.attr,
 	&dev_attr_mailbox_pkt.attr,
+	&dev_attr_mailbox_intr_mode.attr,
+	&dev_attr_mailbox_fifo_depth.attr,
+	&dev_attr_mailbox_throughput.attr,
+	&dev_attr_mailbox_tx_queue.attr,
+	&dev_attr_mailbox_preempt.attr,
+	&dev_attr_mailbox_caps.attr,
+	&dev_attr_mailbox_sw_tx_depth.attr,
+	&dev_attr_mailbox_sw_rx_depth.attr,
 	NULL,
 };
 
@@ -1273,29 +3126,187 @@ static const struct attribute_group mailbox_attrgroup = {
 	.attrs = mailbox_attrs,
 };
 
+/* Root of debugfs entries of all mailbox instances. */
+static struct dentry *mailbox_debugfs_root;
+
+static void hist_show(struct seq_file *m, const char *name, struct mailbox_hist *h)
+{
+	int i;
+
+	seq_printf(m, "\t%s:", name);
+	for (i = 0; i < MBX_HIST_BUCKETS; i++) {
+		if (!h->mh_cnt[i])
+			continue;
+		if (i == MBX_HIST_BUCKETS - 1)
+			seq_printf(m, " >=%lluus:%llu", 1ULL << (i - 1), h->mh_cnt[i]);
+		else
+			seq_printf(m, " <%lluus:%llu", 1ULL << i, h->mh_cnt[i]);
+	}
+	seq_puts(m, "\n");
+}
+
+static int mailbox_stats_show(struct seq_file *m, void *unused)
+{
+	static const char * const cls_names[2][2] = {
+		{ "tx_hw", "tx_sw" },
+		{ "rx_hw", "rx_sw" },
+	};
+	struct mailbox *mbx = m->private;
+	struct mailbox_stats *st;
+	int i, j;
+
+	/* Take a snapshot, so that seq_file is not written with lock held. */
+	st = kmalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+	spin_lock(&mbx->mbx_stats.ms_lock);
+	*st = mbx->mbx_stats;
+	spin_unlock(&mbx->mbx_stats.ms_lock);
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			struct mailbox_class_stats *cls = &st->ms_class[i][j];
+
+			seq_printf(m, "%s: msgs %llu bytes %llu pkts %llu errors %llu timeouts %llu\n",
+				   cls_names[i][j], cls->mcls_msgs, cls->mcls_bytes, cls->mcls_pkts,
+				   cls->mcls_errors, cls->mcls_timeouts);
+			if (!i)
+				hist_show(m, "queue_lat", &cls->mcls_queue_lat);
+			hist_show(m, "xfer_lat", &cls->mcls_xfer_lat);
+		}
+	}
+
+	for (i = 0; i < MBX_STATS_OPCODES; i++) {
+		struct mailbox_op_stats *op = &st->ms_op[i];
+
+		if (!op->mos_tx_reqs && !op->mos_rx_reqs && !op->mos_timeouts)
+			continue;
+		seq_printf(m, "opcode %d (%s): tx_reqs %llu rx_reqs %llu timeouts %llu\n", i,
+			   mailbox_req2name(i), op->mos_tx_reqs, op->mos_rx_reqs, op->mos_timeouts);
+		hist_show(m, "rtt", &op->mos_rtt);
+	}
+
+	seq_printf(m, "max_resp_pending %u max_req_pending %u max_req_inflight %u\n",
+		   st->ms_max_resp_pending, st->ms_max_req_pending, st->ms_max_req_inflight);
+	seq_printf(m, "max_sw_tx_q %u max_sw_rx_q %u\n", st->ms_max_sw_q[0], st->ms_max_sw_q[1]);
+	seq_printf(m, "peer %s hb_missed %u\n", READ_ONCE(mbx->mbx_peer_down) ? "down" : "up",
+		   READ_ONCE(mbx->mbx_hb_missed));
+
+	for (i = 0; i < 2; i++) {
+		struct mailbox_lz4_stats *lz = &st->ms_lz4[i];
+		u64 ratio = lz->mls_wire ? div64_u64(lz->mls_raw * 100, lz->mls_wire) : 0;
+
+		seq_printf(m, "%s_lz4: msgs %llu raw %llu wire %llu ratio %llu.%02llu %s_us %llu skipped %llu\n",
+			   i ? "rx" : "tx", lz->mls_msgs, lz->mls_raw, lz->mls_wire,
+			   ratio / 100, ratio % 100, i ? "decomp" : "comp",
+			   div64_u64(lz->mls_ns, NSEC_PER_USEC), lz->mls_skipped);
+	}
+	/*
+	 * Estimated HW channel time saved by sending less bytes, based on
+	 * measured TX throughput, minus the time spent on compressing.
+	 */
+	if (st->ms_lz4[0].mls_msgs && mbx->mbx_tx.mbc_stats.mcs_bytes) {
+		struct mailbox_lz4_stats *lz = &st->ms_lz4[0];
+		s64 saved = div64_u64((lz->mls_raw - lz->mls_wire) *
+				      mbx->mbx_tx.mbc_stats.mcs_busy_ns,
+				      mbx->mbx_tx.mbc_stats.mcs_bytes);
+
+		seq_printf(m, "tx_lz4_est_saved_us %lld\n",
+			   div_s64(saved - (s64)lz->mls_ns, NSEC_PER_USEC));
+	}
+	seq_printf(m, "csum_errors %llu\n", st->ms_csum_errors);
+
+	kfree(st);
+	return 0;
+}
+
+static int mailbox_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mailbox_stats_show, inode->i_private);
+}
+
+static const struct file_operations mailbox_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = mailbox_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Any write resets all stats. */
+static ssize_t mailbox_stats_reset_write(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct mailbox *mbx = file->private_data;
+	struct mailbox_stats *st = &mbx->mbx_stats;
+
+	spin_lock(&st->ms_lock);
+	memset(st->ms_class, 0, sizeof(st->ms_class));
+	memset(st->ms_op, 0, sizeof(st->ms_op));
+	st->ms_max_resp_pending = 0;
+	st->ms_max_req_pending = 0;
+	st->ms_max_req_inflight = 0;
+	memset(st->ms_max_sw_q, 0, sizeof(st->ms_max_sw_q));
+	memset(st->ms_lz4, 0, sizeof(st->ms_lz4));
+	st->ms_csum_errors = 0;
+	spin_unlock(&st->ms_lock);
+
+	return count;
+}
+
+static const struct file_operations mailbox_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = mailbox_stats_reset_write,
+	.llseek = no_llseek,
+};
+
+static int msg_set_prio(struct mailbox_msg *msg, enum xrt_mailbox_prio prio)
+{
+	if (prio >= XRT_MAILBOX_PRIO_MAX)
+		return -EINVAL;
+
+	if (prio == XRT_MAILBOX_PRIO_INTERACTIVE && msg->mbm_len > XRT_MAILBOX_BULK_SIZE)
+		prio = XRT_MAILBOX_PRIO_BULK;
+	msg->mbm_prio = prio;
+	return 0;
+}
+
 /*
- * Msg will be sent to peer and reply will be received.
+ * Msg will be sent to peer and cb will be called when reply is received.
+ * The request is copied, so caller's buffer can go away once we return.
  */
-static int mailbox_request(struct xrt_device *xdev, void *req,
-			   size_t reqlen, void *resp, size_t *resplen, bool sw_ch, u32 resp_ttl)
+static int mailbox_request_async(struct xrt_device *xdev, void *req, size_t reqlen,
+				 void *resp, size_t resplen, bool sw_ch, u32 resp_ttl,
+				 enum xrt_mailbox_prio prio, u32 flags,
+				 mailbox_msg_cb_t cb, void *cbarg)
 {
 	int rv = -ENOMEM;
 	struct mailbox *mbx = xrt_get_drvdata(xdev);
 	struct mailbox_msg *reqmsg = NULL, *respmsg = NULL;
 
-	reqmsg = alloc_msg(req, reqlen);
+	reqmsg = alloc_msg(mbx, NULL, reqlen);
 	if (!reqmsg)
 		goto fail;
+	memcpy(reqmsg->mbm_data, req, reqlen);
 	reqmsg->mbm_chan_sw = sw_ch;
-	reqmsg->mbm_req_id = (uintptr_t)reqmsg->mbm_data;
-	reqmsg->mbm_flags |= MSG_FLAG_REQUEST;
+	reqmsg->mbm_req_id = mailbox_new_req_id(mbx);
+	reqmsg->mbm_flags |= MSG_FLAG_REQUEST | flags;
+	reqmsg->mbm_wait_resp = true;
+	reqmsg->mbm_resp_ttl = resp_ttl;
+	rv = msg_set_prio(reqmsg, prio);
+	if (rv)
+		goto fail;
 
-	respmsg = alloc_msg(resp, *resplen);
+	respmsg = alloc_msg(mbx, resp, resplen);
 	if (!respmsg)
 		goto fail;
 	/* Only interested in response w/ same ID. */
 	respmsg->mbm_req_id = reqmsg->mbm_req_id;
+	respmsg->mbm_opcode = msg_req_opcode(reqmsg);
 	respmsg->mbm_chan_sw = sw_ch;
+	respmsg->mbm_cb = cb;
+	respmsg->mbm_cb_arg = cbarg;
 
 	/* Always enqueue RX msg before TX one to avoid race. */
 	rv = chan_msg_enqueue(&mbx->mbx_rx, respmsg);
@@ -1304,132 +3315,619 @@ static int mailbox_request(struct xrt_device *xdev, void *req,
 	rv = chan_msg_enqueue(&mbx->mbx_tx, reqmsg);
 	if (rv) {
 		respmsg = chan_msg_dequeue(&mbx->mbx_rx, reqmsg->mbm_req_id);
+		if (!respmsg) {
+			/*
+			 * Response buffer has been time'd out (deadline or peer
+			 * down) and its cb is on the way with the error. Report
+			 * success here so that the error is delivered only once.
+			 */
+			free_msg(reqmsg);
+			return 0;
+		}
 		goto fail;
 	}
 
-	/* Wait for req to be sent. */
-	wait_for_completion(&reqmsg->mbm_complete);
-	rv = reqmsg->mbm_error;
-	if (rv) {
-		chan_msg_dequeue(&mbx->mbx_rx, reqmsg->mbm_req_id);
-		goto fail;
-	}
-	free_msg(reqmsg);
+	/* Both msgs are owned by the channels from now on. */
+	return 0;
+
+fail:
+	if (reqmsg)
+		free_msg(reqmsg);
+	if (respmsg)
+		free_msg(respmsg);
+	return rv;
+}
+
+struct mailbox_req_waiter {
+	struct completion	mrw_comp;
+	size_t			mrw_len;
+	int			mrw_err;
+};
+
+static void mailbox_req_wake(void *arg, void *data, size_t len, u64 msgid, int err, bool sw_ch)
+{
+	struct mailbox_req_waiter *w = arg;
+
+	w->mrw_len = len;
+	w->mrw_err = err;
+	complete(&w->mrw_comp);
+}
+
+/*
+ * Msg will be sent to peer and reply will be received.
+ */
+static int mailbox_request(struct xrt_device *xdev, void *req, size_t reqlen, void *resp,
+			   size_t *resplen, bool sw_ch, u32 resp_ttl, enum xrt_mailbox_prio prio)
+{
+	struct mailbox_req_waiter w;
+	int rv;
+
+	init_completion(&w.mrw_comp);
+	rv = mailbox_request_async(xdev, req, reqlen, resp, *resplen, sw_ch, resp_ttl,
+				   prio, 0, mailbox_req_wake, &w);
+	if (rv)
+		return rv;
+
+	wait_for_completion(&w.mrw_comp);
+	if (w.mrw_err == 0)
+		*resplen = w.mrw_len;
+	return w.mrw_err;
+}
+
+/*
+ * Posting notification or response to peer.
+ */
+static int mailbox_post(struct xrt_device *xdev, u64 reqid, void *buf, size_t len, bool sw_ch,
+			enum xrt_mailbox_prio prio)
+{
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	struct mailbox_msg *msg = NULL;
+	int rv = 0;
+
+	msg = alloc_msg(mbx, NULL, len);
+	if (!msg)
+		return -ENOMEM;
+
+	rv = msg_set_prio(msg, prio);
+	if (rv) {
+		free_msg(msg);
+		return rv;
+	}
+
+	memcpy(msg->mbm_data, buf, len);
+	msg->mbm_chan_sw = sw_ch;
+	msg->mbm_req_id = reqid ? reqid : mailbox_new_req_id(mbx);
+	msg->mbm_flags |= reqid ? MSG_FLAG_RESPONSE : MSG_FLAG_REQUEST;
+
+	rv = chan_msg_enqueue(&mbx->mbx_tx, msg);
+	if (rv == 0) {
+		wait_for_completion(&msg->mbm_complete);
+		rv = msg->mbm_error;
+	}
+
+	if (rv)
+		MBX_ERR(mbx, "failed to post msg, err=%d", rv);
+	free_msg(msg);
+	return rv;
+}
+
+static inline bool is_bench_msg(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	return (msg->mbm_flags & MSG_FLAG_BENCH) && READ_ONCE(mbx->mbx_lb_peer);
+}
+
+static void process_request(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	/* Benchmark request is simply echoed back. */
+	if (is_bench_msg(mbx, msg)) {
+		if (!msg->mbm_error) {
+			mailbox_post(mbx->mbx_xdev, msg->mbm_req_id, msg->mbm_data,
+				     msg->mbm_len, true, XRT_MAILBOX_PRIO_INTERACTIVE);
+		}
+		return;
+	}
+
+	/* Call client's registered callback to process request. */
+	down_read(&mbx->mbx_listen_cb_lock);
+
+	if (mbx->mbx_listen_cb) {
+		mbx->mbx_listen_cb(mbx->mbx_listen_cb_arg, msg->mbm_data,
+				   msg->mbm_len, msg->mbm_req_id, msg->mbm_error, msg->mbm_chan_sw);
+	} else {
+		MBX_INFO(mbx, "msg dropped, no listener");
+	}
+
+	up_read(&mbx->mbx_listen_cb_lock);
+}
+
+static bool req_is_concurrent(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	bool ret = false;
+
+	if (msg->mbm_error)
+		return false;
+	if (is_bench_msg(mbx, msg))
+		return true;
+
+	down_read(&mbx->mbx_listen_cb_lock);
+	if (mbx->mbx_listen_cb && mbx->mbx_listen_concurrent) {
+		ret = mbx->mbx_listen_concurrent(mbx->mbx_listen_cb_arg,
+						 msg->mbm_data, msg->mbm_len);
+	}
+	up_read(&mbx->mbx_listen_cb_lock);
+
+	return ret;
+}
+
+static void mailbox_req_work(struct work_struct *work)
+{
+	struct mailbox_msg *msg = container_of(work, struct mailbox_msg, mbm_work);
+	struct mailbox *mbx = msg->mbm_parent;
+
+	process_request(mbx, msg);
+	free_msg(msg);
+
+	atomic_dec(&mbx->mbx_req_inflight);
+	wake_up(&mbx->mbx_req_wait);
+}
+
+/* Let concurrent requests received so far finish before a serial one starts. */
+static void mailbox_serial_drain(struct mailbox *mbx)
+{
+	atomic_inc(&mbx->mbx_serial_draining);
+	wait_event(mbx->mbx_req_wait, !atomic_read(&mbx->mbx_req_inflight));
+	atomic_dec(&mbx->mbx_serial_draining);
+	wake_up(&mbx->mbx_req_wait);
+}
+
+static void mailbox_serial_work(struct work_struct *work)
+{
+	struct mailbox_msg *msg = container_of(work, struct mailbox_msg, mbm_work);
+	struct mailbox *mbx = msg->mbm_parent;
+
+	mailbox_serial_drain(mbx);
+	process_request(mbx, msg);
+	free_msg(msg);
+}
+
+static void dispatch_request(struct mailbox *mbx, struct mailbox_msg *msg)
+{
+	if (!req_is_concurrent(mbx, msg)) {
+		INIT_WORK(&msg->mbm_work, mailbox_serial_work);
+		queue_work(mbx->mbx_serial_wq, &msg->mbm_work);
+		return;
+	}
+
+	wait_event(mbx->mbx_req_wait, !atomic_read(&mbx->mbx_serial_draining) &&
+		   atomic_read(&mbx->mbx_req_inflight) < MBX_REQ_MAX_INFLIGHT);
+	stats_hwm(mbx, &mbx->mbx_stats.ms_max_req_inflight,
+		  atomic_inc_return(&mbx->mbx_req_inflight));
+	INIT_WORK(&msg->mbm_work, mailbox_req_work);
+	queue_work(mbx->mbx_req_wq, &msg->mbm_work);
+}
+
+/*
+ * Wait for request from peer.
+ */
+static void mailbox_recv_request(struct work_struct *work)
+{
+	struct mailbox_msg *msg = NULL;
+	struct mailbox *mbx = container_of(work, struct mailbox, mbx_listen_worker);
+
+	while (!mbx->mbx_listen_stop) {
+		/* Only interested in request msg. */
+		wait_for_completion_interruptible(&mbx->mbx_comp);
+
+		mutex_lock(&mbx->mbx_lock);
+
+		while ((msg = list_first_entry_or_null(&mbx->mbx_req_list,
+						       struct mailbox_msg, mbm_list))) {
+			list_del(&msg->mbm_list);
+			mbx->mbx_req_cnt--;
+			mutex_unlock(&mbx->mbx_lock);
+
+			/* Process msg without holding mutex. */
+			dispatch_request(mbx, msg);
+
+			mutex_lock(&mbx->mbx_lock);
+		}
+
+		mutex_unlock(&mbx->mbx_lock);
+	}
+
+	/* Drain all msg before quit. */
+	mutex_lock(&mbx->mbx_lock);
+	while ((msg = list_first_entry_or_null(&mbx->mbx_req_list, struct mailbox_msg, mbm_list))) {
+		list_del(&msg->mbm_list);
+		free_msg(msg);
+	}
+	mutex_unlock(&mbx->mbx_lock);
+}
+
+/*
+ * Waits for all running callbacks to finish before switching to new listener,
+ * so the old one can go away right after.
+ */
+static int mailbox_listen(struct xrt_device *xdev, struct xrt_mailbox_listen *listen)
+{
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+
+	down_write(&mbx->mbx_listen_cb_lock);
+
+	mbx->mbx_listen_cb_arg = listen->xmil_cb_arg;
+	mbx->mbx_listen_cb = listen->xmil_cb;
+	mbx->mbx_listen_concurrent = listen->xmil_concurrent;
+	mbx->mbx_listen_stream = listen->xmil_stream;
+
+	up_write(&mbx->mbx_listen_cb_lock);
+
+	return 0;
+}
+
+/*
+ * Pair up SW channel of mbx with the one of peer in both directions, or undo
+ * it when peer is NULL. Peer can be mbx itself.
+ */
+static int mailbox_lb_pair(struct mailbox *mbx, struct mailbox *peer)
+{
+	struct mailbox *old;
+
+	WARN_ON(!mutex_is_locked(&mailbox_list_lock));
+
+	if (peer && peer != mbx && peer->mbx_lb_peer && peer->mbx_lb_peer != mbx)
+		return -EBUSY;
+
+	old = mbx->mbx_lb_peer;
+	if (old)
+		WRITE_ONCE(old->mbx_lb_peer, NULL);
+	WRITE_ONCE(mbx->mbx_lb_peer, peer);
+	if (peer)
+		WRITE_ONCE(peer->mbx_lb_peer, mbx);
+	return 0;
+}
+
+static int mailbox_lb_show(struct seq_file *m, void *unused)
+{
+	struct mailbox *mbx = m->private;
+	struct mailbox *peer;
+
+	mutex_lock(&mailbox_list_lock);
+	peer = mbx->mbx_lb_peer;
+	if (!peer)
+		seq_puts(m, "off\n");
+	else if (peer == mbx)
+		seq_puts(m, "self\n");
+	else
+		seq_printf(m, "%s\n", mbx_name(peer));
+	mutex_unlock(&mailbox_list_lock);
+
+	return 0;
+}
+
+static int mailbox_lb_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mailbox_lb_show, inode->i_private);
+}
+
+/* Takes "off", "self" or device name of another mailbox instance. */
+static ssize_t mailbox_lb_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct mailbox *mbx = ((struct seq_file *)file->private_data)->private;
+	struct mailbox *peer = NULL, *m;
+	char buf[64] = { 0 };
+	char *name;
+	int ret = -ENODEV;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	name = strim(buf);
+
+	mutex_lock(&mailbox_list_lock);
+	if (!strcmp(name, "off")) {
+		ret = 0;
+	} else if (!strcmp(name, "self")) {
+		peer = mbx;
+		ret = 0;
+	} else {
+		list_for_each_entry(m, &mailbox_list, mbx_node) {
+			if (!strcmp(name, mbx_name(m))) {
+				peer = m;
+				ret = 0;
+				break;
+			}
+		}
+	}
+	if (!ret)
+		ret = mailbox_lb_pair(mbx, peer);
+	mutex_unlock(&mailbox_list_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations mailbox_lb_fops = {
+	.owner = THIS_MODULE,
+	.open = mailbox_lb_open,
+	.read = seq_read,
+	.write = mailbox_lb_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* One outstanding benchmark request. */
+struct mailbox_bench_slot {
+	struct list_head	mbs_list;
+	struct mailbox_bench	*mbs_bench;
+	u64			mbs_start_ts;
+	size_t			mbs_len;
+	char			*mbs_req;
+	char			*mbs_resp;
+};
+
+/* State of a benchmark run, shared with response callbacks. */
+struct mailbox_bench {
+	spinlock_t		mb_lock; /* protects all below */
+	struct list_head	mb_free;
+	u64			*mb_lat;
+	u32			mb_nr_lat;
+	u64			mb_errors;
+	u64			mb_bytes;
+	/* Counts free slots. */
+	struct semaphore	mb_sem;
+};
+
+static void bench_slot_put(struct mailbox_bench_slot *slot, int err, u64 bytes)
+{
+	struct mailbox_bench *b = slot->mbs_bench;
+	u64 lat = ktime_get_ns() - slot->mbs_start_ts;
+
+	spin_lock(&b->mb_lock);
+	if (err) {
+		b->mb_errors++;
+	} else {
+		b->mb_lat[b->mb_nr_lat++] = lat;
+		b->mb_bytes += bytes;
+	}
+	list_add(&slot->mbs_list, &b->mb_free);
+	spin_unlock(&b->mb_lock);
+
+	up(&b->mb_sem);
+}
+
+static void bench_resp(void *arg, void *data, size_t len, u64 msgid, int err, bool sw_ch)
+{
+	struct mailbox_bench_slot *slot = arg;
+
+	bench_slot_put(slot, err, slot->mbs_len + len);
+}
+
+static int bench_lat_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
 
-	/* Start timer and wait for resp to be received. */
-	msg_timer_on(respmsg, resp_ttl);
-	wait_for_completion(&respmsg->mbm_complete);
-	rv = respmsg->mbm_error;
-	if (rv == 0)
-		*resplen = respmsg->mbm_len;
+static void bench_lat_pct(struct mailbox_bench_res *res, u64 *lat, u32 n)
+{
+	static const u32 pct[MBX_BENCH_PCT_NUM] = { 500, 900, 990, 999, 1000 };
+	int i;
 
-	free_msg(respmsg);
-	return rv;
+	if (!n)
+		return;
 
-fail:
-	if (reqmsg)
-		free_msg(reqmsg);
-	if (respmsg)
-		free_msg(respmsg);
-	return rv;
+	sort(lat, n, sizeof(*lat), bench_lat_cmp, NULL);
+	for (i = 0; i < MBX_BENCH_PCT_NUM; i++)
+		res->mbr_lat[i] = lat[min(n - 1, (u32)div_u64((u64)n * pct[i], 1000))];
 }
 
 /*
- * Posting notification or response to peer.
+ * Send res->mbr_msgs requests on looped back SW channel, keeping up to
+ * res->mbr_window of them outstanding. Request sizes are random in between
+ * min and max size, opcodes are taken round-robin from ops.
  */
-static int mailbox_post(struct xrt_device *xdev, u64 reqid, void *buf, size_t len, bool sw_ch)
+static int mailbox_bench_run(struct mailbox *mbx, struct mailbox_bench_res *res,
+			     u32 *ops, int nr_ops)
 {
-	struct mailbox *mbx = xrt_get_drvdata(xdev);
-	struct mailbox_msg *msg = NULL;
-	int rv = 0;
+	struct mailbox_bench_slot *slots, *slot;
+	struct mailbox_bench *b;
+	struct xcl_mailbox_req *req;
+	u32 i, range = res->mbr_max_size - res->mbr_min_size + 1;
+	u64 start;
+	int ret = -ENOMEM;
+
+	if (!READ_ONCE(mbx->mbx_lb_peer))
+		return -ENOTCONN;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	slots = kcalloc(res->mbr_window, sizeof(*slots), GFP_KERNEL);
+	if (!b || !slots)
+		goto out;
+	b->mb_lat = kvmalloc_array(res->mbr_msgs, sizeof(*b->mb_lat), GFP_KERNEL);
+	if (!b->mb_lat)
+		goto out;
+	spin_lock_init(&b->mb_lock);
+	INIT_LIST_HEAD(&b->mb_free);
+	sema_init(&b->mb_sem, res->mbr_window);
+	for (i = 0; i < res->mbr_window; i++) {
+		slot = &slots[i];
+		slot->mbs_bench = b;
+		slot->mbs_req = kvzalloc(res->mbr_max_size, GFP_KERNEL);
+		slot->mbs_resp = kvzalloc(res->mbr_max_size, GFP_KERNEL);
+		if (!slot->mbs_req || !slot->mbs_resp)
+			goto out;
+		list_add(&slot->mbs_list, &b->mb_free);
+	}
 
-	msg = alloc_msg(NULL, len);
-	if (!msg)
-		return -ENOMEM;
+	ret = 0;
+	start = ktime_get_ns();
+	for (i = 0; i < res->mbr_msgs; i++) {
+		if (down_interruptible(&b->mb_sem)) {
+			ret = -EINTR;
+			break;
+		}
+		spin_lock(&b->mb_lock);
+		slot = list_first_entry(&b->mb_free, struct mailbox_bench_slot, mbs_list);
+		list_del(&slot->mbs_list);
+		spin_unlock(&b->mb_lock);
+
+		slot->mbs_len = res->mbr_min_size + get_random_u32() % range;
+		req = (struct xcl_mailbox_req *)slot->mbs_req;
+		req->req = ops[i % nr_ops];
+		slot->mbs_start_ts = ktime_get_ns();
+		if (mailbox_request_async(mbx->mbx_xdev, slot->mbs_req, slot->mbs_len,
+					  slot->mbs_resp, res->mbr_max_size, true, MBX_BENCH_TTL,
+					  XRT_MAILBOX_PRIO_INTERACTIVE, MSG_FLAG_BENCH,
+					  bench_resp, slot))
+			bench_slot_put(slot, -EIO, 0);
+	}
 
-	memcpy(msg->mbm_data, buf, len);
-	msg->mbm_chan_sw = sw_ch;
-	msg->mbm_req_id = reqid ? reqid : (uintptr_t)msg->mbm_data;
-	msg->mbm_flags |= reqid ? MSG_FLAG_RESPONSE : MSG_FLAG_REQUEST;
+	/* Wait for all outstanding ones, they are bound by TTL. */
+	for (i = 0; i < res->mbr_window; i++)
+		down(&b->mb_sem);
 
-	rv = chan_msg_enqueue(&mbx->mbx_tx, msg);
-	if (rv == 0) {
-		wait_for_completion(&msg->mbm_complete);
-		rv = msg->mbm_error;
-	}
+	res->mbr_elapsed_ns = ktime_get_ns() - start;
+	res->mbr_msgs = b->mb_nr_lat + b->mb_errors;
+	res->mbr_errors = b->mb_errors;
+	res->mbr_bytes = b->mb_bytes;
+	bench_lat_pct(res, b->mb_lat, b->mb_nr_lat);
 
-	if (rv)
-		MBX_ERR(mbx, "failed to post msg, err=%d", rv);
-	free_msg(msg);
-	return rv;
+out:
+	if (slots) {
+		for (i = 0; i < res->mbr_window; i++) {
+			kvfree(slots[i].mbs_req);
+			kvfree(slots[i].mbs_resp);
+		}
+	}
+	kfree(slots);
+	if (b)
+		kvfree(b->mb_lat);
+	kfree(b);
+	return ret;
 }
 
-static void process_request(struct mailbox *mbx, struct mailbox_msg *msg)
+static int mailbox_bench_show(struct seq_file *m, void *unused)
 {
-	/* Call client's registered callback to process request. */
-	mutex_lock(&mbx->mbx_listen_cb_lock);
+	struct mailbox *mbx = m->private;
+	struct mailbox_bench_res res;
+	u64 ns;
+
+	mutex_lock(&mbx->mbx_bench_lock);
+	res = mbx->mbx_bench_res;
+	mutex_unlock(&mbx->mbx_bench_lock);
+
+	ns = max_t(u64, res.mbr_elapsed_ns, 1);
+	seq_printf(m, "msgs %u errors %llu size %u-%u window %u elapsed_us %llu\n",
+		   res.mbr_msgs, res.mbr_errors, res.mbr_min_size, res.mbr_max_size,
+		   res.mbr_window, div_u64(res.mbr_elapsed_ns, NSEC_PER_USEC));
+	seq_printf(m, "msgs/s %llu MB/s %llu\n",
+		   div64_u64((u64)res.mbr_msgs * NSEC_PER_SEC, ns),
+		   div64_u64(res.mbr_bytes * 1000, ns));
+	seq_printf(m, "lat_us p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+		   div_u64(res.mbr_lat[MBX_BENCH_P50], NSEC_PER_USEC),
+		   div_u64(res.mbr_lat[MBX_BENCH_P90], NSEC_PER_USEC),
+		   div_u64(res.mbr_lat[MBX_BENCH_P99], NSEC_PER_USEC),
+		   div_u64(res.mbr_lat[MBX_BENCH_P999], NSEC_PER_USEC),
+		   div_u64(res.mbr_lat[MBX_BENCH_MAX], NSEC_PER_USEC));
 
-	if (mbx->mbx_listen_cb) {
-		mbx->mbx_listen_cb(mbx->mbx_listen_cb_arg, msg->mbm_data,
-				   msg->mbm_len, msg->mbm_req_id, msg->mbm_error, msg->mbm_chan_sw);
-	} else {
-		MBX_INFO(mbx, "msg dropped, no listener");
-	}
+	return 0;
+}
 
-	mutex_unlock(&mbx->mbx_listen_cb_lock);
+static int mailbox_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mailbox_bench_show, inode->i_private);
 }
 
 /*
- * Wait for request from peer.
+ * Takes "<msgs> <min size> <max size> <window> [<opcode>[,<opcode>...]]" and
+ * runs the benchmark before returning. Opcode defaults to TEST_READ.
  */
-static void mailbox_recv_request(struct work_struct *work)
+static ssize_t mailbox_bench_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
 {
-	struct mailbox_msg *msg = NULL;
-	struct mailbox *mbx = container_of(work, struct mailbox, mbx_listen_worker);
+	struct mailbox *mbx = ((struct seq_file *)file->private_data)->private;
+	struct mailbox_bench_res res = { 0 };
+	u32 ops[MBX_BENCH_MAX_OPS] = { XCL_MAILBOX_REQ_TEST_READ };
+	int nr_ops = 0, pos = 0;
+	char buf[128] = { 0 };
+	char *p, *tok;
+	int ret;
 
-	while (!mbx->mbx_listen_stop) {
-		/* Only interested in request msg. */
-		wait_for_completion_interruptible(&mbx->mbx_comp);
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
 
-		mutex_lock(&mbx->mbx_lock);
+	if (sscanf(buf, "%u %u %u %u %n", &res.mbr_msgs, &res.mbr_min_size,
+		   &res.mbr_max_size, &res.mbr_window, &pos) != 4)
+		return -EINVAL;
+	if (!res.mbr_msgs || res.mbr_msgs > MBX_BENCH_MAX_MSGS ||
+	    res.mbr_min_size < sizeof(struct xcl_mailbox_req) ||
+	    res.mbr_max_size < res.mbr_min_size || res.mbr_max_size >= MAX_REQ_MSG_SZ ||
+	    !res.mbr_window || res.mbr_window > MBX_BENCH_MAX_WINDOW)
+		return -EINVAL;
 
-		while ((msg = list_first_entry_or_null(&mbx->mbx_req_list,
-						       struct mailbox_msg, mbm_list))) {
-			list_del(&msg->mbm_list);
-			mbx->mbx_req_cnt--;
-			mutex_unlock(&mbx->mbx_lock);
+	p = strim(buf + pos);
+	while ((tok = strsep(&p, ",")) && *tok) {
+		if (nr_ops == MBX_BENCH_MAX_OPS || kstrtou32(tok, 0, &ops[nr_ops]))
+			return -EINVAL;
+		nr_ops++;
+	}
 
-			/* Process msg without holding mutex. */
-			process_request(mbx, msg);
-			free_msg(msg);
+	if (!mutex_trylock(&mbx->mbx_bench_lock))
+		return -EBUSY;
+	ret = mailbox_bench_run(mbx, &res, ops, max(nr_ops, 1));
+	if (!ret)
+		mbx->mbx_bench_res = res;
+	mutex_unlock(&mbx->mbx_bench_lock);
 
-			mutex_lock(&mbx->mbx_lock);
-		}
+	return ret ? ret : count;
+}
 
-		mutex_unlock(&mbx->mbx_lock);
-	}
+static const struct file_operations mailbox_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = mailbox_bench_open,
+	.read = seq_read,
+	.write = mailbox_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	/* Drain all msg before quit. */
-	mutex_lock(&mbx->mbx_lock);
-	while ((msg = list_first_entry_or_null(&mbx->mbx_req_list, struct mailbox_msg, mbm_list))) {
-		list_del(&msg->mbm_list);
-		free_msg(msg);
-	}
-	mutex_unlock(&mbx->mbx_lock);
+static void mailbox_debugfs_init(struct mailbox *mbx)
+{
+	/* Debugfs is optional, errors are ignored. */
+	mbx->mbx_debugfs = debugfs_create_dir(mbx_name(mbx), mailbox_debugfs_root);
+	debugfs_create_file("stats", 0444, mbx->mbx_debugfs, mbx, &mailbox_stats_fops);
+	debugfs_create_file("reset", 0200, mbx->mbx_debugfs, mbx, &mailbox_stats_reset_fops);
+	debugfs_create_file("loopback", 0600, mbx->mbx_debugfs, mbx, &mailbox_lb_fops);
+	debugfs_create_file("bench", 0600, mbx->mbx_debugfs, mbx, &mailbox_bench_fops);
 }
 
-static int mailbox_listen(struct xrt_device *xdev, mailbox_msg_cb_t cb, void *cbarg)
+static void mailbox_set_caps(struct mailbox *mbx, u32 caps)
 {
-	struct mailbox *mbx = xrt_get_drvdata(xdev);
-
-	mutex_lock(&mbx->mbx_listen_cb_lock);
-
-	mbx->mbx_listen_cb_arg = cbarg;
-	mbx->mbx_listen_cb = cb;
+	caps &= MBX_SUPPORTED_CAPS;
+	WRITE_ONCE(mbx->mbx_caps, caps);
+	WRITE_ONCE(mbx->mbx_preempt, !!(caps & XCL_MB_CAP_PREEMPT));
+	MBX_INFO(mbx, "peer caps set to 0x%x", caps);
+
+	/* Peer has just talked to us, start over on its liveness. */
+	mailbox_peer_seen(mbx);
+	mbx->mbx_hb_missed = 0;
+	if ((caps & XCL_MB_CAP_HEARTBEAT) && !MBX_SW_ONLY(mbx))
+		mod_delayed_work(system_wq, &mbx->mbx_hb_work,
+				 msecs_to_jiffies(MBX_HB_INTERVAL_MS));
+}
 
-	mutex_unlock(&mbx->mbx_listen_cb_lock);
+/* Hot reset takes peer down with the card, no point waiting for its replies. */
+static void mailbox_event_cb(struct xrt_device *xdev, void *arg)
+{
+	struct mailbox *mbx = xrt_get_drvdata(xdev);
+	struct xrt_event *evt = (struct xrt_event *)arg;
 
-	return 0;
+	if (evt->xe_evt == XRT_EVENT_PRE_HOT_RESET)
+		mailbox_peer_down(mbx, "hot reset");
 }
 
 static int mailbox_leaf_call(struct xrt_device *xdev, u32 cmd, void *arg)
@@ -1439,13 +3937,13 @@ static int mailbox_leaf_call(struct xrt_device *xdev, u32 cmd, void *arg)
 
 	switch (cmd) {
 	case XRT_XLEAF_EVENT:
-		/* Does not handle any event. */
+		mailbox_event_cb(xdev, arg);
 		break;
 	case XRT_MAILBOX_POST: {
 		struct xrt_mailbox_post *post = (struct xrt_mailbox_post *)arg;
 
 		ret = mailbox_post(xdev, post->xmip_req_id, post->xmip_data,
-				   post->xmip_data_size, post->xmip_sw_ch);
+				   post->xmip_data_size, post->xmip_sw_ch, post->xmip_prio);
 		break;
 	}
 	case XRT_MAILBOX_REQUEST: {
@@ -1453,15 +3951,33 @@ static int mailbox_leaf_call(struct xrt_device *xdev, u32 cmd, void *arg)
 
 		ret = mailbox_request(xdev, req->xmir_req, req->xmir_req_size,
 				      req->xmir_resp, &req->xmir_resp_size, req->xmir_sw_ch,
-				      req->xmir_resp_ttl);
+				      req->xmir_resp_ttl, req->xmir_prio);
+		break;
+	}
+	case XRT_MAILBOX_REQUEST_ASYNC: {
+		struct xrt_mailbox_request_async *req = (struct xrt_mailbox_request_async *)arg;
+
+		ret = mailbox_request_async(xdev, req->xmira_req, req->xmira_req_size,
+					    req->xmira_resp, req->xmira_resp_size, req->xmira_sw_ch,
+					    req->xmira_resp_ttl, req->xmira_prio, 0,
+					    req->xmira_cb, req->xmira_cb_arg);
 		break;
 	}
 	case XRT_MAILBOX_LISTEN: {
 		struct xrt_mailbox_listen *listen = (struct xrt_mailbox_listen *)arg;
 
-		ret = mailbox_listen(xdev, listen->xmil_cb, listen->xmil_cb_arg);
+		ret = mailbox_listen(xdev, listen);
 		break;
 	}
+	case XRT_MAILBOX_GET_CAPS:
+		*(u32 *)arg = MBX_SUPPORTED_CAPS;
+		break;
+	case XRT_MAILBOX_SET_CAPS:
+		mailbox_set_caps(mbx, *(u32 *)arg);
+		break;
+	case XRT_MAILBOX_PEER_DOWN:
+		mailbox_peer_down(mbx, "reported");
+		break;
 	default:
 		MBX_ERR(mbx, "unknown cmd: %d", cmd);
 		ret = -EINVAL;
@@ -1470,9 +3986,100 @@ static int mailbox_leaf_call(struct xrt_device *xdev, u32 cmd, void *arg)
 	return ret;
 }
 
+static irqreturn_t mailbox_isr(int irq, void *arg)
+{
+	struct mailbox *mbx = (struct mailbox *)arg;
+	u32 ip;
+
+	ip = mailbox_reg_rd(mbx, &mbx->mbx_regs->mbr_ip);
+	/* Device is being reset or firewall tripped. */
+	if (ip == 0xffffffff || !(ip & (FLAG_STI | FLAG_RTI)))
+		return IRQ_NONE;
+
+	/* Ack the intr before waking up workers so that no edge is lost. */
+	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_is, ip);
+
+	if (ip & FLAG_RTI)
+		chan_kick(&mbx->mbx_rx);
+	if (ip & FLAG_STI)
+		chan_kick(&mbx->mbx_tx);
+
+	return IRQ_HANDLED;
+}
+
+static int mailbox_enable_intr(struct mailbox *mbx, bool enable)
+{
+	if (MBX_SW_ONLY(mbx) || (enable && mbx->mbx_irq < 0))
+		return -ENODEV;
+
+	WRITE_ONCE(mbx->mbx_intr_on, enable);
+	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_ie, enable ? (FLAG_STI | FLAG_RTI) : 0);
+	/* Clear any stale intr and let workers catch up with current HW state. */
+	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_is, FLAG_STI | FLAG_RTI);
+	chan_kick(&mbx->mbx_tx);
+	chan_kick(&mbx->mbx_rx);
+	mailbox_poll_start(mbx);
+
+	MBX_INFO(mbx, "switched to %s mode", enable ? "interrupt" : "polling");
+	return 0;
+}
+
+/*
+ * Look up MSI-X vector assigned to mailbox in metadata (vsec copies it from the
+ * root VSEC node) and hook up the handler.
+ * Failing to do so is not fatal, we'll just keep polling the HW.
+ */
+static void mailbox_init_intr(struct mailbox *mbx)
+{
+	struct xrt_device *xdev = mbx->mbx_xdev;
+	struct xrt_subdev_platdata *pdata = DEV_PDATA(xdev);
+	const __be32 *vec;
+	int irq, ret;
+
+	if (MBX_SW_ONLY(mbx))
+		return;
+
+	ret = xrt_md_get_prop(DEV(xdev), pdata->xsp_dtb, XRT_MD_NODE_MAILBOX_VSEC,
+			      NULL, XRT_MD_PROP_INTERRUPTS, (const void **)&vec, NULL);
+	if (ret) {
+		MBX_INFO(mbx, "no interrupt assigned, use polling mode");
+		return;
+	}
+
+	irq = xleaf_get_root_irq(xdev, be32_to_cpu(*vec));
+	if (irq < 0) {
+		MBX_WARN(mbx, "failed to get irq for vector %d: %d, use polling mode",
+			 be32_to_cpu(*vec), irq);
+		return;
+	}
+
+	ret = request_threaded_irq(irq, NULL, mailbox_isr, IRQF_ONESHOT,
+				   dev_name(DEV(xdev)), mbx);
+	if (ret) {
+		MBX_WARN(mbx, "failed to request irq %d: %d, use polling mode", irq, ret);
+		return;
+	}
+	mbx->mbx_irq = irq;
+
+	mailbox_enable_intr(mbx, true);
+}
+
+static void mailbox_fini_intr(struct mailbox *mbx)
+{
+	if (mbx->mbx_irq < 0)
+		return;
+
+	mailbox_enable_intr(mbx, false);
+	free_irq(mbx->mbx_irq, mbx);
+	mbx->mbx_irq = -ENODEV;
+}
+
 static void mailbox_stop(struct mailbox *mbx)
 {
 	/* Tear down all threads. */
+	mailbox_fini_intr(mbx);
+	WRITE_ONCE(mbx->mbx_caps, 0);
+	cancel_delayed_work_sync(&mbx->mbx_hb_work);
 	del_timer_sync(&mbx->mbx_poll_timer);
 	chan_fini(&mbx->mbx_tx);
 	chan_fini(&mbx->mbx_rx);
@@ -1484,7 +4091,10 @@ static int mailbox_start(struct mailbox *mbx)
 {
 	int ret;
 
+	timer_setup(&mbx->mbx_poll_timer, mailbox_poll_timer, 0);
 	mbx->mbx_req_cnt = 0;
+	atomic_set(&mbx->mbx_req_inflight, 0);
+	atomic_set(&mbx->mbx_serial_draining, 0);
 	mbx->mbx_opened = 0;
 	mbx->mbx_listen_stop = false;
 
@@ -1495,6 +4105,20 @@ static int mailbox_start(struct mailbox *mbx)
 		ret = -ENOMEM;
 		goto out;
 	}
+	mbx->mbx_req_wq = alloc_workqueue("%s-req", WQ_UNBOUND, MBX_REQ_MAX_ACTIVE,
+					  dev_name(&mbx->mbx_xdev->dev));
+	if (!mbx->mbx_req_wq) {
+		MBX_ERR(mbx, "failed to create request work queue");
+		ret = -ENOMEM;
+		goto out;
+	}
+	mbx->mbx_serial_wq = alloc_ordered_workqueue("%s-serial", 0,
+						     dev_name(&mbx->mbx_xdev->dev));
+	if (!mbx->mbx_serial_wq) {
+		MBX_ERR(mbx, "failed to create serial request work queue");
+		ret = -ENOMEM;
+		goto out;
+	}
 	INIT_WORK(&mbx->mbx_listen_worker, mailbox_recv_request);
 	queue_work(mbx->mbx_listen_wq, &mbx->mbx_listen_worker);
 
@@ -1510,15 +4134,16 @@ static int mailbox_start(struct mailbox *mbx)
 		goto out;
 	}
 
-	/* Only see status change when we have full packet sent or received. */
-	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_rit, PACKET_SIZE - 1);
-	mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_sit, 0);
-
-	/* Disable both TX / RX intrs. We only do polling. */
-	if (!MBX_SW_ONLY(mbx))
+	if (!MBX_SW_ONLY(mbx)) {
+		/* Only see status change when we have full packet sent or received. */
+		mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_rit, PACKET_SIZE - 1);
+		mailbox_set_sit(mbx);
+		/* Disable both TX / RX intrs till we know there is an irq for us. */
 		mailbox_reg_wr(mbx, &mbx->mbx_regs->mbr_ie, 0x0);
-	timer_setup(&mbx->mbx_poll_timer, mailbox_poll_timer, 0);
-	mod_timer(&mbx->mbx_poll_timer, jiffies + MAILBOX_TTL_TIMER);
+	}
+	mailbox_poll_start(mbx);
+
+	mailbox_init_intr(mbx);
 
 out:
 	return ret;
@@ -1547,11 +4172,144 @@ static int mailbox_open(struct inode *inode, struct file *file)
 	mutex_lock(&mbx->mbx_lock);
 	mbx->mbx_opened++;
 	mutex_unlock(&mbx->mbx_lock);
+	/* Legacy daemon moves one msg per read() or write(). */
+	mbx->mbx_sw_batch = false;
 
 	file->private_data = mbx;
 	return 0;
 }
 
+static void mailbox_ring_fini(struct mailbox *mbx)
+{
+	struct mailbox_ring *mr;
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	mr = mbx->mbx_ring;
+	mbx->mbx_ring = NULL;
+	mutex_unlock(&mbx->mbx_ring_lock);
+
+	if (!mr)
+		return;
+	if (mr->mr_evt)
+		eventfd_ctx_put(mr->mr_evt);
+	vfree(mr->mr_buf);
+	kfree(mr);
+}
+
+static int mailbox_ring_setup(struct mailbox *mbx, void __user *arg)
+{
+	struct xcl_sw_ring_setup setup;
+	struct mailbox_ring *mr;
+	size_t ring_sz;
+	int ret;
+
+	if (copy_from_user(&setup, arg, sizeof(setup)))
+		return -EFAULT;
+
+	if (!is_power_of_2(setup.nr_slots) || setup.nr_slots > MBX_RING_MAX_SLOTS ||
+	    setup.slot_size <= MBX_RING_HDR_SIZE || !IS_ALIGNED(setup.slot_size, 8))
+		return -EINVAL;
+	ring_sz = PAGE_ALIGN(XCL_SW_RING_HDR_SIZE + (size_t)setup.nr_slots * setup.slot_size);
+	if (ring_sz * 2 > MBX_RING_MAX_SIZE)
+		return -EINVAL;
+
+	mr = kzalloc(sizeof(*mr), GFP_KERNEL);
+	if (!mr)
+		return -ENOMEM;
+	mr->mr_size = ring_sz * 2;
+	mr->mr_nr_slots = setup.nr_slots;
+	mr->mr_slot_size = setup.slot_size;
+	mr->mr_buf = vmalloc_user(mr->mr_size);
+	if (!mr->mr_buf) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	mr->mr_tx = mr->mr_buf;
+	mr->mr_rx = mr->mr_buf + ring_sz;
+	mr->mr_tx->nr_slots = mr->mr_nr_slots;
+	mr->mr_tx->slot_size = mr->mr_slot_size;
+	mr->mr_rx->nr_slots = mr->mr_nr_slots;
+	mr->mr_rx->slot_size = mr->mr_slot_size;
+
+	if (setup.eventfd >= 0) {
+		mr->mr_evt = eventfd_ctx_fdget(setup.eventfd);
+		if (IS_ERR(mr->mr_evt)) {
+			ret = PTR_ERR(mr->mr_evt);
+			mr->mr_evt = NULL;
+			goto fail;
+		}
+	}
+
+	setup.tx_offset = 0;
+	setup.rx_offset = ring_sz;
+	setup.mmap_size = mr->mr_size;
+	if (copy_to_user(arg, &setup, sizeof(setup))) {
+		ret = -EFAULT;
+		goto fail;
+	}
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	if (mbx->mbx_ring) {
+		mutex_unlock(&mbx->mbx_ring_lock);
+		ret = -EBUSY;
+		goto fail;
+	}
+	mbx->mbx_ring = mr;
+	mutex_unlock(&mbx->mbx_ring_lock);
+
+	MBX_INFO(mbx, "SW channel ring set up, %u slots of %uB", mr->mr_nr_slots,
+		 mr->mr_slot_size);
+	/* Msgs waiting for read() might go thru the ring now. */
+	chan_kick(&mbx->mbx_tx);
+	return 0;
+
+fail:
+	if (mr->mr_evt)
+		eventfd_ctx_put(mr->mr_evt);
+	vfree(mr->mr_buf);
+	kfree(mr);
+	return ret;
+}
+
+static long mailbox_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct mailbox *mbx = file->private_data;
+
+	switch (cmd) {
+	case XCL_MB_IOC_RING_SETUP:
+		return mailbox_ring_setup(mbx, (void __user *)arg);
+	case XCL_MB_IOC_SW_BATCH:
+		/* Move multiple msgs per read() and write() from now on. */
+		mbx->mbx_sw_batch = !!arg;
+		return 0;
+	case XCL_MB_IOC_RING_KICK:
+		/* Daemon has produced to RX ring and/or consumed from TX ring. */
+		chan_kick(&mbx->mbx_rx);
+		chan_kick(&mbx->mbx_tx);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int mailbox_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct mailbox *mbx = file->private_data;
+	struct mailbox_ring *mr;
+	int ret = -ENODEV;
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	mr = mbx->mbx_ring;
+	if (mr) {
+		if (vma->vm_pgoff || vma->vm_end - vma->vm_start != mr->mr_size)
+			ret = -EINVAL;
+		else
+			ret = remap_vmalloc_range(vma, mr->mr_buf, 0);
+	}
+	mutex_unlock(&mbx->mbx_ring_lock);
+	return ret;
+}
+
 /*
  * Called when the device goes from used to unused.
  */
@@ -1559,6 +4317,7 @@ static int mailbox_close(struct inode *inode, struct file *file)
 {
 	struct mailbox *mbx = file->private_data;
 
+	mailbox_ring_fini(mbx);
 	mutex_lock(&mbx->mbx_lock);
 	mbx->mbx_opened--;
 	mutex_unlock(&mbx->mbx_lock);
@@ -1567,17 +4326,20 @@ static int mailbox_close(struct inode *inode, struct file *file)
 }
 
 /*
- * Software channel TX handler. Msg goes out to peer.
+ * Software channel TX handler. Msgs go out to peer.
  *
  * We either read the entire msg out or nothing and return error. Partial read
- * is not supported.
+ * is not supported. In batch mode, as many queued msgs as fit in the buffer
+ * are read out, each taking XCL_SW_CHAN_REC_SIZE() bytes.
  */
 static ssize_t
 mailbox_read(struct file *file, char __user *buf, size_t n, loff_t *ignd)
 {
 	struct mailbox *mbx = file->private_data;
 	struct mailbox_channel *ch = &mbx->mbx_tx;
-	struct xcl_sw_chan args = { 0 };
+	struct mailbox_sw_rec *rec;
+	size_t off = 0, len;
+	ssize_t ret = 0;
 
 	if (n < sizeof(struct xcl_sw_chan)) {
 		MBX_ERR(mbx, "Software TX buf has no room for header");
@@ -1585,8 +4347,8 @@ mailbox_read(struct file *file, char __user *buf, size_t n, loff_t *ignd)
 	}
 
 	/* Wait until tx worker has something to transmit to peer. */
-	if (wait_event_interruptible(ch->sw_chan_wq,
-				     atomic_read(&ch->sw_num_pending_msg) > 0) == -ERESTARTSYS) {
+	if (wait_event_interruptible(ch->sw_chan_wq, READ_ONCE(ch->sw_chan_q_len) > 0) ==
+	    -ERESTARTSYS) {
 		MBX_ERR(mbx, "Software TX channel handler is interrupted");
 		return -ERESTARTSYS;
 	}
@@ -1595,55 +4357,63 @@ mailbox_read(struct file *file, char __user *buf, size_t n, loff_t *ignd)
 
 	mutex_lock(&ch->sw_chan_mutex);
 
-	/* Nothing to do. Someone is ahead of us and did the job? */
-	if (ch->sw_chan_msg_id == 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		MBX_ERR(mbx, "Software TX channel is empty");
-		return 0;
-	}
+	while ((rec = list_first_entry_or_null(&ch->sw_chan_q, struct mailbox_sw_rec, msr_list))) {
+		len = sizeof(struct xcl_sw_chan) + rec->msr_chan.sz;
+		if (len > n - off) {
+			if (off)
+				break;
+			/*
+			 * Buffer passed in is too small for payload, return
+			 * EMSGSIZE to ask for a bigger one. Header is copied
+			 * so that daemon knows the size.
+			 */
+			if (copy_to_user(buf, &rec->msr_chan, sizeof(struct xcl_sw_chan)) != 0) {
+				ret = -EFAULT;
+			} else {
+				/*
+				 * This error occurs when daemons try to query the size
+				 * of the msg. Show it as info to avoid flushing system console.
+				 */
+				MBX_INFO(mbx, "Software TX msg is too big");
+				ret = -EMSGSIZE;
+			}
+			break;
+		}
 
-	/* Copy header to user. */
-	args.id = ch->sw_chan_msg_id;
-	args.sz = ch->sw_chan_buf_sz;
-	args.flags = ch->sw_chan_msg_flags;
-	if (copy_to_user(buf, &args, sizeof(struct xcl_sw_chan)) != 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		return -EFAULT;
-	}
+		/* Copy header and payload to user. */
+		if (copy_to_user(buf + off, &rec->msr_chan,
+				 offsetof(struct xcl_sw_chan, data) + rec->msr_chan.sz) != 0) {
+			if (!off)
+				ret = -EFAULT;
+			break;
+		}
 
-	/*
-	 * Buffer passed in is too small for payload, return EMSGSIZE to ask
-	 * for a bigger one.
-	 */
-	if (ch->sw_chan_buf_sz > (n - sizeof(struct xcl_sw_chan))) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		/*
-		 * This error occurs when daemons try to query the size
-		 * of the msg. Show it as info to avoid flushing system console.
-		 */
-		MBX_INFO(mbx, "Software TX msg is too big");
-		return -EMSGSIZE;
-	}
+		/* Mark that job is done and we're ready for next TX msg. */
+		sw_queue_pop(ch);
+		sw_rec_free(rec);
 
-	/* Copy payload to user. */
-	if (copy_to_user(((struct xcl_sw_chan *)buf)->data,
-			 ch->sw_chan_buf, ch->sw_chan_buf_sz) != 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		return -EFAULT;
+		if (!mbx->mbx_sw_batch) {
+			off += len;
+			break;
+		}
+		off += XCL_SW_CHAN_REC_SIZE(len - sizeof(struct xcl_sw_chan));
+		if (off >= n)
+			break;
 	}
 
-	/* Mark that job is done and we're ready for next TX msg. */
-	reset_sw_ch(ch);
-
 	mutex_unlock(&ch->sw_chan_mutex);
-	return args.sz + sizeof(struct xcl_sw_chan);
+	if (off)
+		chan_kick(ch);
+	return ret ? ret : min(off, n);
 }
 
 /*
- * Software channel RX handler. Msg comes in from peer.
+ * Software channel RX handler. Msgs come in from peer.
  *
  * We either receive the entire msg or nothing and return error. Partial write
- * is not supported.
+ * is not supported. In batch mode, buffer can hold several msgs, each taking
+ * XCL_SW_CHAN_REC_SIZE() bytes. As many of them as there is room for in the
+ * queue are received and number of bytes consumed is returned.
  */
 static ssize_t
 mailbox_write(struct file *file, const char __user *buf, size_t n, loff_t *ignd)
@@ -1651,7 +4421,9 @@ mailbox_write(struct file *file, const char __user *buf, size_t n, loff_t *ignd)
 	struct mailbox *mbx = file->private_data;
 	struct mailbox_channel *ch = &mbx->mbx_rx;
 	struct xcl_sw_chan args = { 0 };
-	void *payload = NULL;
+	struct mailbox_sw_rec *rec;
+	size_t off = 0, len;
+	ssize_t ret = 0;
 
 	if (n < sizeof(struct xcl_sw_chan)) {
 		MBX_ERR(mbx, "Software RX msg has invalid header");
@@ -1659,8 +4431,7 @@ mailbox_write(struct file *file, const char __user *buf, size_t n, loff_t *ignd)
 	}
 
 	/* Wait until rx worker is ready for receiving next msg from peer. */
-	if (wait_event_interruptible(ch->sw_chan_wq,
-				     atomic_read(&ch->sw_num_pending_msg) == 0) == -ERESTARTSYS) {
+	if (wait_event_interruptible(ch->sw_chan_wq, !sw_queue_full(ch)) == -ERESTARTSYS) {
 		MBX_ERR(mbx, "Software RX channel handler is interrupted");
 		return -ERESTARTSYS;
 	}
@@ -1669,67 +4440,98 @@ mailbox_write(struct file *file, const char __user *buf, size_t n, loff_t *ignd)
 
 	mutex_lock(&ch->sw_chan_mutex);
 
-	/* No room for us. Someone is ahead of us and is using the channel? */
-	if (ch->sw_chan_msg_id != 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		MBX_ERR(mbx, "Software RX channel is busy");
-		return -EBUSY;
-	}
+	while (off < n && n - off >= sizeof(struct xcl_sw_chan)) {
+		/* No room for us. Someone is ahead of us and is using the channel? */
+		if (sw_queue_full(ch)) {
+			if (!off) {
+				MBX_ERR(mbx, "Software RX channel is busy");
+				ret = -EBUSY;
+			}
+			break;
+		}
 
-	/* Copy header from user. */
-	if (copy_from_user(&args, buf, sizeof(struct xcl_sw_chan)) != 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		return -EFAULT;
-	}
-	if (args.id == 0 || args.sz == 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		MBX_ERR(mbx, "Software RX msg has malformed header");
-		return -EINVAL;
-	}
+		/* Copy header from user. */
+		if (copy_from_user(&args, buf + off, sizeof(struct xcl_sw_chan)) != 0) {
+			ret = -EFAULT;
+			break;
+		}
+		if (args.id == 0 || args.sz == 0) {
+			MBX_ERR(mbx, "Software RX msg has malformed header");
+			ret = -EINVAL;
+			break;
+		}
 
-	/* Copy payload from user. */
-	if (n < args.sz + sizeof(struct xcl_sw_chan)) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		MBX_ERR(mbx, "Software RX msg has invalid payload");
-		return -EINVAL;
-	}
-	payload = vmalloc(args.sz);
-	if (!payload) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		return -ENOMEM;
-	}
-	if (copy_from_user(payload, ((struct xcl_sw_chan *)buf)->data, args.sz) != 0) {
-		mutex_unlock(&ch->sw_chan_mutex);
-		vfree(payload);
-		return -EFAULT;
-	}
+		/* Copy payload from user. */
+		len = sizeof(struct xcl_sw_chan) + args.sz;
+		if (args.sz > n || len > n - off) {
+			MBX_ERR(mbx, "Software RX msg has invalid payload");
+			ret = -EINVAL;
+			break;
+		}
+		rec = sw_rec_alloc(args.sz);
+		if (!rec) {
+			ret = -ENOMEM;
+			break;
+		}
+		rec->msr_chan = args;
+		if (copy_from_user(rec->msr_chan.data, ((struct xcl_sw_chan *)(buf + off))->data,
+				   args.sz) != 0) {
+			sw_rec_free(rec);
+			ret = -EFAULT;
+			break;
+		}
 
-	/* Set up received msg and notify rx worker. */
-	ch->sw_chan_buf_sz = args.sz;
-	ch->sw_chan_msg_id = args.id;
-	ch->sw_chan_msg_flags = args.flags;
-	ch->sw_chan_buf = payload;
+		/* Set up received msg and notify rx worker. */
+		sw_queue_push(ch, rec);
 
-	atomic_inc(&ch->sw_num_pending_msg);
+		if (!mbx->mbx_sw_batch) {
+			off += len;
+			break;
+		}
+		off += XCL_SW_CHAN_REC_SIZE(args.sz);
+	}
 
 	mutex_unlock(&ch->sw_chan_mutex);
 
-	return args.sz + sizeof(struct xcl_sw_chan);
+	if (!off)
+		return ret;
+
+	/* Msgs received so far are good, error is reported on next write. */
+	chan_kick(ch);
+	return min(off, n);
 }
 
 static uint mailbox_poll(struct file *file, poll_table *wait)
 {
 	struct mailbox *mbx = file->private_data;
 	struct mailbox_channel *ch = &mbx->mbx_tx;
-	int counter;
+	struct mailbox_ring *mr;
+	uint mask = 0;
+	u32 counter;
 
 	poll_wait(file, &ch->sw_chan_wq, wait);
-	counter = atomic_read(&ch->sw_num_pending_msg);
+	poll_wait(file, &mbx->mbx_rx.sw_chan_wq, wait);
+	poll_wait(file, &mbx->mbx_ring_wq, wait);
+	counter = READ_ONCE(ch->sw_chan_q_len);
 
 	MBX_DBG(mbx, "%s: %d", __func__, counter);
-	if (counter == 0)
-		return 0;
-	return POLLIN;
+	if (counter)
+		mask |= POLLIN;
+	if (!sw_queue_full(&mbx->mbx_rx))
+		mask |= POLLOUT;
+
+	mutex_lock(&mbx->mbx_ring_lock);
+	mr = mbx->mbx_ring;
+	if (mr && !mr->mr_broken) {
+		/* Only a hint, barrier is not needed. */
+		if (READ_ONCE(mr->mr_tx->consumer) != mr->mr_tx_prod)
+			mask |= POLLIN;
+		if (mr->mr_rx_cons + mr->mr_nr_slots != READ_ONCE(mr->mr_rx->producer))
+			mask |= POLLOUT;
+	}
+	mutex_unlock(&mbx->mbx_ring_lock);
+
+	return mask;
 }
 
 static void mailbox_remove(struct xrt_device *xdev)
@@ -1738,9 +4540,20 @@ static void mailbox_remove(struct xrt_device *xdev)
 
 	/* Stop accessing from sysfs node. */
 	sysfs_remove_group(&xdev->dev.kobj, &mailbox_attrgroup);
+	debugfs_remove_recursive(mbx->mbx_debugfs);
+
+	/* No more msgs from or to loopback peer. */
+	mutex_lock(&mailbox_list_lock);
+	mailbox_lb_pair(mbx, NULL);
+	list_del_init(&mbx->mbx_node);
+	mutex_unlock(&mailbox_list_lock);
+
 	mailbox_stop(mbx);
 	if (mbx->mbx_regs)
 		iounmap(mbx->mbx_regs);
+	mailbox_ring_fini(mbx);
+	mempool_destroy(mbx->mbx_buf_pool);
+	mempool_destroy(mbx->mbx_msg_pool);
 	MBX_INFO(mbx, "mailbox cleaned up successfully");
 	xrt_set_drvdata(xdev, NULL);
 }
@@ -1756,12 +4569,35 @@ static int mailbox_probe(struct xrt_device *xdev)
 		return -ENOMEM;
 
 	mbx->mbx_xdev = xdev;
+	mbx->mbx_irq = -ENODEV;
+	mbx->mbx_fifo_depth = PACKET_SIZE;
+	mbx->mbx_tx.sw_chan_q_depth = MBX_SW_QUEUE_DEPTH;
+	mbx->mbx_rx.sw_chan_q_depth = MBX_SW_QUEUE_DEPTH;
 	xrt_set_drvdata(xdev, mbx);
 
 	init_completion(&mbx->mbx_comp);
 	mutex_init(&mbx->mbx_lock);
-	mutex_init(&mbx->mbx_listen_cb_lock);
+	init_rwsem(&mbx->mbx_listen_cb_lock);
+	init_waitqueue_head(&mbx->mbx_req_wait);
 	INIT_LIST_HEAD(&mbx->mbx_req_list);
+	mutex_init(&mbx->mbx_ring_lock);
+	init_waitqueue_head(&mbx->mbx_ring_wq);
+	spin_lock_init(&mbx->mbx_stats.ms_lock);
+	INIT_LIST_HEAD(&mbx->mbx_node);
+	mutex_init(&mbx->mbx_bench_lock);
+	INIT_DELAYED_WORK(&mbx->mbx_hb_work, mailbox_hb_work);
+
+	if (!mailbox_msg_cache) {
+		ret = -ENOMEM;
+		goto failed;
+	}
+	mbx->mbx_msg_pool = mempool_create_slab_pool(MBX_MSG_POOL_MIN, mailbox_msg_cache);
+	mbx->mbx_buf_pool = mempool_create_kmalloc_pool(MBX_MSG_POOL_MIN, MBX_MSG_INLINE_MAX);
+	if (!mbx->mbx_msg_pool || !mbx->mbx_buf_pool) {
+		MBX_ERR(mbx, "failed to create msg pool");
+		ret = -ENOMEM;
+		goto failed;
+	}
 
 	res = xrt_get_resource(xdev, IORESOURCE_MEM, 0);
 	if (res) {
@@ -1784,6 +4620,12 @@ static int mailbox_probe(struct xrt_device *xdev)
 		goto failed;
 	}
 
+	mailbox_debugfs_init(mbx);
+
+	mutex_lock(&mailbox_list_lock);
+	list_add_tail(&mbx->mbx_node, &mailbox_list);
+	mutex_unlock(&mailbox_list_lock);
+
 	MBX_INFO(mbx, "successfully initialized");
 	return 0;
 
@@ -1817,6 +4659,8 @@ static struct xrt_driver xrt_mailbox_driver = {
 			.read = mailbox_read,
 			.write = mailbox_write,
 			.poll = mailbox_poll,
+			.unlocked_ioctl = mailbox_ioctl,
+			.mmap = mailbox_mmap,
 		},
 		.xsf_dev_name = "mailbox",
 	},
@@ -1827,4 +4671,18 @@ static struct xrt_driver xrt_mailbox_driver = {
 	.leaf_call = mailbox_leaf_call,
 };
 
-XRT_LEAF_INIT_FINI_FUNC(mailbox);
+void mailbox_leaf_init_fini(bool init)
+{
+	if (init) {
+		/* Failure is reported by probe. */
+		mailbox_msg_cache = KMEM_CACHE(mailbox_msg, SLAB_HWCACHE_ALIGN);
+		mailbox_debugfs_root = debugfs_create_dir("xrt_mailbox", NULL);
+		xrt_register_driver(&xrt_mailbox_driver);
+	} else {
+		xrt_unregister_driver(&xrt_mailbox_driver);
+		debugfs_remove_recursive(mailbox_debugfs_root);
+		mailbox_debugfs_root = NULL;
+		kmem_cache_destroy(mailbox_msg_cache);
+		mailbox_msg_cache = NULL;
+	}
+}
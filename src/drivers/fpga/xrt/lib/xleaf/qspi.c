@@ -11,6 +11,13 @@
 #include <linux/delay.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/file.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/xarray.h>
+#include <linux/sched/task.h>
+#include <linux/xrt/flash-ioctl.h>
 #include "metadata.h"
 #include "xleaf.h"
 #include "xleaf/flash.h"
@@ -137,6 +144,21 @@ static inline size_t QSPI_PAGE_ROUNDUP(loff_t offset)
 	return offset + QSPI_PAGE_SIZE;
 }
 
+/* Flash programs at most one such page per cmd, it is the unit we skip. */
+#define QSPI_PROG_PAGE_SIZE	256UL
+
+/* Upper limit of read cache, pages beyond it are read from flash each time. */
+#define QSPI_CACHE_MAX_PAGES	((32UL * 1024 * 1024) >> PAGE_SHIFT)
+
+/* Read cmd is op code followed by 24 bit address. */
+#define QSPI_READ_HEADER_LEN	4
+/* Dummy bytes in FIFO after address for quad output read. */
+#define QSPI_QUAD_READ_DUMMY_LEN	4
+/* Range of 24 bit address, the rest is in extended address register. */
+#define QSPI_SECTOR_SIZE	(16UL * 1024 * 1024)
+/* Max time to keep CPU during flash IO. */
+#define QSPI_YIELD_INTERVAL_MS	10
+
 /*
  * Wait for condition to be true for at most 1 second.
  * Return true, if time'd out, false otherwise.
@@ -206,9 +228,14 @@ static struct qspi_flash_vendor {
 	const char *vendor_name;
 	size_t (*code2sectors)(u8 code);
 	u8 (*write_cmd)(void);
+	/*
+	 * Dummy bytes in FIFO after address for quad IO read with default
+	 * dummy clock cycles, two cycles per byte. First one is mode byte.
+	 */
+	size_t quad_io_dummy_len;
 } vendors[] = {
-	{ 0x20, "micron", micron_code2sectors, micron_write_cmd },
-	{ 0xc2, "macronix", macronix_code2sectors, macronix_write_cmd },
+	{ 0x20, "micron", micron_code2sectors, micron_write_cmd, 5 },
+	{ 0xc2, "macronix", macronix_code2sectors, macronix_write_cmd, 3 },
 };
 
 struct qspi_flash_addr {
@@ -243,9 +270,82 @@ struct xrt_qspi {
 	u8 *io_buf;
 	struct qspi_reg *qspi_regs;
 	size_t qspi_fifo_depth;
-	u8 qspi_curr_sector;
+	/* Each flash has its own extended address register. */
+	u8 qspi_curr_sector[MAX_NUM_OF_SLAVES];
 	struct qspi_flash_vendor *vendor;
+	/* Read cmd in use and its dummy bytes in FIFO after address. */
+	u8 read_cmd;
+	size_t read_dummy_len;
+	/* Flash read throughput, protected by io_lock. */
+	u64 read_bytes;
+	u64 read_ns;
+	unsigned long yield_at;	/* in jiffies, protected by io_lock */
 	int qspi_curr_slave;
+	int qspi_num_slaves;
+	/* Flash is erasing or programming, wait for it before next cmd. */
+	bool qspi_busy[MAX_NUM_OF_SLAVES];
+	/* Only erase and program blocks which are changed by write. */
+	bool diff_write;
+	/* Erase blocks handled by last write, protected by io_lock. */
+	u32 blk_skipped;
+	u32 blk_programmed;
+	u32 blk_erased;
+	u64 bytes_erased;
+	u64 bytes_programmed;
+
+	/*
+	 * Read cache of flash pages, indexed by offset >> PAGE_SHIFT. Pages are
+	 * added and removed with io_lock held, looked up without it.
+	 */
+	struct xarray cache;
+	unsigned long cache_pages;
+	u64 cache_hits;		/* protected by cache xa_lock */
+	u64 cache_misses;	/* protected by cache xa_lock */
+	/* Of device node while it is mmap'ed, protected by io_lock. */
+	struct address_space *mapping;
+
+	/* Background update job, last one is kept for its status. */
+	struct mutex job_lock;	/* protects job and writing */
+	struct qspi_job *job;
+	bool writing;		/* write() is going on */
+	u32 job_next_id;
+	wait_queue_head_t job_wq;
+};
+
+/* Per-open state of device node. */
+struct qspi_client {
+	struct xrt_qspi *flash;
+	/* Job progress seen by last status ioctl on this open. */
+	u32 seen_job;
+	u64 seen_seq;
+};
+
+/* Background flash update, see XRT_FLASH_IOC_UPDATE. */
+struct qspi_job {
+	struct xrt_qspi *flash;
+	u32 id;
+	struct task_struct *thread;
+	bool cancel;
+	/* Image comes from either a file or a copy of user buffer. */
+	struct file *file;
+	loff_t src_off;
+	u8 *image;
+	loff_t flash_off;
+	/* Image is split in two, one for each flash. */
+	bool dual;
+
+	/* Updated by job thread only. */
+	spinlock_t lock;	/* protects fields below */
+	u32 state;		/* XRT_FLASH_JOB_* */
+	int error;
+	u64 seq;		/* bumped on every progress */
+	u64 total;
+	u64 done;
+	u64 erased;
+	u64 programmed;
+	u64 verified;
+	u64 start_ns;
+	u64 end_ns;
 };
 
 static inline const char *reg2name(struct xrt_qspi *flash, u32 *reg)
@@ -338,6 +438,23 @@ static inline bool qspi_has_err(struct xrt_qspi *flash)
 	return true;
 }
 
+/* Bytes in RX fifo. Occupancy register holds the count minus one. */
+static inline size_t qspi_rx_count(struct xrt_qspi *flash)
+{
+	if (qspi_get_status(flash) & QSPI_SR_RX_EMPTY)
+		return 0;
+	return qspi_reg_rd(flash, &flash->qspi_regs->qspi_rx_fifo) + 1;
+}
+
+/* Called under io_lock during long flash IO to give up CPU once in a while. */
+static inline void qspi_yield(struct xrt_qspi *flash)
+{
+	if (time_before(jiffies, flash->yield_at))
+		return;
+	cond_resched();
+	flash->yield_at = jiffies + msecs_to_jiffies(QSPI_YIELD_INTERVAL_MS);
+}
+
 /*
  * Caller should make sure the flash controller has exactly
  * len bytes in the fifo. It's an error if we pull out less.
@@ -430,18 +547,31 @@ static int qspi_reset_fifo(struct xrt_qspi *flash)
 	return 0;
 }
 
+static bool qspi_wait_until_ready(struct xrt_qspi *flash);
+
 static int qspi_transaction(struct xrt_qspi *flash, u8 *buf, size_t len, bool need_output)
 {
 	int ret = 0;
 
+	/* The slave index should be within range. */
+	if (flash->qspi_curr_slave >= MAX_NUM_OF_SLAVES)
+		return -EINVAL;
+
+	/*
+	 * Erase and program cmds do not wait for flash to finish, so that
+	 * the other flash can be fed meanwhile. Wait for it now.
+	 */
+	if (flash->qspi_busy[flash->qspi_curr_slave]) {
+		flash->qspi_busy[flash->qspi_curr_slave] = false;
+		if (!qspi_wait_until_ready(flash))
+			return -ETIMEDOUT;
+	}
+
 	/* Reset both the TX and RX fifo before starting transaction. */
 	ret = qspi_reset_fifo(flash);
 	if (ret)
 		return ret;
 
-	/* The slave index should be within range. */
-	if (flash->qspi_curr_slave >= MAX_NUM_OF_SLAVES)
-		return -EINVAL;
 	qspi_activate_slave(flash, flash->qspi_curr_slave);
 
 	ret = qspi_tx(flash, buf, len);
@@ -536,7 +666,7 @@ static int qspi_set_sector(struct xrt_qspi *flash, u8 sector)
 	int ret = 0;
 	u8 cmd[] = { QSPI_CMD_EXTENDED_ADDRESS_REG_WRITE, sector };
 
-	if (sector == flash->qspi_curr_sector)
+	if (sector == flash->qspi_curr_sector[flash->qspi_curr_slave])
 		return 0;
 
 	QSPI_DBG(flash, "setting sector to %d", sector);
@@ -551,7 +681,7 @@ static int qspi_set_sector(struct xrt_qspi *flash, u8 sector)
 		return ret;
 	}
 
-	flash->qspi_curr_sector = sector;
+	flash->qspi_curr_sector[flash->qspi_curr_slave] = sector;
 	return ret;
 }
 
@@ -608,60 +738,206 @@ static bool qspi_wait_until_ready(struct xrt_qspi *flash)
 	return true;
 }
 
+/* Wait for erase or program cmds still going on in all flashes to finish. */
+static int qspi_wait_all_ready(struct xrt_qspi *flash)
+{
+	int slave = flash->qspi_curr_slave;
+	int i, ret = 0;
+
+	for (i = 0; i < MAX_NUM_OF_SLAVES; i++) {
+		if (!flash->qspi_busy[i])
+			continue;
+		flash->qspi_curr_slave = i;
+		flash->qspi_busy[i] = false;
+		if (!qspi_wait_until_ready(flash))
+			ret = -EINVAL;
+	}
+	flash->qspi_curr_slave = slave;
+	return ret;
+}
+
 /*
- * Do one FIFO read from flash.
- * @cnt contains bytes actually read on successful return.
+ * Drop cached pages and user mappings of flash range about to be changed.
+ * Range is on current flash, whatever slave in off says.
  */
-static int qspi_fifo_rd(struct xrt_qspi *flash, loff_t off, u8 *buf, size_t *cnt)
+static void qspi_cache_inval(struct xrt_qspi *flash, loff_t off, size_t len)
 {
-	/* For read cmd, we need to exclude a few more dummy bytes in FIFO. */
-	const size_t read_dummy_len = 4;
-
-	int ret;
 	struct qspi_flash_addr faddr;
-	size_t header_len, total_len, payload_len;
+	unsigned long idx, last;
+	struct page *page;
 
-	/* Should not cross page bundary. */
-	WARN_ON(off + *cnt > QSPI_PAGE_ROUNDUP(off));
 	qspi_offset2faddr(off, &faddr);
+	faddr.slave = flash->qspi_curr_slave;
+	off = qspi_faddr2offset(&faddr);
+
+	last = (off + len - 1) >> PAGE_SHIFT;
+	for (idx = off >> PAGE_SHIFT; idx <= last; idx++) {
+		page = xa_erase(&flash->cache, idx);
+		if (page) {
+			put_page(page);
+			flash->cache_pages--;
+		}
+	}
+	if (flash->mapping)
+		unmap_mapping_range(flash->mapping, off, len, 1);
+}
 
-	ret = qspi_setup_io_cmd_header(flash, QSPI_CMD_QUAD_READ, &faddr, &header_len);
-	if (ret)
-		return ret;
+/*
+ * Load TX fifo with read cmd for len bytes at faddr. Transfer is inhibited and
+ * no slave is selected, RX fifo may still hold data of last read.
+ */
+static void qspi_rd_load(struct xrt_qspi *flash, struct qspi_flash_addr *faddr, size_t len)
+{
+	u32 *tx = &flash->qspi_regs->qspi_tx;
+	size_t i;
+
+	/* Bypass qspi_send8(), logging each byte costs more than sending it. */
+	iowrite32(flash->read_cmd, tx);
+	iowrite32(faddr->addr_hi, tx);
+	iowrite32(faddr->addr_mid, tx);
+	iowrite32(faddr->addr_lo, tx);
+	/* All ones in mode byte keeps flash out of continuous read mode. */
+	for (i = 0; i < flash->read_dummy_len + len; i++)
+		iowrite32(0xff, tx);
+}
 
-	/* Figure out length of IO for this read. */
+/* Start the read loaded in TX fifo, it runs while CPU does something else. */
+static void qspi_rd_kick(struct xrt_qspi *flash, u32 ctrl)
+{
+	qspi_activate_slave(flash, flash->qspi_curr_slave);
+	qspi_set_ctrl(flash, ctrl & ~QSPI_CR_TRANS_INHIBIT);
+}
 
-	/*
-	 * One read should not be more than one fifo depth, so that we don't
-	 * overrun flash->io_buf.
-	 * The first header_len + read_dummy_len bytes in output buffer are
-	 * always garbage, need to make room for them. What a wonderful memory
-	 * controller!!
-	 */
-	payload_len = min(*cnt, flash->qspi_fifo_depth - header_len - read_dummy_len);
-	total_len = payload_len + header_len + read_dummy_len;
+/*
+ * Wait for the running read to finish, RX fifo holds exactly total_len bytes
+ * of its output afterwards. Transfer is inhibited again on return.
+ */
+static int qspi_rd_wait(struct xrt_qspi *flash, u32 ctrl, size_t total_len)
+{
+	size_t cnt;
+
+	/* TX fifo is empty before last byte is shifted out, wait on RX fifo instead. */
+	if (QSPI_BUSY_WAIT(qspi_rx_count(flash) >= total_len ||
+			   (qspi_get_status(flash) & QSPI_SR_ERRS))) {
+		QSPI_ERR(flash, "QSPI read timeout, status: 0x%x", qspi_get_status(flash));
+		qspi_set_ctrl(flash, ctrl);
+		qspi_activate_slave(flash, SLAVE_NONE);
+		return -ETIMEDOUT;
+	}
 
-	QSPI_DBG(flash, "reading %zu bytes @0x%llx", payload_len, off);
+	qspi_set_ctrl(flash, ctrl);
+	qspi_activate_slave(flash, SLAVE_NONE);
+
+	if (qspi_has_err(flash))
+		return -EINVAL;
+	cnt = qspi_rx_count(flash);
+	if (cnt != total_len) {
+		QSPI_ERR(flash, "RX fifo has %zu bytes, expecting %zu", cnt, total_len);
+		return -EINVAL;
+	}
+	return 0;
+}
 
-	/* Now do the read. */
+/*
+ * Pull output of a finished read from RX fifo. Output of the next read may be
+ * coming in behind it.
+ */
+static void qspi_rd_drain(struct xrt_qspi *flash, u8 *buf, size_t len)
+{
+	u32 *rx = &flash->qspi_regs->qspi_rx;
+	size_t i;
 
-	/*
-	 * You tell the memory controller how many bytes you want to read
-	 * by writing that many bytes to it. How hard would it be to just
-	 * add one more integer to specify the length in the input cmd?!
-	 */
-	ret = qspi_exec_io_cmd(flash, total_len, true);
+	/* Cmd, address and dummy bytes come out first, they are garbage. */
+	for (i = 0; i < QSPI_READ_HEADER_LEN + flash->read_dummy_len; i++)
+		ioread32(rx);
+	for (i = 0; i < len; i++)
+		buf[i] = (u8)ioread32(rx);
+}
+
+/*
+ * Read from flash with back to back FIFO reads, up to end of the sector.
+ * Each read takes at most half of the fifo, so that the next one can be
+ * started before output of the current one is pulled from RX fifo. Draining
+ * one read then overlaps with the next one running on the wire.
+ * @cnt contains bytes actually read on successful return.
+ */
+static int qspi_burst_rd(struct xrt_qspi *flash, loff_t off, u8 *buf, size_t *cnt)
+{
+	const size_t hdr_len = QSPI_READ_HEADER_LEN + flash->read_dummy_len;
+	int slave = flash->qspi_curr_slave;
+	struct qspi_flash_addr faddr;
+	size_t n, len, cur, next;
+	size_t max_len;
+	u64 start;
+	u32 ctrl;
+	int ret;
+
+	if (flash->qspi_fifo_depth / 2 <= hdr_len) {
+		QSPI_ERR(flash, "%zuB fifo is too small for reads", flash->qspi_fifo_depth);
+		return -EINVAL;
+	}
+	max_len = flash->qspi_fifo_depth / 2 - hdr_len;
+
+	qspi_offset2faddr(off, &faddr);
+	ret = qspi_set_sector(flash, faddr.sector);
+	if (ret)
+		return ret;
+	if (flash->qspi_busy[slave]) {
+		flash->qspi_busy[slave] = false;
+		if (!qspi_wait_until_ready(flash))
+			return -ETIMEDOUT;
+	}
+	ret = qspi_reset_fifo(flash);
 	if (ret)
 		return ret;
 
-	/* Copy out the output. Skip the garbage part. */
-	memcpy(buf, &flash->io_buf[header_len + read_dummy_len], payload_len);
-	*cnt = payload_len;
+	/* Reads are within the sector, 24 bit address wraps around at its end. */
+	len = min(*cnt, QSPI_SECTOR_SIZE - (size_t)(off & (QSPI_SECTOR_SIZE - 1)));
+	QSPI_DBG(flash, "reading %zu bytes @0x%llx", len, off);
+
+	start = ktime_get_ns();
+	ctrl = qspi_get_ctrl(flash) | QSPI_CR_TRANS_INHIBIT;
+	qspi_set_ctrl(flash, ctrl);
+
+	cur = min(len, max_len);
+	qspi_rd_load(flash, &faddr, cur);
+	qspi_rd_kick(flash, ctrl);
+	ret = qspi_rd_wait(flash, ctrl, hdr_len + cur);
+	if (ret)
+		return ret;
+	for (n = 0; n < len; n += cur, cur = next) {
+		/* TX fifo is empty now, start next read before draining this one. */
+		next = min(len - n - cur, max_len);
+		if (next) {
+			qspi_offset2faddr(off + n + cur, &faddr);
+			qspi_rd_load(flash, &faddr, next);
+			qspi_rd_kick(flash, ctrl);
+		}
+
+		qspi_rd_drain(flash, &buf[n], cur);
+
+		if (next) {
+			ret = qspi_rd_wait(flash, ctrl, hdr_len + next);
+			if (ret)
+				return ret;
+		}
+		qspi_yield(flash);
+	}
+
+	if ((qspi_get_status(flash) & QSPI_SR_RX_EMPTY) == 0) {
+		QSPI_ERR(flash, "failed to drain RX fifo");
+		return -EINVAL;
+	}
+
+	flash->read_bytes += len;
+	flash->read_ns += ktime_get_ns() - start;
+	*cnt = len;
 	return 0;
 }
 
 /*
- * Do one FIFO write to flash. Assuming erase is already done.
+ * Do one FIFO write to flash. Assuming erase is already done. Flash is still
+ * programming on return, next cmd to it will wait.
  * @cnt contains bytes actually written on successful return.
  */
 static int qspi_fifo_wr(struct xrt_qspi *flash, loff_t off, u8 *buf, size_t *cnt)
@@ -697,6 +973,7 @@ static int qspi_fifo_wr(struct xrt_qspi *flash, loff_t off, u8 *buf, size_t *cnt
 
 	/* Copy in payload after header. */
 	memcpy(&flash->io_buf[header_len], buf, payload_len);
+	qspi_cache_inval(flash, off, payload_len);
 
 	/* Now do the write. */
 
@@ -706,8 +983,7 @@ static int qspi_fifo_wr(struct xrt_qspi *flash, loff_t off, u8 *buf, size_t *cnt
 	ret = qspi_exec_io_cmd(flash, total_len, false);
 	if (ret)
 		return ret;
-	if (!qspi_wait_until_ready(flash))
-		return -EINVAL;
+	flash->qspi_busy[flash->qspi_curr_slave] = true;
 
 	*cnt = payload_len;
 	return 0;
@@ -726,14 +1002,10 @@ static int qspi_buf_rdwr(struct xrt_qspi *flash, u8 *buf, loff_t off, size_t len
 		if (write)
 			ret = qspi_fifo_wr(flash, off + n, &buf[n], &curlen);
 		else
-			ret = qspi_fifo_rd(flash, off + n, &buf[n], &curlen);
+			ret = qspi_burst_rd(flash, off + n, &buf[n], &curlen);
+		/* Don't let Linux complain about CPU soft lockup. */
+		qspi_yield(flash);
 	}
-
-	/*
-	 * Yield CPU after every buf IO so that Linux does not complain
-	 * about CPU soft lockup.
-	 */
-	schedule();
 	return ret;
 }
 
@@ -761,7 +1033,8 @@ static u8 qspi_erase_cmd(size_t pagesz)
 }
 
 /*
- * Erase one flash page.
+ * Erase one flash page. Flash is still erasing on return, next cmd to it will
+ * wait.
  */
 static int qspi_page_erase(struct xrt_qspi *flash, loff_t off, size_t pagesz)
 {
@@ -780,6 +1053,7 @@ static int qspi_page_erase(struct xrt_qspi *flash, loff_t off, size_t pagesz)
 	ret = qspi_setup_io_cmd_header(flash, cmd, &faddr, &cmdlen);
 	if (ret)
 		return ret;
+	qspi_cache_inval(flash, off, pagesz);
 
 	ret = qspi_enable_write(flash);
 	if (ret)
@@ -790,9 +1064,7 @@ static int qspi_page_erase(struct xrt_qspi *flash, loff_t off, size_t pagesz)
 		QSPI_ERR(flash, "Failed to erase 0x%lx bytes @0x%llx", pagesz, off);
 		return ret;
 	}
-
-	if (!qspi_wait_until_ready(flash))
-		return -EINVAL;
+	flash->qspi_busy[flash->qspi_curr_slave] = true;
 
 	return 0;
 }
@@ -810,52 +1082,123 @@ static bool is_valid_offset(struct xrt_qspi *flash, loff_t off)
 	return qspi_faddr2offset(&faddr) < flash->flash_size;
 }
 
-static int
-qspi_do_read(struct xrt_qspi *flash, char *kbuf, size_t n, loff_t off)
+/* Read flash content into buf. */
+static inline int qspi_blk_read(struct xrt_qspi *flash, u8 *buf, loff_t off, size_t len)
+{
+	return qspi_buf_rdwr(flash, buf, off, len, false);
+}
+
+/* Look up cached flash page at off and take a reference on it. */
+static struct page *qspi_cache_lookup(struct xrt_qspi *flash, loff_t off)
+{
+	struct page *page;
+
+	xa_lock(&flash->cache);
+	page = xa_load(&flash->cache, off >> PAGE_SHIFT);
+	if (page) {
+		get_page(page);
+		flash->cache_hits++;
+	} else {
+		flash->cache_misses++;
+	}
+	xa_unlock(&flash->cache);
+	return page;
+}
+
+/*
+ * Read flash page at off in and add it to cache, if there is room. io_lock is
+ * held, so that page can't be changed before it is in cache. Page returned has
+ * a reference for caller.
+ */
+static struct page *qspi_cache_fill(struct xrt_qspi *flash, loff_t off)
 {
-	u8 *page = NULL;
-	size_t cnt = 0;
+	unsigned long idx = off >> PAGE_SHIFT;
 	struct qspi_flash_addr faddr;
-	int ret = 0;
+	struct page *page;
+	int ret;
 
-	page = vmalloc(QSPI_PAGE_SIZE);
-	if (!page)
-		return -ENOMEM;
+	WARN_ON(!mutex_is_locked(&flash->io_lock));
 
-	mutex_lock(&flash->io_lock);
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return ERR_PTR(-ENOMEM);
 
 	qspi_offset2faddr(off, &faddr);
 	flash->qspi_curr_slave = faddr.slave;
+	ret = qspi_blk_read(flash, page_address(page), off & PAGE_MASK, PAGE_SIZE);
+	if (ret) {
+		put_page(page);
+		return ERR_PTR(ret);
+	}
+	/* Page may have been read in by someone else, keep that one. */
+	if (flash->cache_pages < QSPI_CACHE_MAX_PAGES &&
+	    xa_insert(&flash->cache, idx, page, GFP_KERNEL) == 0) {
+		get_page(page);
+		flash->cache_pages++;
+	}
+	return page;
+}
 
-	if (!qspi_wait_until_ready(flash))
-		ret = -EINVAL;
+/* Get flash page at off with a reference, reading it in on cache miss. */
+static struct page *qspi_cache_get(struct xrt_qspi *flash, loff_t off)
+{
+	struct page *page;
 
-	while (ret == 0 && cnt < n) {
-		loff_t thisoff = off + cnt;
-		size_t thislen = min(n - cnt, QSPI_PAGE_ROUNDUP(thisoff) - (size_t)thisoff);
-		char *thisbuf = &page[QSPI_PAGE_OFFSET(thisoff)];
+	page = qspi_cache_lookup(flash, off);
+	if (page)
+		return page;
 
-		ret = qspi_buf_rdwr(flash, thisbuf, thisoff, thislen, false);
-		if (ret)
-			break;
+	mutex_lock(&flash->io_lock);
+	page = qspi_cache_fill(flash, off);
+	mutex_unlock(&flash->io_lock);
+	return page;
+}
 
-		memcpy(&kbuf[cnt], thisbuf, thislen);
-		cnt += thislen;
-	}
+/* Copy flash content thru read cache to kernel buf, or user buf if kbuf is NULL. */
+static int qspi_cache_read(struct xrt_qspi *flash, char *kbuf, char __user *ubuf,
+			   size_t n, loff_t off)
+{
+	size_t cnt, pgoff, len;
+	struct page *page;
+	int ret = 0;
 
-	mutex_unlock(&flash->io_lock);
-	vfree(page);
+	for (cnt = 0; ret == 0 && cnt < n; cnt += len) {
+		pgoff = offset_in_page(off + cnt);
+		len = min(n - cnt, PAGE_SIZE - pgoff);
+		page = qspi_cache_get(flash, off + cnt);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+
+		if (kbuf)
+			memcpy(kbuf + cnt, page_address(page) + pgoff, len);
+		else if (copy_to_user(ubuf + cnt, page_address(page) + pgoff, len) != 0)
+			ret = -EFAULT;
+		put_page(page);
+	}
 	return ret;
 }
 
+/* Caller should hold io_lock, if flash is still in use. */
+static void qspi_cache_drop(struct xrt_qspi *flash)
+{
+	unsigned long idx;
+	struct page *page;
+
+	xa_for_each(&flash->cache, idx, page) {
+		xa_erase(&flash->cache, idx);
+		put_page(page);
+	}
+	flash->cache_pages = 0;
+}
+
 /*
  * Read flash memory page by page into user buf.
  */
 static ssize_t
 qspi_read(struct file *file, char __user *ubuf, size_t n, loff_t *off)
 {
-	struct xrt_qspi *flash = file->private_data;
-	char *kbuf = NULL;
+	struct qspi_client *client = file->private_data;
+	struct xrt_qspi *flash = client->flash;
 	int ret = 0;
 
 	QSPI_INFO(flash, "reading %zu bytes @0x%llx", n, *off);
@@ -865,17 +1208,8 @@ qspi_read(struct file *file, char __user *ubuf, size_t n, loff_t *off)
 		return 0;
 	}
 	n = min(n, flash->flash_size - (size_t)*off);
-	kbuf = vmalloc(n);
-	if (!kbuf)
-		return -ENOMEM;
-
-	ret = qspi_do_read(flash, kbuf, n, *off);
-	if (ret == 0) {
-		if (copy_to_user(ubuf, kbuf, n) != 0)
-			ret = -EFAULT;
-	}
-	vfree(kbuf);
 
+	ret = qspi_cache_read(flash, NULL, ubuf, n, *off);
 	if (ret)
 		return ret;
 
@@ -889,45 +1223,192 @@ static int qspi_kernel_read(struct xrt_device *xdev, char *buf, size_t n, loff_t
 	struct xrt_qspi *flash = xrt_get_drvdata(xdev);
 
 	QSPI_INFO(flash, "kernel reading %zu bytes @0x%llx", n, off);
-	return qspi_do_read(flash, buf, n, off);
+	return qspi_cache_read(flash, buf, NULL, n, off);
+}
+
+/*
+ * PTE is installed with io_lock held, so that flash can't be changed between
+ * reading the page and mapping it. Otherwise, zapping of the range by a writer
+ * could come before the PTE and miss it.
+ */
+static vm_fault_t qspi_vm_fault(struct vm_fault *vmf)
+{
+	struct xrt_qspi *flash = vmf->vma->vm_private_data;
+	loff_t off = (loff_t)vmf->pgoff << PAGE_SHIFT;
+	struct page *page;
+	vm_fault_t ret;
+
+	if (!is_valid_offset(flash, off))
+		return VM_FAULT_SIGBUS;
+
+	mutex_lock(&flash->io_lock);
+	page = qspi_cache_lookup(flash, off);
+	if (!page)
+		page = qspi_cache_fill(flash, off);
+	if (IS_ERR(page)) {
+		mutex_unlock(&flash->io_lock);
+		return PTR_ERR(page) == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+	}
+	/* Mapping takes its own reference. */
+	ret = vmf_insert_page(vmf->vma, vmf->address, page);
+	mutex_unlock(&flash->io_lock);
+
+	put_page(page);
+	return ret;
+}
+
+static const struct vm_operations_struct qspi_vm_ops = {
+	.fault = qspi_vm_fault,
+};
+
+/*
+ * Map flash content read only. Mapping is backed by read cache and is zapped
+ * when flash is changed under it, so it always shows what is on flash.
+ */
+static int qspi_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct qspi_client *client = file->private_data;
+	struct xrt_qspi *flash = client->flash;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	/* Cached pages are inserted by fault handler, see qspi_vm_fault(). */
+	vma->vm_flags |= VM_MIXEDMAP;
+	vma->vm_ops = &qspi_vm_ops;
+	vma->vm_private_data = flash;
+
+	mutex_lock(&flash->io_lock);
+	flash->mapping = file->f_mapping;
+	mutex_unlock(&flash->io_lock);
+	return 0;
+}
+
+/* What it takes to turn current content of an erase block into new data. */
+enum qspi_blk_action {
+	QSPI_BLK_SKIP,		/* identical */
+	QSPI_BLK_PROGRAM,	/* only 1->0 bit transitions, no erase needed */
+	QSPI_BLK_ERASE,		/* needs erase and program */
+};
+
+static enum qspi_blk_action qspi_blk_diff(const u8 *old, const u8 *new, size_t len)
+{
+	enum qspi_blk_action act = QSPI_BLK_SKIP;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (new[i] & ~old[i])
+			return QSPI_BLK_ERASE;
+		if (new[i] != old[i])
+			act = QSPI_BLK_PROGRAM;
+	}
+	return act;
+}
+
+/*
+ * Check if program page already holds the data. @old is current flash
+ * content, or NULL if it has just been erased.
+ */
+static inline bool qspi_prog_page_same(const u8 *buf, const u8 *old, size_t cnt)
+{
+	if (old)
+		return !memcmp(buf, old, cnt);
+	return !memchr_inv(buf, 0xff, cnt);
+}
+
+/* Program buf to flash, skipping program pages which already hold the data. */
+static int qspi_buf_program(struct xrt_qspi *flash, u8 *buf, const u8 *old,
+			    loff_t off, size_t len)
+{
+	size_t n, cnt;
+	int ret = 0;
+
+	for (n = 0; ret == 0 && n < len; n += cnt) {
+		cnt = min(QSPI_PROG_PAGE_SIZE, len - n);
+		if (!qspi_prog_page_same(&buf[n], old ? &old[n] : NULL, cnt))
+			ret = qspi_buf_rdwr(flash, &buf[n], off + n, cnt, true);
+	}
+	return ret;
+}
+
+static void qspi_blk_count(struct xrt_qspi *flash, enum qspi_blk_action act, size_t len)
+{
+	if (act == QSPI_BLK_SKIP) {
+		flash->blk_skipped++;
+		return;
+	}
+	flash->bytes_programmed += len;
+	if (act == QSPI_BLK_PROGRAM) {
+		flash->blk_programmed++;
+		return;
+	}
+	flash->blk_erased++;
+	flash->bytes_erased += len;
+}
+
+/*
+ * Write one erase block. @old holds its current content for differential
+ * write, so that it can be skipped or programmed without erase. Otherwise,
+ * @old is NULL and the block is always erased and programmed.
+ */
+static int qspi_blk_update(struct xrt_qspi *flash, u8 *buf, const u8 *old,
+			   loff_t off, size_t len)
+{
+	enum qspi_blk_action act = old ? qspi_blk_diff(old, buf, len) : QSPI_BLK_ERASE;
+	int ret;
+
+	qspi_blk_count(flash, act, len);
+	if (act == QSPI_BLK_SKIP)
+		return 0;
+	if (act == QSPI_BLK_PROGRAM)
+		return qspi_buf_program(flash, buf, old, off, len);
+
+	ret = qspi_page_erase(flash, off, len);
+	if (ret)
+		return ret;
+	if (old)
+		return qspi_buf_program(flash, buf, NULL, off, len);
+	return qspi_buf_rdwr(flash, buf, off, len, true);
 }
 
 /*
  * Write a page. Perform read-modify-write as needed.
- * @cnt contains actual bytes copied from user on successful return.
+ * @cnt contains actual bytes taken from src on successful return.
  */
-static int qspi_page_rmw(struct xrt_qspi *flash,
-			 const char __user *ubuf, u8 *kbuf, loff_t off, size_t *cnt)
+static int qspi_page_rmw(struct xrt_qspi *flash, const u8 *src,
+			 u8 *kbuf, u8 *old, loff_t off, size_t *cnt)
 {
 	loff_t thisoff = QSPI_PAGE_ALIGN(off);
 	size_t front = QSPI_PAGE_OFFSET(off);
 	size_t mid = min(*cnt, QSPI_PAGE_SIZE - front);
 	size_t last = QSPI_PAGE_SIZE - front - mid;
-	u8 *thiskbuf = kbuf;
 	int ret;
 
-	if (front) {
-		ret = qspi_buf_rdwr(flash, thiskbuf, thisoff, front, false);
+	if (old) {
+		/* Whole page is read for diff, front and last come from it. */
+		ret = qspi_blk_read(flash, old, thisoff, QSPI_PAGE_SIZE);
 		if (ret)
 			return ret;
+		memcpy(kbuf, old, QSPI_PAGE_SIZE);
+	} else {
+		if (front) {
+			ret = qspi_buf_rdwr(flash, kbuf, thisoff, front, false);
+			if (ret)
+				return ret;
+		}
+		if (last) {
+			ret = qspi_buf_rdwr(flash, kbuf + front + mid, thisoff + front + mid,
+					    last, false);
+			if (ret)
+				return ret;
+		}
 	}
-	thisoff += front;
-	thiskbuf += front;
-	if (copy_from_user(thiskbuf, ubuf, mid) != 0)
-		return -EFAULT;
+
+	memcpy(kbuf + front, src, mid);
 	*cnt = mid;
-	thisoff += mid;
-	thiskbuf += mid;
-	if (last) {
-		ret = qspi_buf_rdwr(flash, thiskbuf, thisoff, last, false);
-		if (ret)
-			return ret;
-	}
 
-	ret = qspi_page_erase(flash, QSPI_PAGE_ALIGN(off), QSPI_PAGE_SIZE);
-	if (ret == 0)
-		ret = qspi_buf_rdwr(flash, kbuf, QSPI_PAGE_ALIGN(off), QSPI_PAGE_SIZE, true);
-	return ret;
+	return qspi_blk_update(flash, kbuf, old, thisoff, QSPI_PAGE_SIZE);
 }
 
 static inline size_t qspi_get_page_io_size(loff_t off, size_t sz)
@@ -944,11 +1425,11 @@ static inline size_t qspi_get_page_io_size(loff_t off, size_t sz)
 
 /*
  * Try to erase and write full (large/huge) page.
- * @cnt contains actual bytes copied from user on successful return.
+ * @cnt contains actual bytes taken from src on successful return.
  * Needs to fallback to RMW, if not possible.
  */
-static int qspi_page_wr(struct xrt_qspi *flash,
-			const char __user *ubuf, u8 *kbuf, loff_t off, size_t *cnt)
+static int qspi_page_wr(struct xrt_qspi *flash, const u8 *src,
+			u8 *kbuf, u8 *old, loff_t off, size_t *cnt)
 {
 	int ret;
 	size_t thislen = qspi_get_page_io_size(off, *cnt);
@@ -957,26 +1438,199 @@ static int qspi_page_wr(struct xrt_qspi *flash,
 		return -EOPNOTSUPP;
 
 	*cnt = thislen;
+	memcpy(kbuf, src, thislen);
 
-	if (copy_from_user(kbuf, ubuf, thislen) != 0)
-		return -EFAULT;
+	if (old) {
+		ret = qspi_blk_read(flash, old, off, thislen);
+		if (ret)
+			return ret;
+	}
+	return qspi_blk_update(flash, kbuf, old, off, thislen);
+}
 
-	ret = qspi_page_erase(flash, off, thislen);
-	if (ret == 0)
-		ret = qspi_buf_rdwr(flash, kbuf, off, thislen, true);
-	return ret;
+/* Bytes to be written in one go from off, stopping at huge page boundary. */
+static inline size_t qspi_chunk_len(loff_t off, size_t n)
+{
+	return min(n, QSPI_HUGE_PAGE_SIZE - (size_t)(off & (QSPI_HUGE_PAGE_SIZE - 1)));
 }
 
 /*
- * Write to flash memory page by page from user buf.
+ * Write one chunk from kernel buf src to flash page by page. @page and @old
+ * are buffers of QSPI_HUGE_PAGE_SIZE, @old is NULL if not in diff mode.
+ * Caller should hold io_lock.
  */
-static ssize_t qspi_write(struct file *file, const char __user *buf, size_t n, loff_t *off)
+static int qspi_do_write(struct xrt_qspi *flash, const u8 *src, u8 *page, u8 *old,
+			 loff_t off, size_t len)
 {
-	struct xrt_qspi *flash = file->private_data;
-	u8 *page = NULL;
-	size_t cnt = 0;
+	size_t cnt = 0, thislen;
 	int ret = 0;
-	struct qspi_flash_addr faddr;
+
+	if (!qspi_wait_until_ready(flash))
+		return -EINVAL;
+
+	while (ret == 0 && cnt < len) {
+		thislen = len - cnt;
+		/* Try write full page. */
+		ret = qspi_page_wr(flash, src + cnt, page, old, off + cnt, &thislen);
+		/* Fallback to RMW. */
+		if (ret == -EOPNOTSUPP)
+			ret = qspi_page_rmw(flash, src + cnt, page, old, off + cnt, &thislen);
+		cnt += thislen;
+	}
+	if (ret == 0)
+		ret = qspi_wait_all_ready(flash);
+	return ret;
+}
+
+/*
+ * Update the same erase block on both flashes. Erase and program cmds are
+ * sent to each flash in turn, so that one flash is fed while the other one
+ * is busy. @src and @old are buffers for each flash, data of the block is
+ * at @soff in @src. @old is NULL if not in diff mode.
+ */
+static int qspi_dual_blk_update(struct xrt_qspi *flash, u8 *src[], u8 *old[],
+				size_t soff, loff_t off, size_t len)
+{
+	enum qspi_blk_action act[MAX_NUM_OF_SLAVES];
+	const u8 *cur[MAX_NUM_OF_SLAVES];
+	size_t n[MAX_NUM_OF_SLAVES];
+	size_t cnt;
+	bool more;
+	int i, ret;
+
+	for (i = 0; i < MAX_NUM_OF_SLAVES; i++) {
+		act[i] = QSPI_BLK_ERASE;
+		cur[i] = NULL;
+		if (old) {
+			flash->qspi_curr_slave = i;
+			ret = qspi_blk_read(flash, old[i], off, len);
+			if (ret)
+				return ret;
+			act[i] = qspi_blk_diff(old[i], src[i] + soff, len);
+			cur[i] = old[i];
+		}
+		qspi_blk_count(flash, act[i], len);
+		n[i] = act[i] == QSPI_BLK_SKIP ? len : 0;
+	}
+
+	/* Both flashes erase at the same time. */
+	for (i = 0; i < MAX_NUM_OF_SLAVES; i++) {
+		if (act[i] != QSPI_BLK_ERASE)
+			continue;
+		flash->qspi_curr_slave = i;
+		ret = qspi_page_erase(flash, off, len);
+		if (ret)
+			return ret;
+		cur[i] = NULL;
+	}
+
+	/* One program cmd to each flash in turn. */
+	do {
+		more = false;
+		for (i = 0; i < MAX_NUM_OF_SLAVES; i++) {
+			if (n[i] >= len)
+				continue;
+			cnt = min(QSPI_PROG_PAGE_SIZE - (n[i] & (QSPI_PROG_PAGE_SIZE - 1)),
+				  len - n[i]);
+			if (IS_ALIGNED(n[i], QSPI_PROG_PAGE_SIZE) &&
+			    qspi_prog_page_same(src[i] + soff + n[i], cur[i] ? cur[i] + n[i] : NULL,
+						cnt)) {
+				n[i] += cnt;
+			} else {
+				flash->qspi_curr_slave = i;
+				ret = qspi_fifo_wr(flash, off + n[i], src[i] + soff + n[i], &cnt);
+				if (ret)
+					return ret;
+				n[i] += cnt;
+			}
+			more |= n[i] < len;
+		}
+	} while (more);
+	return 0;
+}
+
+/*
+ * Write one chunk to the same range of both flashes, one erase block at a
+ * time. @page is a buffer of QSPI_HUGE_PAGE_SIZE for partial page. Caller
+ * should hold io_lock.
+ */
+static int qspi_dual_write(struct xrt_qspi *flash, u8 *src[], u8 *page, u8 *old[],
+			   loff_t off, size_t len)
+{
+	size_t cnt = 0, thislen;
+	int i, ret = 0;
+
+	while (ret == 0 && cnt < len) {
+		thislen = qspi_get_page_io_size(off + cnt, len - cnt);
+		if (thislen) {
+			ret = qspi_dual_blk_update(flash, src, old, cnt, off + cnt, thislen);
+			cnt += thislen;
+			continue;
+		}
+
+		/* Partial page at either end of image is not worth interleaving. */
+		for (i = 0; ret == 0 && i < MAX_NUM_OF_SLAVES; i++) {
+			thislen = len - cnt;
+			flash->qspi_curr_slave = i;
+			ret = qspi_page_rmw(flash, src[i] + cnt, page, old ? old[i] : NULL,
+					    off + cnt, &thislen);
+		}
+		cnt += thislen;
+	}
+	if (ret == 0)
+		ret = qspi_wait_all_ready(flash);
+	return ret;
+}
+
+/* Caller should hold job_lock. */
+static bool qspi_job_running(struct xrt_qspi *flash)
+{
+	bool running = false;
+
+	if (flash->job) {
+		spin_lock(&flash->job->lock);
+		running = flash->job->state == XRT_FLASH_JOB_RUNNING;
+		spin_unlock(&flash->job->lock);
+	}
+	return running;
+}
+
+/*
+ * Keep update job away while write() is going on. io_lock is only held for one
+ * chunk at a time, so that user buf can be copied in without holding it.
+ */
+static int qspi_write_begin(struct xrt_qspi *flash)
+{
+	int ret = 0;
+
+	mutex_lock(&flash->job_lock);
+	if (flash->writing || qspi_job_running(flash))
+		ret = -EBUSY;
+	else
+		flash->writing = true;
+	mutex_unlock(&flash->job_lock);
+	return ret;
+}
+
+static void qspi_write_end(struct xrt_qspi *flash)
+{
+	mutex_lock(&flash->job_lock);
+	flash->writing = false;
+	mutex_unlock(&flash->job_lock);
+}
+
+/*
+ * Write to flash memory page by page from user buf.
+ */
+static ssize_t qspi_write(struct file *file, const char __user *buf, size_t n, loff_t *off)
+{
+	struct qspi_client *client = file->private_data;
+	struct xrt_qspi *flash = client->flash;
+	u8 *page = NULL, *src = NULL, *old = NULL;
+	bool diff = READ_ONCE(flash->diff_write);
+	size_t cnt = 0, thislen;
+	int ret = 0;
+	struct qspi_flash_addr faddr;
 
 	QSPI_INFO(flash, "writing %zu bytes @0x%llx", n, *off);
 
@@ -986,35 +1640,51 @@ static ssize_t qspi_write(struct file *file, const char __user *buf, size_t n, l
 	}
 	n = min(n, flash->flash_size - (size_t)*off);
 
+	if (qspi_write_begin(flash)) {
+		QSPI_ERR(flash, "Can't write: flash is being updated");
+		return -EBUSY;
+	}
+
 	page = vmalloc(QSPI_HUGE_PAGE_SIZE);
-	if (!page)
-		return -ENOMEM;
+	src = vmalloc(QSPI_HUGE_PAGE_SIZE);
+	/* Current flash content, for differential write. */
+	if (diff)
+		old = vmalloc(QSPI_HUGE_PAGE_SIZE);
+	if (!page || !src || (diff && !old)) {
+		ret = -ENOMEM;
+		goto done;
+	}
 
 	mutex_lock(&flash->io_lock);
+	flash->blk_skipped = 0;
+	flash->blk_programmed = 0;
+	flash->blk_erased = 0;
+	mutex_unlock(&flash->io_lock);
 
 	qspi_offset2faddr(*off, &faddr);
-	flash->qspi_curr_slave = faddr.slave;
-
-	if (!qspi_wait_until_ready(flash))
-		ret = -EINVAL;
 	while (ret == 0 && cnt < n) {
 		loff_t thisoff = *off + cnt;
-		const char *thisbuf = buf + cnt;
-		size_t thislen = n - cnt;
 
-		/* Try write full page. */
-		ret = qspi_page_wr(flash, thisbuf, page, thisoff, &thislen);
-		if (ret) {
-			/* Fallback to RMW. */
-			if (ret == -EOPNOTSUPP)
-				ret = qspi_page_rmw(flash, thisbuf, page, thisoff, &thislen);
-			if (ret)
-				break;
+		/* User buf may be mmap'ed flash, can't fault on it with io_lock held. */
+		thislen = qspi_chunk_len(thisoff, n - cnt);
+		if (copy_from_user(src, buf + cnt, thislen) != 0) {
+			ret = -EFAULT;
+			break;
 		}
+
+		mutex_lock(&flash->io_lock);
+		flash->qspi_curr_slave = faddr.slave;
+		ret = qspi_do_write(flash, src, page, old, thisoff, thislen);
+		mutex_unlock(&flash->io_lock);
 		cnt += thislen;
 	}
-	mutex_unlock(&flash->io_lock);
+	QSPI_INFO(flash, "erase blocks: %u skipped, %u programmed, %u erased",
+		  flash->blk_skipped, flash->blk_programmed, flash->blk_erased);
 
+done:
+	qspi_write_end(flash);
+	vfree(old);
+	vfree(src);
 	vfree(page);
 	if (ret)
 		return ret;
@@ -1023,6 +1693,377 @@ static ssize_t qspi_write(struct file *file, const char __user *buf, size_t n, l
 	return n;
 }
 
+/* Fetch len bytes at pos of image into buf. */
+static int qspi_job_fetch(struct qspi_job *job, u8 *buf, u64 pos, size_t len)
+{
+	ssize_t ret;
+	size_t n;
+
+	if (job->image) {
+		memcpy(buf, job->image + pos, len);
+		return 0;
+	}
+
+	pos += job->src_off;
+	for (n = 0; n < len; n += ret) {
+		ret = kernel_read(job->file, buf + n, len - n, &pos);
+		if (ret < 0)
+			return ret;
+		/* Image file is shorter than what we are told. */
+		if (ret == 0)
+			return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Program image one chunk at a time, then read it back to verify. io_lock is
+ * only held for one chunk, so flash can still be read while job is running.
+ * Dual image has one half for each flash, both are programmed together.
+ */
+static int qspi_job_thread(void *arg)
+{
+	struct qspi_job *job = arg;
+	struct xrt_qspi *flash = job->flash;
+	bool diff = READ_ONCE(flash->diff_write);
+	int nr = job->dual ? MAX_NUM_OF_SLAVES : 1;
+	u8 *src[MAX_NUM_OF_SLAVES] = { NULL };
+	u8 *old[MAX_NUM_OF_SLAVES] = { NULL };
+	u64 half = job->total / nr;
+	struct qspi_flash_addr faddr;
+	u64 erased, programmed;
+	u8 *page;
+	size_t len;
+	loff_t off;
+	u64 pos;
+	int i, ret = 0;
+
+	page = vmalloc(QSPI_HUGE_PAGE_SIZE);
+	if (!page)
+		ret = -ENOMEM;
+	for (i = 0; i < nr; i++) {
+		src[i] = vmalloc(QSPI_HUGE_PAGE_SIZE);
+		old[i] = vmalloc(QSPI_HUGE_PAGE_SIZE);
+		if (!src[i] || !old[i])
+			ret = -ENOMEM;
+	}
+
+	mutex_lock(&flash->io_lock);
+	flash->bytes_erased = 0;
+	flash->bytes_programmed = 0;
+	mutex_unlock(&flash->io_lock);
+
+	for (pos = 0; ret == 0 && pos < half; pos += len) {
+		if (READ_ONCE(job->cancel) || kthread_should_stop()) {
+			ret = -ECANCELED;
+			break;
+		}
+
+		off = job->flash_off + pos;
+		len = qspi_chunk_len(off, half - pos);
+		for (i = 0; ret == 0 && i < nr; i++)
+			ret = qspi_job_fetch(job, src[i], i * half + pos, len);
+		if (ret)
+			break;
+
+		mutex_lock(&flash->io_lock);
+		qspi_offset2faddr(off, &faddr);
+		if (job->dual) {
+			ret = qspi_dual_write(flash, src, page, diff ? old : NULL, off, len);
+		} else {
+			flash->qspi_curr_slave = faddr.slave;
+			ret = qspi_do_write(flash, src[0], page, diff ? old[0] : NULL, off, len);
+		}
+		for (i = 0; ret == 0 && i < nr; i++) {
+			flash->qspi_curr_slave = job->dual ? i : faddr.slave;
+			ret = qspi_blk_read(flash, old[i], off, len);
+			if (ret == 0 && memcmp(src[i], old[i], len)) {
+				QSPI_ERR(flash, "job %u: verify failed @0x%llx on flash %d",
+					 job->id, off, flash->qspi_curr_slave);
+				ret = -EIO;
+			}
+		}
+		erased = flash->bytes_erased;
+		programmed = flash->bytes_programmed;
+		mutex_unlock(&flash->io_lock);
+
+		spin_lock(&job->lock);
+		job->erased = erased;
+		job->programmed = programmed;
+		if (ret == 0) {
+			job->verified += len * nr;
+			job->done += len * nr;
+		}
+		job->seq++;
+		spin_unlock(&job->lock);
+		wake_up_interruptible(&flash->job_wq);
+	}
+
+	spin_lock(&job->lock);
+	job->error = ret;
+	if (ret == -ECANCELED)
+		job->state = XRT_FLASH_JOB_CANCELLED;
+	else if (ret)
+		job->state = XRT_FLASH_JOB_FAILED;
+	else
+		job->state = XRT_FLASH_JOB_DONE;
+	job->end_ns = ktime_get_ns();
+	job->seq++;
+	spin_unlock(&job->lock);
+	wake_up_interruptible(&flash->job_wq);
+
+	QSPI_INFO(flash, "job %u: %llu of %llu bytes in %llums: %d", job->id, job->done,
+		  job->total, div_u64(job->end_ns - job->start_ns, NSEC_PER_MSEC), ret);
+
+	for (i = 0; i < nr; i++) {
+		vfree(old[i]);
+		vfree(src[i]);
+	}
+	vfree(page);
+	return ret;
+}
+
+/* Stop job thread if it is still running and free the job. */
+static void qspi_job_free(struct xrt_qspi *flash)
+{
+	struct qspi_job *job = flash->job;
+
+	WARN_ON(!mutex_is_locked(&flash->job_lock));
+	if (!job)
+		return;
+
+	WRITE_ONCE(job->cancel, true);
+	kthread_stop(job->thread);
+	put_task_struct(job->thread);
+	if (job->file)
+		fput(job->file);
+	kvfree(job->image);
+	kfree(job);
+	flash->job = NULL;
+}
+
+static int qspi_job_submit(struct xrt_qspi *flash, struct xrt_flash_ioc_update __user *arg)
+{
+	struct xrt_flash_ioc_update upd;
+	struct qspi_job *job;
+	int ret = 0;
+
+	if (copy_from_user(&upd, arg, sizeof(upd)))
+		return -EFAULT;
+	if ((upd.flags & ~XRT_FLASH_UPDATE_DUAL) || upd.padding || upd.size == 0)
+		return -EINVAL;
+	if (upd.flags & XRT_FLASH_UPDATE_DUAL) {
+		struct qspi_flash_addr faddr;
+
+		if (flash->qspi_num_slaves < MAX_NUM_OF_SLAVES)
+			return -ENODEV;
+		/* Both halves go to the same offset on each flash. */
+		qspi_offset2faddr(upd.flash_offset, &faddr);
+		if (faddr.slave || upd.size % MAX_NUM_OF_SLAVES)
+			return -EINVAL;
+	}
+	if (!is_valid_offset(flash, upd.flash_offset) ||
+	    upd.size / ((upd.flags & XRT_FLASH_UPDATE_DUAL) ? MAX_NUM_OF_SLAVES : 1) >
+	    flash->flash_size - (size_t)upd.flash_offset)
+		return -ENOSPC;
+
+	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+	job->flash = flash;
+	job->flash_off = upd.flash_offset;
+	job->dual = !!(upd.flags & XRT_FLASH_UPDATE_DUAL);
+	job->total = upd.size;
+	job->state = XRT_FLASH_JOB_RUNNING;
+	spin_lock_init(&job->lock);
+
+	if (upd.fd >= 0) {
+		job->file = fget(upd.fd);
+		if (!job->file || !(job->file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			goto fail;
+		}
+		job->src_off = upd.src_offset;
+	} else {
+		job->image = vmemdup_user(u64_to_user_ptr(upd.buf), upd.size);
+		if (IS_ERR(job->image)) {
+			ret = PTR_ERR(job->image);
+			job->image = NULL;
+			goto fail;
+		}
+	}
+
+	mutex_lock(&flash->job_lock);
+	if (flash->writing || qspi_job_running(flash)) {
+		mutex_unlock(&flash->job_lock);
+		ret = -EBUSY;
+		goto fail;
+	}
+	qspi_job_free(flash);
+
+	/* Job ID 0 is reserved for status query of last job. */
+	if (++flash->job_next_id == 0)
+		flash->job_next_id++;
+	job->id = flash->job_next_id;
+	job->thread = kthread_create(qspi_job_thread, job, "xrt_qspi_job%u", job->id);
+	if (IS_ERR(job->thread)) {
+		mutex_unlock(&flash->job_lock);
+		ret = PTR_ERR(job->thread);
+		goto fail;
+	}
+	/* Job thread exits by itself, hold it for kthread_stop(). */
+	get_task_struct(job->thread);
+	job->start_ns = ktime_get_ns();
+	flash->job = job;
+	wake_up_process(job->thread);
+	upd.job_id = job->id;
+	mutex_unlock(&flash->job_lock);
+
+	QSPI_INFO(flash, "job %u: updating %llu bytes @0x%llx from %s%s", upd.job_id, upd.size,
+		  upd.flash_offset, upd.fd >= 0 ? "file" : "user buffer",
+		  (upd.flags & XRT_FLASH_UPDATE_DUAL) ? " to both flashes" : "");
+	if (copy_to_user(&arg->job_id, &upd.job_id, sizeof(upd.job_id)))
+		return -EFAULT;
+	return 0;
+
+fail:
+	if (job->file)
+		fput(job->file);
+	kvfree(job->image);
+	kfree(job);
+	return ret;
+}
+
+/*
+ * Snapshot progress of job of st->job_id, or last job if it is 0. Progress
+ * sequence of the snapshot is returned in seq if it is not NULL.
+ */
+static int qspi_job_status(struct xrt_qspi *flash, struct xrt_flash_ioc_status *st, u64 *seq)
+{
+	struct qspi_job *job;
+	u32 id = st->job_id;
+	u64 elapsed;
+
+	memset(st, 0, sizeof(*st));
+	mutex_lock(&flash->job_lock);
+	job = flash->job;
+	if (!job) {
+		mutex_unlock(&flash->job_lock);
+		return id ? -ENOENT : 0;
+	}
+	if (id && id != job->id) {
+		mutex_unlock(&flash->job_lock);
+		return -ENOENT;
+	}
+
+	spin_lock(&job->lock);
+	st->job_id = job->id;
+	st->state = job->state;
+	st->error = job->error;
+	st->total = job->total;
+	st->done = job->done;
+	st->erased = job->erased;
+	st->programmed = job->programmed;
+	st->verified = job->verified;
+	elapsed = (job->end_ns ? job->end_ns : ktime_get_ns()) - job->start_ns;
+	if (seq)
+		*seq = job->seq;
+	spin_unlock(&job->lock);
+	mutex_unlock(&flash->job_lock);
+
+	/* Assuming the rest of image goes as fast as what is done so far. */
+	if (st->state == XRT_FLASH_JOB_RUNNING && st->done) {
+		st->eta_ms = div64_u64(div_u64(elapsed, NSEC_PER_MSEC) * (st->total - st->done),
+				       st->done);
+	}
+	return 0;
+}
+
+static int qspi_job_ioc_status(struct qspi_client *client,
+			       struct xrt_flash_ioc_status __user *arg)
+{
+	struct xrt_flash_ioc_status st;
+	u64 seq = 0;
+	int ret;
+
+	if (copy_from_user(&st, arg, sizeof(st)))
+		return -EFAULT;
+	ret = qspi_job_status(client->flash, &st, &seq);
+	if (ret)
+		return ret;
+	if (st.job_id) {
+		WRITE_ONCE(client->seen_job, st.job_id);
+		WRITE_ONCE(client->seen_seq, seq);
+	}
+	if (copy_to_user(arg, &st, sizeof(st)))
+		return -EFAULT;
+	return 0;
+}
+
+static int qspi_job_cancel(struct xrt_qspi *flash, u32 id)
+{
+	int ret = 0;
+
+	mutex_lock(&flash->job_lock);
+	if (!flash->job || flash->job->id != id)
+		ret = -ENOENT;
+	else
+		WRITE_ONCE(flash->job->cancel, true);
+	mutex_unlock(&flash->job_lock);
+
+	if (!ret)
+		QSPI_INFO(flash, "job %u: cancelling", id);
+	return ret;
+}
+
+static long qspi_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct qspi_client *client = file->private_data;
+	struct xrt_qspi *flash = client->flash;
+
+	switch (cmd) {
+	case XRT_FLASH_IOC_UPDATE:
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		return qspi_job_submit(flash, (void __user *)arg);
+	case XRT_FLASH_IOC_STATUS:
+		return qspi_job_ioc_status(client, (void __user *)arg);
+	case XRT_FLASH_IOC_CANCEL:
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		return qspi_job_cancel(flash, arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ * Readable when job has made progress since last status query on this open.
+ * Nothing of a job submitted after that query has been seen.
+ */
+static uint qspi_poll(struct file *file, poll_table *wait)
+{
+	struct qspi_client *client = file->private_data;
+	struct xrt_qspi *flash = client->flash;
+	struct qspi_job *job;
+	uint mask = 0;
+	u64 seen;
+
+	poll_wait(file, &flash->job_wq, wait);
+
+	mutex_lock(&flash->job_lock);
+	job = flash->job;
+	if (job) {
+		seen = READ_ONCE(client->seen_job) == job->id ? READ_ONCE(client->seen_seq) : 0;
+		spin_lock(&job->lock);
+		if (job->seq != seen)
+			mask |= POLLIN | POLLRDNORM;
+		spin_unlock(&job->lock);
+	}
+	mutex_unlock(&flash->job_lock);
+	return mask;
+}
+
 static loff_t qspi_llseek(struct file *filp, loff_t off, int whence)
 {
 	loff_t npos;
@@ -1051,25 +2092,38 @@ static loff_t qspi_llseek(struct file *filp, loff_t off, int whence)
  */
 static int qspi_open(struct inode *inode, struct file *file)
 {
-	struct xrt_qspi *flash;
+	struct qspi_client *client;
 	struct xrt_device *xdev = xleaf_devnode_open_excl(inode);
 
 	if (!xdev)
 		return -EBUSY;
 
-	flash = xrt_get_drvdata(xdev);
-	file->private_data = flash;
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client) {
+		xleaf_devnode_close(inode);
+		return -ENOMEM;
+	}
+	client->flash = xrt_get_drvdata(xdev);
+	file->private_data = client;
 	return 0;
 }
 
 static int qspi_close(struct inode *inode, struct file *file)
 {
-	struct xrt_qspi *flash = file->private_data;
+	struct qspi_client *client = file->private_data;
+	struct xrt_qspi *flash;
 
-	if (!flash)
+	if (!client)
 		return -EINVAL;
+	flash = client->flash;
+
+	/* Last user is gone, so are all mappings. */
+	mutex_lock(&flash->io_lock);
+	flash->mapping = NULL;
+	mutex_unlock(&flash->io_lock);
 
 	file->private_data = NULL;
+	kfree(client);
 	xleaf_devnode_close(inode);
 	return 0;
 }
@@ -1089,9 +2143,126 @@ static ssize_t size_show(struct device *dev, struct device_attribute *attr, char
 }
 static DEVICE_ATTR_RO(size);
 
+static ssize_t diff_write_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", READ_ONCE(flash->diff_write));
+}
+
+static ssize_t diff_write_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+	bool enable;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	WRITE_ONCE(flash->diff_write, enable);
+	return count;
+}
+
+/* Skip unchanged erase blocks and avoid erase when possible, 1 by default. */
+static DEVICE_ATTR_RW(diff_write);
+
+static ssize_t update_status_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	static const char * const state_names[] = {
+		[XRT_FLASH_JOB_NONE] = "none",
+		[XRT_FLASH_JOB_RUNNING] = "running",
+		[XRT_FLASH_JOB_DONE] = "done",
+		[XRT_FLASH_JOB_FAILED] = "failed",
+		[XRT_FLASH_JOB_CANCELLED] = "cancelled",
+	};
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+	struct xrt_flash_ioc_status st = { 0 };
+	ssize_t cnt;
+
+	qspi_job_status(flash, &st, NULL);
+	cnt = sprintf(buf, "job %u %s total %llu done %llu erased %llu ",
+		      st.job_id, state_names[st.state], st.total, st.done, st.erased);
+	cnt += sprintf(buf + cnt, "programmed %llu verified %llu eta_ms %llu error %d\n",
+		       st.programmed, st.verified, st.eta_ms, st.error);
+	return cnt;
+}
+
+/* Progress of last background update job. */
+static DEVICE_ATTR_RO(update_status);
+
+static ssize_t read_cache_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+	u64 hits, misses;
+
+	xa_lock(&flash->cache);
+	hits = flash->cache_hits;
+	misses = flash->cache_misses;
+	xa_unlock(&flash->cache);
+
+	return sprintf(buf, "pages %lu hits %llu misses %llu\n",
+		       READ_ONCE(flash->cache_pages), hits, misses);
+}
+
+static ssize_t read_cache_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+
+	mutex_lock(&flash->io_lock);
+	qspi_cache_drop(flash);
+	mutex_unlock(&flash->io_lock);
+
+	xa_lock(&flash->cache);
+	flash->cache_hits = 0;
+	flash->cache_misses = 0;
+	xa_unlock(&flash->cache);
+	return count;
+}
+
+/* Any write drops all cached pages and resets the counters. */
+static DEVICE_ATTR_RW(read_cache);
+
+static ssize_t read_speed_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+	u64 bytes, ns, kbps = 0;
+	u8 cmd;
+
+	mutex_lock(&flash->io_lock);
+	cmd = flash->read_cmd;
+	bytes = flash->read_bytes;
+	ns = flash->read_ns;
+	mutex_unlock(&flash->io_lock);
+
+	if (ns)
+		kbps = div64_u64(bytes * 1000 * 1000, ns);
+	return sprintf(buf, "cmd 0x%x bytes %llu us %llu speed %llu.%03llu MB/s\n",
+		       cmd, bytes, div_u64(ns, 1000), div_u64(kbps, 1000), kbps % 1000);
+}
+
+static ssize_t read_speed_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct xrt_qspi *flash = dev_get_drvdata(dev);
+
+	mutex_lock(&flash->io_lock);
+	flash->read_bytes = 0;
+	flash->read_ns = 0;
+	mutex_unlock(&flash->io_lock);
+	return count;
+}
+
+/* Throughput of reads from flash, not counting cache hits. Any write resets it. */
+static DEVICE_ATTR_RW(read_speed);
+
 static struct attribute *qspi_attrs[] = {
 	&dev_attr_flash_type.attr,
 	&dev_attr_size.attr,
+	&dev_attr_diff_write.attr,
+	&dev_attr_update_status.attr,
+	&dev_attr_read_cache.attr,
+	&dev_attr_read_speed.attr,
 	NULL,
 };
 
@@ -1107,12 +2278,20 @@ static void qspi_remove(struct xrt_device *xdev)
 
 	sysfs_remove_group(&DEV(flash->xdev)->kobj, &qspi_attr_group);
 
+	mutex_lock(&flash->job_lock);
+	qspi_job_free(flash);
+	mutex_unlock(&flash->job_lock);
+
+	qspi_cache_drop(flash);
+	xa_destroy(&flash->cache);
+
 	if (flash->io_buf)
 		vfree(flash->io_buf);
 
 	if (flash->qspi_regs)
 		iounmap(flash->qspi_regs);
 
+	mutex_destroy(&flash->job_lock);
 	mutex_destroy(&flash->io_lock);
 }
 
@@ -1157,6 +2336,57 @@ static int qspi_get_ID(struct xrt_qspi *flash)
 	return 0;
 }
 
+/* Check if there is a second flash of the same kind as the first one. */
+static bool qspi_probe_slave(struct xrt_qspi *flash, int slave)
+{
+	u8 cmd[5] = { QSPI_CMD_IDCODE_READ, };
+	int ret;
+
+	flash->qspi_curr_slave = slave;
+	ret = qspi_transaction(flash, cmd, sizeof(cmd), true);
+	flash->qspi_curr_slave = 0;
+
+	return !ret && cmd[1] == flash->vendor->vendor_id &&
+		flash->vendor->code2sectors(cmd[3]) * (16 * 1024 * 1024) == flash->flash_size;
+}
+
+/*
+ * Quad IO read also sends address and dummy on all 4 lines, it is shorter on
+ * the wire than quad output read. But its dummy length depends on flash
+ * config, so it is only used when it reads the same data as quad output read.
+ */
+static void qspi_probe_read_cmd(struct xrt_qspi *flash)
+{
+	size_t len = QSPI_PROG_PAGE_SIZE;
+	u8 *buf;
+	int ret;
+
+	if (!flash->vendor->quad_io_dummy_len)
+		return;
+
+	buf = kmalloc(len * 2, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	ret = qspi_blk_read(flash, buf, 0, len);
+	/* Can't tell if data is shifted when all bytes are the same. */
+	if (ret || !memchr_inv(buf, buf[0], len))
+		goto done;
+
+	flash->read_cmd = QSPI_CMD_QUAD_IO_READ;
+	flash->read_dummy_len = flash->vendor->quad_io_dummy_len;
+	ret = qspi_blk_read(flash, buf + len, 0, len);
+	if (ret || memcmp(buf, buf + len, len)) {
+		QSPI_WARN(flash, "Quad IO read does not work, err: %d", ret);
+		flash->read_cmd = QSPI_CMD_QUAD_READ;
+		flash->read_dummy_len = QSPI_QUAD_READ_DUMMY_LEN;
+	}
+
+done:
+	QSPI_INFO(flash, "Flash read cmd: 0x%x", flash->read_cmd);
+	kfree(buf);
+}
+
 static int qspi_controller_probe(struct xrt_qspi *flash)
 {
 	int ret;
@@ -1180,7 +2410,14 @@ static int qspi_controller_probe(struct xrt_qspi *flash)
 	if (ret)
 		return ret;
 
-	flash->qspi_curr_sector = 0xff;
+	flash->qspi_num_slaves = qspi_probe_slave(flash, 1) ? 2 : 1;
+	QSPI_INFO(flash, "Number of flashes: %d", flash->qspi_num_slaves);
+
+	memset(flash->qspi_curr_sector, 0xff, sizeof(flash->qspi_curr_sector));
+	flash->diff_write = true;
+	flash->read_cmd = QSPI_CMD_QUAD_READ;
+	flash->read_dummy_len = QSPI_QUAD_READ_DUMMY_LEN;
+	flash->yield_at = jiffies;
 
 	return 0;
 }
@@ -1198,6 +2435,9 @@ static int qspi_probe(struct xrt_device *xdev)
 	flash->xdev = xdev;
 
 	mutex_init(&flash->io_lock);
+	mutex_init(&flash->job_lock);
+	init_waitqueue_head(&flash->job_wq);
+	xa_init(&flash->cache);
 
 	flash->res = xrt_get_resource(xdev, IORESOURCE_MEM, 0);
 	if (!flash->res) {
@@ -1222,6 +2462,7 @@ static int qspi_probe(struct xrt_device *xdev)
 		ret = -ENOMEM;
 		goto error;
 	}
+	qspi_probe_read_cmd(flash);
 
 	ret  = sysfs_create_group(&DEV(xdev)->kobj, &qspi_attr_group);
 	if (ret)
@@ -1296,6 +2537,9 @@ static struct xrt_driver xrt_qspi_driver = {
 			.read = qspi_read,
 			.write = qspi_write,
 			.llseek = qspi_llseek,
+			.unlocked_ioctl = qspi_ioctl,
+			.poll = qspi_poll,
+			.mmap = qspi_mmap,
 		},
 		.xsf_dev_name = "flash",
 	},
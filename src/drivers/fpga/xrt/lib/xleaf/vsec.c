@@ -155,6 +155,29 @@ static char *type2compat(u32 type)
 	return NULL;
 }
 
+/*
+ * Root puts the mailbox MSI-X vector on the VSEC node, if it has one.
+ * Pass it on to the mailbox node so that the mailbox does not have to poll.
+ */
+static int xrt_vsec_add_intr(struct xrt_vsec *vsec, const char *ep_name)
+{
+	struct xrt_subdev_platdata *pdata = DEV_PDATA(vsec->xdev);
+	const __be32 *vec;
+	int ret;
+
+	ret = xrt_md_get_prop(DEV(vsec->xdev), pdata->xsp_dtb, XRT_MD_NODE_VSEC,
+			      NULL, XRT_MD_PROP_INTERRUPTS, (const void **)&vec, NULL);
+	if (ret)
+		return 0;
+
+	ret = xrt_md_set_prop(DEV(vsec->xdev), vsec->metadata, ep_name, NULL,
+			      XRT_MD_PROP_INTERRUPTS, vec, sizeof(*vec));
+	if (ret)
+		xrt_err(vsec->xdev, "add %s interrupts failed, ret %d", ep_name, ret);
+
+	return ret;
+}
+
 static int xrt_vsec_add_node(struct xrt_vsec *vsec,
 			     void *md_blob, struct xrt_vsec_entry *p_entry)
 {
@@ -181,8 +204,13 @@ static int xrt_vsec_add_node(struct xrt_vsec *vsec,
 	ep.compat = type2compat(p_entry->type);
 	ep.compat_ver = compat_ver;
 	ret = xrt_md_add_endpoint(DEV(vsec->xdev), vsec->metadata, &ep);
-	if (ret)
+	if (ret) {
 		xrt_err(vsec->xdev, "add ep failed, ret %d", ret);
+		return ret;
+	}
+
+	if (p_entry->type == VSEC_TYPE_MAILBOX)
+		ret = xrt_vsec_add_intr(vsec, ep.ep_name);
 
 	return ret;
 }
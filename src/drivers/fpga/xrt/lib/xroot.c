@@ -379,6 +379,17 @@ static int xroot_root_cb(struct device *dev, void *parg, enum xrt_root_cmd cmd,
 			memset(id, 0, sizeof(*id));
 		break;
 	}
+	case XRT_ROOT_GET_IRQ: {
+		struct xrt_root_get_irq *irq = (struct xrt_root_get_irq *)arg;
+
+		if (xr->pf_cb.xpc_get_irq) {
+			rc = xr->pf_cb.xpc_get_irq(xr->dev, irq);
+		} else {
+			xroot_dbg(xr, "get irq is not supported");
+			rc = -EOPNOTSUPP;
+		}
+		break;
+	}
 
 	/* MISC generic root driver functions. */
 	case XRT_ROOT_HOT_RESET: {
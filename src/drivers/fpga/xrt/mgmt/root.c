@@ -37,6 +37,8 @@
 	PCI_DEVID((pcidev)->bus->number, 0)); })
 #define XRT_VSEC_ID		0x20
 #define XRT_MAX_READRQ		512
+/* MSI-X vector the mgmt PF mailbox raises its RX/TX intrs on. */
+#define XRT_MAILBOX_VEC		0
 
 static struct class *xmgmt_class;
 
@@ -58,6 +60,7 @@ static const struct pci_device_id xmgmt_pci_ids[] = {
 struct xmgmt {
 	struct pci_dev *pdev;
 	void *root;
+	int nvec;
 
 	bool ready;
 };
@@ -85,6 +88,25 @@ static int xmgmt_config_pci(struct xmgmt *xm)
 	return 0;
 }
 
+static void xmgmt_config_irq(struct xmgmt *xm)
+{
+	struct pci_dev *pdev = XMGMT_PDEV(xm);
+	int nvec;
+
+	nvec = pci_msix_vec_count(pdev);
+	if (nvec <= 0) {
+		xmgmt_info(xm, "no MSI-X vector, leaves will poll");
+		return;
+	}
+
+	nvec = pci_alloc_irq_vectors(pdev, nvec, nvec, PCI_IRQ_MSIX);
+	if (nvec < 0) {
+		xmgmt_warn(xm, "failed to alloc MSI-X vectors: %d", nvec);
+		return;
+	}
+	xm->nvec = nvec;
+}
+
 static int xmgmt_match_slot_and_save(struct device *dev, void *data)
 {
 	struct xmgmt *xm = data;
@@ -225,6 +247,21 @@ static int xmgmt_add_vsec_node(struct xmgmt *xm, char *dtb)
 		goto failed;
 	}
 
+	/*
+	 * The VSEC table has no room for intr routing, so hand the mailbox
+	 * vector down through the VSEC node. Leaves keep polling without it.
+	 */
+	if (xm->nvec > XRT_MAILBOX_VEC) {
+		__be32 vec = cpu_to_be32(XRT_MAILBOX_VEC);
+
+		ret = xrt_md_set_prop(dev, dtb, XRT_MD_NODE_VSEC, NULL,
+				      XRT_MD_PROP_INTERRUPTS, &vec, sizeof(vec));
+		if (ret) {
+			xmgmt_err(xm, "add vsec interrupts failed, ret %d", ret);
+			goto failed;
+		}
+	}
+
 failed:
 	return ret;
 }
@@ -307,9 +344,28 @@ static int xmgmt_root_get_resource(struct device *dev, struct xrt_root_get_res *
 	return 0;
 }
 
+static int xmgmt_root_get_irq(struct device *dev, struct xrt_root_get_irq *irq)
+{
+	struct pci_dev *pdev = to_pci_dev(dev);
+	struct xmgmt *xm;
+	int ret;
+
+	xm = pci_get_drvdata(pdev);
+	if (irq->xpigq_vector >= xm->nvec)
+		return -ENOENT;
+
+	ret = pci_irq_vector(pdev, irq->xpigq_vector);
+	if (ret < 0)
+		return ret;
+
+	irq->xpigq_irq = ret;
+	return 0;
+}
+
 static struct xroot_physical_function_callback xmgmt_xroot_pf_cb = {
 	.xpc_get_id = xmgmt_root_get_id,
 	.xpc_get_resource = xmgmt_root_get_resource,
+	.xpc_get_irq = xmgmt_root_get_irq,
 	.xpc_hot_reset = xmgmt_root_hot_reset,
 };
 
@@ -328,6 +384,7 @@ static int xmgmt_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	ret = xmgmt_config_pci(xm);
 	if (ret)
 		goto failed;
+	xmgmt_config_irq(xm);
 
 	ret = xroot_probe(&pdev->dev, &xmgmt_xroot_pf_cb, &xm->root);
 	if (ret)
@@ -360,6 +417,8 @@ static int xmgmt_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 failed_metadata:
 	xroot_remove(xm->root);
 failed:
+	if (xm->nvec)
+		pci_free_irq_vectors(pdev);
 	pci_set_drvdata(pdev, NULL);
 	return ret;
 }
@@ -371,6 +430,8 @@ static void xmgmt_remove(struct pci_dev *pdev)
 	xroot_broadcast(xm->root, XRT_EVENT_PRE_REMOVAL);
 	sysfs_remove_group(&pdev->dev.kobj, &xmgmt_root_attr_group);
 	xroot_remove(xm->root);
+	if (xm->nvec)
+		pci_free_irq_vectors(pdev);
 	pci_disable_pcie_error_reporting(xm->pdev);
 	xmgmt_info(xm, "%s cleaned up successfully", XMGMT_MODULE_NAME);
 }
@@ -23,12 +23,52 @@
 #include "xleaf/ddr_calibration.h"
 #include "xleaf/icap.h"
 
+/* Number of PEER_DATA kinds with cached responses. */
+#define XMGMT_MBX_CACHE_KINDS	4
+
+struct xmgmt_mailbox_cache_entry {
+	struct mutex lock; /* serializes backend reads, protects below */
+	void *data;
+	size_t len;
+	u32 csum;
+	bool valid;
+	u32 gen;
+	unsigned long stamp;
+	u64 fills;
+};
+
+/* LOAD_XCLBIN request being streamed in from peer. */
+struct xmgmt_mailbox_xclbin {
+	u64 req_id;
+	struct axlf *axlf; /* filled in as it arrives */
+	size_t len;
+	size_t done;
+	u64 bit_off;
+	u64 bit_size;
+	bool bit_checked;
+};
+
+/* Caps handled here rather than in mailbox. */
+#define XMGMT_MAILBOX_CAPS	XCL_MB_CAP_RECLOCK_FREQS
+
 struct xmgmt_mailbox {
 	struct xrt_device *xdev;
 	struct xrt_device *mailbox;
 	struct mutex lock; /* lock for xmgmt_mailbox */
 	char *test_msg;
 	bool peer_in_same_domain;
+	u32 peer_caps; /* XCL_MB_CAP_* agreed with peer */
+	struct xmgmt_mailbox_xclbin *xclbin; /* protected by lock */
+	/* Streamed request already failed and answered, protected by lock. */
+	bool stream_failed;
+	u64 stream_failed_id;
+
+	/* PEER_DATA response cache, one packed blob per kind. */
+	struct xmgmt_mailbox_cache_entry cache[XMGMT_MBX_CACHE_KINDS];
+	atomic_t cache_gen;
+	atomic64_t cache_hits;
+	atomic64_t cache_misses;
+	atomic64_t cache_coalesced;
 };
 
 static inline const char *mailbox_chan2name(bool sw_ch)
@@ -69,20 +109,20 @@ static inline struct xmgmt_mailbox *xdev2mbx(struct xrt_device *xdev)
 	return (struct xmgmt_mailbox *)xmgmt_xdev2mailbox(xdev);
 }
 
-static void xmgmt_mailbox_post(struct xmgmt_mailbox *xmbx,
+static void xmgmt_mailbox_post(struct xmgmt_mailbox *xmbx, struct xrt_device *mailbox,
 			       u64 msgid, bool sw_ch, void *buf, size_t len)
 {
 	struct xrt_mailbox_post post = {
 		.xmip_req_id = msgid,
 		.xmip_sw_ch = sw_ch,
 		.xmip_data = buf,
-		.xmip_data_size = len
+		.xmip_data_size = len,
+		/* Notifications to peer go ahead of responses. */
+		.xmip_prio = msgid ? XRT_MAILBOX_PRIO_INTERACTIVE : XRT_MAILBOX_PRIO_CONTROL,
 	};
 	int rc;
 
-	WARN_ON(!mutex_is_locked(&xmbx->lock));
-
-	if (!xmbx->mailbox) {
+	if (!mailbox) {
 		xrt_err(xmbx->xdev, "mailbox not available");
 		return;
 	}
@@ -92,7 +132,7 @@ static void xmgmt_mailbox_post(struct xmgmt_mailbox *xmbx,
 	else
 		xmgmt_mailbox_prt_resp(xmbx, &post);
 
-	rc = xleaf_call(xmbx->mailbox, XRT_MAILBOX_POST, &post);
+	rc = xleaf_call(mailbox, XRT_MAILBOX_POST, &post);
 	if (rc && rc != -ESHUTDOWN)
 		xrt_err(xmbx->xdev, "failed to post msg: %d", rc);
 }
@@ -100,15 +140,24 @@ static void xmgmt_mailbox_post(struct xmgmt_mailbox *xmbx,
 static void xmgmt_mailbox_notify(struct xmgmt_mailbox *xmbx, bool sw_ch,
 				 struct xcl_mailbox_req *req, size_t len)
 {
-	xmgmt_mailbox_post(xmbx, 0, sw_ch, req, len);
+	WARN_ON(!mutex_is_locked(&xmbx->lock));
+	xmgmt_mailbox_post(xmbx, xmbx->mailbox, 0, sw_ch, req, len);
 }
 
+/*
+ * Only called from listener callbacks. Mailbox leaf does not go away before
+ * listener is unregistered, which waits for them, so responses are posted
+ * without lock and concurrent requests don't wait on each other's TX.
+ */
 static void xmgmt_mailbox_respond(struct xmgmt_mailbox *xmbx,
 				  u64 msgid, bool sw_ch, void *buf, size_t len)
 {
+	struct xrt_device *mailbox;
+
 	mutex_lock(&xmbx->lock);
-	xmgmt_mailbox_post(xmbx, msgid, sw_ch, buf, len);
+	mailbox = xmbx->mailbox;
 	mutex_unlock(&xmbx->lock);
+	xmgmt_mailbox_post(xmbx, mailbox, msgid, sw_ch, buf, len);
 }
 
 static void xmgmt_mailbox_resp_test_msg(struct xmgmt_mailbox *xmbx, u64 msgid, bool sw_ch)
@@ -332,61 +381,54 @@ fail:
 	return NULL;
 }
 
-static void xmgmt_mailbox_resp_subdev(struct xmgmt_mailbox *xmbx,
-				      u64 msgid, bool sw_ch, u64 offset, u64 size)
+/*
+ * PEER_DATA blobs are built by fill functions below. A fill function returns
+ * the whole vmalloc'ed blob in buf, responses are cut out of it. When it fails
+ * but still sets buf, the blob is used for this response, but not cached.
+ */
+typedef int (*xmgmt_mailbox_fill_t)(struct xmgmt_mailbox *xmbx, void **buf, size_t *len);
+
+static int xmgmt_mailbox_fill_subdev(struct xmgmt_mailbox *xmbx, void **buf, size_t *len)
 {
 	struct xrt_device *xdev = xmbx->xdev;
 	char *dtb = xmgmt_mailbox_user_dtb(xdev);
 	long dtbsz;
-	struct xcl_subdev *hdr;
-	u64 totalsz;
 
 	if (!dtb)
-		return;
+		return -ENOENT;
 
 	dtbsz = xrt_md_size(DEV(xdev), dtb);
-	totalsz = dtbsz + sizeof(*hdr) - sizeof(hdr->data);
-	if (offset != 0 || totalsz > size) {
-		/* Only support fetching dtb in one shot. */
-		vfree(dtb);
-		xrt_err(xdev, "need %lldB, user buffer size is %lldB, dropped", totalsz, size);
-		return;
-	}
-
-	hdr = vzalloc(totalsz);
-	if (!hdr) {
+	if (dtbsz <= 0) {
 		vfree(dtb);
-		return;
+		return -EINVAL;
 	}
 
-	hdr->ver = 1;
-	hdr->size = dtbsz;
-	hdr->rtncode = XRT_MSG_SUBDEV_RTN_COMPLETE;
-	memcpy(hdr->data, dtb, dtbsz);
-
-	xmgmt_mailbox_respond(xmbx, msgid, sw_ch, hdr, totalsz);
-
-	vfree(dtb);
-	vfree(hdr);
+	*buf = dtb;
+	*len = dtbsz;
+	return 0;
 }
 
-static void xmgmt_mailbox_resp_sensor(struct xmgmt_mailbox *xmbx,
-				      u64 msgid, bool sw_ch, u64 offset, u64 size)
+static int xmgmt_mailbox_fill_sensor(struct xmgmt_mailbox *xmbx, void **buf, size_t *len)
 {
 	struct xrt_device *xdev = xmbx->xdev;
-	struct xcl_sensor sensors = { 0 };
-	struct xrt_device *cmcxdev =
-		xleaf_get_leaf_by_id(xdev, XRT_SUBDEV_CMC, XRT_INVALID_DEVICE_INST);
-	int rc;
+	struct xcl_sensor *sensors = vzalloc(sizeof(*sensors));
+	struct xrt_device *cmcxdev;
+	int rc = -ENODEV;
+
+	if (!sensors)
+		return -ENOMEM;
 
+	cmcxdev = xleaf_get_leaf_by_id(xdev, XRT_SUBDEV_CMC, XRT_INVALID_DEVICE_INST);
 	if (cmcxdev) {
-		rc = xleaf_call(cmcxdev, XRT_CMC_READ_SENSORS, &sensors);
+		rc = xleaf_call(cmcxdev, XRT_CMC_READ_SENSORS, sensors);
 		xleaf_put_leaf(xdev, cmcxdev);
 		if (rc)
 			xrt_err(xdev, "can't read sensors: %d", rc);
 	}
 
-	xmgmt_mailbox_respond(xmbx, msgid, sw_ch, &sensors, min((u64)sizeof(sensors), size));
+	*buf = sensors;
+	*len = sizeof(*sensors);
+	return rc;
 }
 
 static int xmgmt_mailbox_get_freq(struct xmgmt_mailbox *xmbx,
@@ -465,33 +507,36 @@ static int xmgmt_mailbox_get_mig_calib(struct xmgmt_mailbox *xmbx, u64 *calib)
 	return rc;
 }
 
-static void xmgmt_mailbox_resp_icap(struct xmgmt_mailbox *xmbx,
-				    u64 msgid, bool sw_ch, u64 offset, u64 size)
+static int xmgmt_mailbox_fill_icap(struct xmgmt_mailbox *xmbx, void **buf, size_t *len)
 {
 	struct xrt_device *xdev = xmbx->xdev;
-	struct xcl_pr_region icap = { 0 };
+	struct xcl_pr_region *icap = vzalloc(sizeof(*icap));
+
+	if (!icap)
+		return -ENOMEM;
 
-	xmgmt_mailbox_get_freq(xmbx, CT_DATA, &icap.freq_data, &icap.freq_cntr_data);
-	xmgmt_mailbox_get_freq(xmbx, CT_KERNEL, &icap.freq_kernel, &icap.freq_cntr_kernel);
-	xmgmt_mailbox_get_freq(xmbx, CT_SYSTEM, &icap.freq_system, &icap.freq_cntr_system);
-	xmgmt_mailbox_get_icap_idcode(xmbx, &icap.idcode);
-	xmgmt_mailbox_get_mig_calib(xmbx, &icap.mig_calib);
-	WARN_ON(sizeof(icap.uuid) != sizeof(uuid_t));
-	xmgmt_get_provider_uuid(xdev, XMGMT_ULP, (uuid_t *)&icap.uuid);
+	xmgmt_mailbox_get_freq(xmbx, CT_DATA, &icap->freq_data, &icap->freq_cntr_data);
+	xmgmt_mailbox_get_freq(xmbx, CT_KERNEL, &icap->freq_kernel, &icap->freq_cntr_kernel);
+	xmgmt_mailbox_get_freq(xmbx, CT_SYSTEM, &icap->freq_system, &icap->freq_cntr_system);
+	xmgmt_mailbox_get_icap_idcode(xmbx, &icap->idcode);
+	xmgmt_mailbox_get_mig_calib(xmbx, &icap->mig_calib);
+	WARN_ON(sizeof(icap->uuid) != sizeof(uuid_t));
+	xmgmt_get_provider_uuid(xdev, XMGMT_ULP, (uuid_t *)&icap->uuid);
 
-	xmgmt_mailbox_respond(xmbx, msgid, sw_ch, &icap, min_t(u64, sizeof(icap), size));
+	*buf = icap;
+	*len = sizeof(*icap);
+	return 0;
 }
 
-static void xmgmt_mailbox_resp_bdinfo(struct xmgmt_mailbox *xmbx,
-				      u64 msgid, bool sw_ch, u64 offset, u64 size)
+static int xmgmt_mailbox_fill_bdinfo(struct xmgmt_mailbox *xmbx, void **buf, size_t *len)
 {
 	struct xrt_device *xdev = xmbx->xdev;
 	struct xcl_board_info *info = vzalloc(sizeof(*info));
 	struct xrt_device *cmcxdev;
-	int rc;
+	int rc = -ENODEV;
 
 	if (!info)
-		return;
+		return -ENOMEM;
 
 	cmcxdev = xleaf_get_leaf_by_id(xdev, XRT_SUBDEV_CMC, XRT_INVALID_DEVICE_INST);
 	if (cmcxdev) {
@@ -501,9 +546,71 @@ static void xmgmt_mailbox_resp_bdinfo(struct xmgmt_mailbox *xmbx,
 			xrt_err(xdev, "can't read board info: %d", rc);
 	}
 
-	xmgmt_mailbox_respond(xmbx, msgid, sw_ch, info, min((u64)sizeof(*info), size));
+	*buf = info;
+	*len = sizeof(*info);
+	return rc;
+}
+
+/*
+ * How long a cached PEER_DATA response stays valid, 0 means until it is
+ * invalidated by an event. Sensors are polled by user PF every second, the
+ * short TTL makes concurrent pollers share one read. The rest is only
+ * changed by subdev creation/removal, xclbin download or reset.
+ * Paged kinds honor offset in request, the rest always start from 0.
+ */
+static const struct xmgmt_mailbox_cache_kind {
+	u32 kind;
+	unsigned int ttl_ms;
+	bool paged;
+	xmgmt_mailbox_fill_t fill;
+} xmgmt_mailbox_cache_kinds[XMGMT_MBX_CACHE_KINDS] = {
+	{ XCL_SENSOR, 500, false, xmgmt_mailbox_fill_sensor },
+	{ XCL_ICAP, 1000, false, xmgmt_mailbox_fill_icap },
+	{ XCL_BDINFO, 0, false, xmgmt_mailbox_fill_bdinfo },
+	{ XCL_SUBDEV, 0, true, xmgmt_mailbox_fill_subdev },
+};
+
+static const struct xmgmt_mailbox_cache_kind *xmgmt_mailbox_cache_kind(u32 kind)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(xmgmt_mailbox_cache_kinds); i++) {
+		if (xmgmt_mailbox_cache_kinds[i].kind == kind)
+			return &xmgmt_mailbox_cache_kinds[i];
+	}
+	return NULL;
+}
+
+static void xmgmt_mailbox_cache_invalidate(struct xmgmt_mailbox *xmbx)
+{
+	atomic_inc(&xmbx->cache_gen);
+}
 
-	vfree(info);
+static bool xmgmt_mailbox_cache_fresh(struct xmgmt_mailbox *xmbx,
+				      const struct xmgmt_mailbox_cache_kind *ck,
+				      struct xmgmt_mailbox_cache_entry *e)
+{
+	if (!e->valid || e->gen != atomic_read(&xmbx->cache_gen))
+		return false;
+	return !ck->ttl_ms || time_before(jiffies, e->stamp + msecs_to_jiffies(ck->ttl_ms));
+}
+
+static void xmgmt_mailbox_cache_init(struct xmgmt_mailbox *xmbx)
+{
+	int i;
+
+	for (i = 0; i < XMGMT_MBX_CACHE_KINDS; i++)
+		mutex_init(&xmbx->cache[i].lock);
+}
+
+static void xmgmt_mailbox_cache_fini(struct xmgmt_mailbox *xmbx)
+{
+	int i;
+
+	for (i = 0; i < XMGMT_MBX_CACHE_KINDS; i++) {
+		vfree(xmbx->cache[i].data);
+		xmbx->cache[i].data = NULL;
+	}
 }
 
 static void xmgmt_mailbox_simple_respond(struct xmgmt_mailbox *xmbx, u64 msgid, bool sw_ch, int rc)
@@ -511,29 +618,130 @@ static void xmgmt_mailbox_simple_respond(struct xmgmt_mailbox *xmbx, u64 msgid,
 	xmgmt_mailbox_respond(xmbx, msgid, sw_ch, &rc, sizeof(rc));
 }
 
+/*
+ * Copy [offset, offset + size) of the blob into a new buffer for response.
+ * SUBDEV chunk is prefixed by struct xcl_subdev telling the whole blob size
+ * and checksum, so that peer can fetch the rest and notice the blob changing
+ * between chunks. A SUBDEV request out of the blob or with no room for data
+ * still gets the header, so that peer can retry with the right offset and
+ * size. Other kinds are always sent from offset 0 and -EINVAL is returned if
+ * there is nothing to send.
+ */
+static int xmgmt_mailbox_get_chunk(struct xmgmt_mailbox *xmbx,
+				   const struct xmgmt_mailbox_cache_kind *ck,
+				   struct xmgmt_mailbox_cache_entry *e,
+				   u64 offset, u64 size, void **resp, size_t *resplen)
+{
+	struct xcl_subdev *hdr = NULL;
+	size_t hdrsz = 0;
+	size_t cnt = 0;
+	char *buf;
+
+	if (ck->kind == XCL_SUBDEV)
+		hdrsz = sizeof(*hdr) - sizeof(hdr->data);
+	if (!ck->paged)
+		offset = 0;
+	if (offset < e->len && size > hdrsz)
+		cnt = min_t(u64, size - hdrsz, e->len - offset);
+	else
+		xrt_warn(xmbx->xdev, "%s chunk %lldB@%lld is out of %zuB blob",
+			 mailbox_group_kind2name(ck->kind), size, offset, e->len);
+	if (!hdrsz && !cnt)
+		return -EINVAL;
+
+	buf = vzalloc(hdrsz + cnt);
+	if (!buf)
+		return -ENOMEM;
+	if (hdrsz) {
+		hdr = (struct xcl_subdev *)buf;
+		hdr->ver = 1;
+		hdr->size = e->len;
+		hdr->offset = offset;
+		hdr->checksum = e->csum;
+		if (cnt && offset + cnt == e->len)
+			hdr->rtncode = XRT_MSG_SUBDEV_RTN_COMPLETE;
+		else
+			hdr->rtncode = XRT_MSG_SUBDEV_RTN_PARTIAL;
+	}
+	memcpy(buf + hdrsz, e->data + offset, cnt);
+
+	*resp = buf;
+	*resplen = hdrsz + cnt;
+	return 0;
+}
+
+/*
+ * Respond to PEER_DATA from cached blob, read from backend only when cached one
+ * is stale. Identical requests arriving during a backend read wait on the entry
+ * lock and are answered by that one read.
+ */
+static void xmgmt_mailbox_resp_cached(struct xmgmt_mailbox *xmbx,
+				      const struct xmgmt_mailbox_cache_kind *ck,
+				      u64 msgid, bool sw_ch, u64 offset, u64 size)
+{
+	struct xmgmt_mailbox_cache_entry *e = &xmbx->cache[ck - xmgmt_mailbox_cache_kinds];
+	void *buf = NULL, *resp = NULL;
+	size_t len = 0, resplen = 0;
+	u64 fills;
+	u32 gen;
+	int rc;
+
+	/* Changed fill count once we get the lock means someone read for us. */
+	fills = READ_ONCE(e->fills);
+	mutex_lock(&e->lock);
+	if (xmgmt_mailbox_cache_fresh(xmbx, ck, e)) {
+		if (e->fills != fills)
+			atomic64_inc(&xmbx->cache_coalesced);
+		else
+			atomic64_inc(&xmbx->cache_hits);
+	} else {
+		atomic64_inc(&xmbx->cache_misses);
+		/* Invalidation during the read makes the result stale right away. */
+		gen = atomic_read(&xmbx->cache_gen);
+		rc = ck->fill(xmbx, &buf, &len);
+		if (!buf) {
+			mutex_unlock(&e->lock);
+			return;
+		}
+		vfree(e->data);
+		e->data = buf;
+		e->len = len;
+		e->csum = ck->paged ? crc32c_le(~0, buf, len) : 0;
+		e->valid = !rc;
+		e->gen = gen;
+		e->stamp = jiffies;
+		e->fills++;
+	}
+	rc = xmgmt_mailbox_get_chunk(xmbx, ck, e, offset, size, &resp, &resplen);
+	mutex_unlock(&e->lock);
+
+	/* Blob may change once unlocked, chunk is copied out for response. */
+	if (rc == -EINVAL) {
+		xmgmt_mailbox_simple_respond(xmbx, msgid, sw_ch, rc);
+	} else if (!rc) {
+		xmgmt_mailbox_respond(xmbx, msgid, sw_ch, resp, resplen);
+		vfree(resp);
+	}
+}
+
 static void xmgmt_mailbox_resp_peer_data(struct xmgmt_mailbox *xmbx, struct xcl_mailbox_req *req,
 					 size_t len, u64 msgid, bool sw_ch)
 {
 	struct xcl_mailbox_peer_data *pdata = (struct xcl_mailbox_peer_data *)req->data;
+	const struct xmgmt_mailbox_cache_kind *ck;
 
 	if (len < (sizeof(*req) + sizeof(*pdata) - 1)) {
 		xrt_err(xmbx->xdev, "received corrupted %s, dropped", mailbox_req2name(req->req));
 		return;
 	}
 
+	ck = xmgmt_mailbox_cache_kind(pdata->kind);
+	if (ck) {
+		xmgmt_mailbox_resp_cached(xmbx, ck, msgid, sw_ch, pdata->offset, pdata->size);
+		return;
+	}
+
 	switch (pdata->kind) {
-	case XCL_SENSOR:
-		xmgmt_mailbox_resp_sensor(xmbx, msgid, sw_ch, pdata->offset, pdata->size);
-		break;
-	case XCL_ICAP:
-		xmgmt_mailbox_resp_icap(xmbx, msgid, sw_ch, pdata->offset, pdata->size);
-		break;
-	case XCL_BDINFO:
-		xmgmt_mailbox_resp_bdinfo(xmbx, msgid, sw_ch, pdata->offset, pdata->size);
-		break;
-	case XCL_SUBDEV:
-		xmgmt_mailbox_resp_subdev(xmbx, msgid, sw_ch, pdata->offset, pdata->size);
-		break;
 	case XCL_MIG_ECC:
 	case XCL_FIREWALL:
 	case XCL_DNA:
@@ -568,16 +776,27 @@ static bool xmgmt_mailbox_is_same_domain(struct xmgmt_mailbox *xmbx,
 	return true;
 }
 
+/* Old peer does not send caps, which means none. */
+static u32 xmgmt_mailbox_peer_caps(struct xcl_mailbox_conn *conn, size_t conn_len)
+{
+	if (conn_len < offsetofend(struct xcl_mailbox_conn, caps))
+		return 0;
+	return conn->caps;
+}
+
 static void xmgmt_mailbox_resp_user_probe(struct xmgmt_mailbox *xmbx, struct xcl_mailbox_req *req,
 					  size_t len, u64 msgid, bool sw_ch)
 {
 	struct xcl_mailbox_conn_resp *resp = vzalloc(sizeof(*resp));
 	struct xcl_mailbox_conn *conn = (struct xcl_mailbox_conn *)req->data;
+	size_t conn_len = len - offsetof(struct xcl_mailbox_req, data);
+	u32 caps = 0;
 
 	if (!resp)
 		return;
 
-	if (len < (sizeof(*req) + sizeof(*conn) - 1)) {
+	if (len < offsetof(struct xcl_mailbox_req, data) ||
+	    conn_len < offsetofend(struct xcl_mailbox_conn, version)) {
 		xrt_err(xmbx->xdev, "received corrupted %s, dropped", mailbox_req2name(req->req));
 		vfree(resp);
 		return;
@@ -589,8 +808,31 @@ static void xmgmt_mailbox_resp_user_probe(struct xmgmt_mailbox *xmbx, struct xcl
 		resp->conn_flags |= XCL_MB_PEER_SAME_DOMAIN;
 	}
 
+	/*
+	 * Peer probing again may be a new or older driver knowing nothing of what
+	 * was agreed before. Response goes out in old format, new caps apply to
+	 * what follows.
+	 */
+	mutex_lock(&xmbx->lock);
+	xmbx->peer_caps = 0;
+	if (xmbx->mailbox) {
+		xleaf_call(xmbx->mailbox, XRT_MAILBOX_SET_CAPS, &xmbx->peer_caps);
+		xleaf_call(xmbx->mailbox, XRT_MAILBOX_GET_CAPS, &caps);
+	}
+	mutex_unlock(&xmbx->lock);
+	caps |= XMGMT_MAILBOX_CAPS;
+	caps &= xmgmt_mailbox_peer_caps(conn, conn_len);
+	resp->caps = caps;
+
 	xmgmt_mailbox_respond(xmbx, msgid, sw_ch, resp, sizeof(*resp));
 	vfree(resp);
+
+	mutex_lock(&xmbx->lock);
+	xmbx->peer_caps = caps;
+	if (xmbx->mailbox)
+		xleaf_call(xmbx->mailbox, XRT_MAILBOX_SET_CAPS, &caps);
+	mutex_unlock(&xmbx->lock);
+	xrt_info(xmbx->xdev, "peer caps 0x%x", caps);
 }
 
 static void xmgmt_mailbox_resp_hot_reset(struct xmgmt_mailbox *xmbx, struct xcl_mailbox_req *req,
@@ -602,6 +844,7 @@ static void xmgmt_mailbox_resp_hot_reset(struct xmgmt_mailbox *xmbx, struct xcl_
 	xmgmt_mailbox_simple_respond(xmbx, msgid, sw_ch, 0);
 
 	ret = xmgmt_hot_reset(xdev);
+	xmgmt_mailbox_cache_invalidate(xmbx);
 	if (ret)
 		xrt_err(xdev, "failed to hot reset: %d", ret);
 	else
@@ -619,6 +862,265 @@ static void xmgmt_mailbox_resp_load_xclbin(struct xmgmt_mailbox *xmbx, struct xc
 	xmgmt_mailbox_simple_respond(xmbx, msgid, sw_ch, ret);
 }
 
+static void xmgmt_mailbox_resp_reclock(struct xmgmt_mailbox *xmbx, struct xcl_mailbox_req *req,
+				       size_t len, u64 msgid, bool sw_ch)
+{
+	struct xcl_mailbox_clock_freqscaling *fs =
+		(struct xcl_mailbox_clock_freqscaling *)req->data;
+	struct xcl_mailbox_clock_freqscaling_resp resp = { 0 };
+	struct xrt_device *xdev = xmbx->xdev;
+	bool freqs;
+	int i;
+
+	if (len < offsetof(struct xcl_mailbox_req, data) + sizeof(*fs)) {
+		xrt_err(xdev, "received corrupted %s, dropped", mailbox_req2name(req->req));
+		return;
+	}
+
+	for (i = XMGMT_RECLOCK_NUM; i < ARRAY_SIZE(fs->target_freqs); i++) {
+		if (fs->target_freqs[i])
+			resp.ret = -EINVAL;
+	}
+	if (fs->region || resp.ret) {
+		xrt_err(xdev, "invalid clock in region %d", fs->region);
+		resp.ret = -EINVAL;
+	} else {
+		resp.ret = xmgmt_reclock(xdev, fs->target_freqs, resp.freqs);
+	}
+
+	mutex_lock(&xmbx->lock);
+	freqs = xmbx->peer_caps & XCL_MB_CAP_RECLOCK_FREQS;
+	mutex_unlock(&xmbx->lock);
+	if (freqs)
+		xmgmt_mailbox_respond(xmbx, msgid, sw_ch, &resp, sizeof(resp));
+	else
+		xmgmt_mailbox_simple_respond(xmbx, msgid, sw_ch, resp.ret);
+}
+
+/* Xclbin small enough to be buffered by mailbox comes in one piece. */
+static void xmgmt_mailbox_resp_load_xclbin_payload(struct xmgmt_mailbox *xmbx,
+						   struct xcl_mailbox_req *req,
+						   size_t len, u64 msgid, bool sw_ch)
+{
+	const struct axlf *axlf = (const struct axlf *)req->data;
+	size_t hdrsz = offsetof(struct xcl_mailbox_req, data);
+	int ret = -EINVAL;
+
+	if (len >= hdrsz + sizeof(*axlf) && axlf->header.length == len - hdrsz &&
+	    !xmgmt_check_xclbin_header(axlf))
+		ret = bitstream_axlf_mailbox(xmbx->xdev, axlf);
+	else
+		xrt_err(xmbx->xdev, "received corrupted %s, dropped", mailbox_req2name(req->req));
+
+	xmgmt_mailbox_simple_respond(xmbx, msgid, sw_ch, ret);
+}
+
+static void xmgmt_mailbox_xclbin_free(struct xmgmt_mailbox_xclbin *x)
+{
+	if (!x)
+		return;
+	vfree(x->axlf);
+	kfree(x);
+}
+
+/* First chunk of a streamed request, only LOAD_XCLBIN is taken this way. */
+static int xmgmt_mailbox_xclbin_begin(struct xmgmt_mailbox *xmbx, struct xrt_mailbox_stream *st)
+{
+	size_t hdrsz = offsetof(struct xcl_mailbox_req, data);
+	struct xcl_mailbox_req *req = st->xmis_data;
+	const struct axlf *axlf = (const struct axlf *)req->data;
+	struct xrt_device *xdev = xmbx->xdev;
+	struct xmgmt_mailbox_xclbin *x;
+	int rc = 0;
+
+	if (st->xmis_len < hdrsz + sizeof(*axlf)) {
+		xrt_err(xdev, "received corrupted streamed request, dropped");
+		return -EINVAL;
+	}
+
+	XMGMT_MAILBOX_PRT_REQ_RECV(xmbx, req, st->xmis_sw_ch);
+	if (req->req != XCL_MAILBOX_REQ_LOAD_XCLBIN) {
+		xrt_err(xdev, "%s of %zuB not handled", mailbox_req2name(req->req),
+			st->xmis_total);
+		return -EOPNOTSUPP;
+	}
+	if (xmgmt_check_xclbin_header(axlf) || axlf->header.length != st->xmis_total - hdrsz) {
+		xrt_err(xdev, "invalid xclbin header, dropped");
+		return -EINVAL;
+	}
+
+	x = kzalloc(sizeof(*x), GFP_KERNEL);
+	if (!x)
+		return -ENOMEM;
+	x->axlf = vmalloc(axlf->header.length);
+	if (!x->axlf) {
+		kfree(x);
+		return -ENOMEM;
+	}
+	x->req_id = st->xmis_req_id;
+	x->len = axlf->header.length;
+
+	mutex_lock(&xmbx->lock);
+	if (xmbx->xclbin)
+		rc = -EBUSY;
+	else
+		xmbx->xclbin = x;
+	mutex_unlock(&xmbx->lock);
+
+	if (rc) {
+		xrt_err(xdev, "another xclbin is being received, dropped");
+		xmgmt_mailbox_xclbin_free(x);
+	}
+	return rc;
+}
+
+/*
+ * Check xclbin as far as it has arrived, so that a bad one is rejected before
+ * all of it is received. Section table is checked once it is in, and so is
+ * bitstream header.
+ */
+static int xmgmt_mailbox_xclbin_check(struct xmgmt_mailbox *xmbx, struct xmgmt_mailbox_xclbin *x)
+{
+	const struct axlf_section_header *sect;
+	struct xclbin_bit_head_info bit = { 0 };
+	struct xrt_device *xdev = xmbx->xdev;
+	const struct axlf *axlf = x->axlf;
+	u32 num = axlf->header.num_sections;
+	size_t end;
+	u32 i;
+
+	if (!x->bit_size) {
+		end = offsetof(struct axlf, sections) + (size_t)num * sizeof(*sect);
+		if (!num || end > x->len) {
+			xrt_err(xdev, "invalid xclbin section number %d", num);
+			return -EINVAL;
+		}
+		if (x->done < end)
+			return 0;
+
+		for (i = 0; i < num; i++) {
+			sect = &axlf->sections[i];
+			if (sect->section_offset > x->len ||
+			    sect->section_size > x->len - sect->section_offset) {
+				xrt_err(xdev, "xclbin section %d is out of range", i);
+				return -EINVAL;
+			}
+			if (sect->section_kind == BITSTREAM && !x->bit_size) {
+				x->bit_off = sect->section_offset;
+				x->bit_size = sect->section_size;
+			}
+		}
+		if (!x->bit_size) {
+			xrt_err(xdev, "bitstream not found");
+			return -ENOENT;
+		}
+	}
+
+	if (x->bit_checked)
+		return 0;
+	end = x->bit_off + min_t(u64, x->bit_size, XCLBIN_HWICAP_BITFILE_BUF_SZ);
+	if (x->done < end)
+		return 0;
+	if (xrt_xclbin_parse_bitstream_header(DEV(xdev), (const unchar *)axlf + x->bit_off,
+					      end - x->bit_off, &bit) ||
+	    (u64)bit.header_length + bit.bitstream_length > x->bit_size) {
+		xrt_err(xdev, "invalid bitstream header");
+		return -EINVAL;
+	}
+	x->bit_checked = true;
+	return 0;
+}
+
+static int xmgmt_mailbox_xclbin_recv(struct xmgmt_mailbox *xmbx, struct xmgmt_mailbox_xclbin *x,
+				     struct xrt_mailbox_stream *st)
+{
+	size_t hdrsz = offsetof(struct xcl_mailbox_req, data);
+	const char *data = st->xmis_data;
+	size_t off = st->xmis_offset;
+	size_t len = st->xmis_len;
+
+	/* Mailbox request header is in front of xclbin. */
+	if (off < hdrsz) {
+		size_t skip = min(len, hdrsz - off);
+
+		data += skip;
+		len -= skip;
+		off += skip;
+	}
+	off -= hdrsz;
+	if (off != x->done || len > x->len - x->done)
+		return -EBADMSG;
+
+	memcpy((char *)x->axlf + off, data, len);
+	x->done += len;
+	return xmgmt_mailbox_xclbin_check(xmbx, x);
+}
+
+/*
+ * LOAD_XCLBIN does not fit in mailbox buffer, it is streamed in and assembled
+ * in the buffer it is downloaded from. Only checking the image overlaps with
+ * receiving it, ICAP download starts once the whole image is in, since it goes
+ * thru fpga_mgr which takes a whole image. Peer gets the result once the last
+ * chunk is in, or right away once it has failed. In the latter case, the rest
+ * of the stream is dropped by mailbox and the last call is not answered again.
+ */
+static int xmgmt_mailbox_stream(void *arg, struct xrt_mailbox_stream *st)
+{
+	struct xmgmt_mailbox *xmbx = (struct xmgmt_mailbox *)arg;
+	struct xmgmt_mailbox_xclbin *x = NULL;
+	bool answered = false;
+	int rc = st->xmis_err;
+
+	if (!rc && st->xmis_offset == 0)
+		rc = xmgmt_mailbox_xclbin_begin(xmbx, st);
+
+	mutex_lock(&xmbx->lock);
+	if (xmbx->xclbin && xmbx->xclbin->req_id == st->xmis_req_id)
+		x = xmbx->xclbin;
+	if (st->xmis_last && xmbx->stream_failed && xmbx->stream_failed_id == st->xmis_req_id) {
+		xmbx->stream_failed = false;
+		answered = true;
+	}
+	mutex_unlock(&xmbx->lock);
+
+	if (answered)
+		return rc;
+
+	if (!rc && !x)
+		rc = -EINVAL;
+	if (!rc)
+		rc = xmgmt_mailbox_xclbin_recv(xmbx, x, st);
+	if (!rc && !st->xmis_last)
+		return 0;
+
+	if (!rc && x->done != x->len)
+		rc = -EBADMSG;
+
+	/* Done with this stream one way or the other, buffer goes away. */
+	mutex_lock(&xmbx->lock);
+	if (x && xmbx->xclbin == x)
+		xmbx->xclbin = NULL;
+	else
+		x = NULL;
+	if (rc && !st->xmis_last) {
+		xmbx->stream_failed = true;
+		xmbx->stream_failed_id = st->xmis_req_id;
+	}
+	mutex_unlock(&xmbx->lock);
+
+	if (!rc) {
+		/* Buffer is taken over by download. */
+		rc = bitstream_axlf_mailbox_buf(xmbx->xdev, x->axlf);
+		x->axlf = NULL;
+	}
+	xmgmt_mailbox_xclbin_free(x);
+
+	if (rc)
+		xrt_err(xmbx->xdev, "failed to load streamed xclbin: %d", rc);
+	xmgmt_mailbox_simple_respond(xmbx, st->xmis_req_id, st->xmis_sw_ch, rc);
+	return rc;
+}
+
 static void xmgmt_mailbox_listener(void *arg, void *data, size_t len,
 				   u64 msgid, int err, bool sw_ch)
 {
@@ -660,15 +1162,46 @@ static void xmgmt_mailbox_listener(void *arg, void *data, size_t len,
 				mailbox_req2name(req->req));
 		}
 		break;
+	case XCL_MAILBOX_REQ_LOAD_XCLBIN:
+		xmgmt_mailbox_resp_load_xclbin_payload(xmbx, req, len, msgid, sw_ch);
+		break;
+	case XCL_MAILBOX_REQ_RECLOCK:
+		xmgmt_mailbox_resp_reclock(xmbx, req, len, msgid, sw_ch);
+		break;
 	default:
 		xrt_err(xdev, "%s(%d) request not handled", mailbox_req2name(req->req), req->req);
 		break;
 	}
 }
 
+/*
+ * Read-only queries can be handled concurrently. Their handlers only touch
+ * xmbx state under xmbx->lock and respond thru xmgmt_mailbox_respond(), so
+ * xmgmt_mailbox_listener() is re-entrant for them. Anything changing device
+ * or peer state is handled serially.
+ */
+static bool xmgmt_mailbox_concurrent(void *arg, void *data, size_t len)
+{
+	struct xcl_mailbox_req *req = (struct xcl_mailbox_req *)data;
+
+	if (len < sizeof(*req))
+		return false;
+
+	switch (req->req) {
+	case XCL_MAILBOX_REQ_TEST_READ:
+	case XCL_MAILBOX_REQ_PEER_DATA:
+	case XCL_MAILBOX_REQ_READ_P2P_BAR_ADDR:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static void xmgmt_mailbox_reg_listener(struct xmgmt_mailbox *xmbx)
 {
-	struct xrt_mailbox_listen listen = { xmgmt_mailbox_listener, xmbx };
+	struct xrt_mailbox_listen listen = {
+		xmgmt_mailbox_listener, xmbx, xmgmt_mailbox_concurrent, xmgmt_mailbox_stream
+	};
 
 	WARN_ON(!mutex_is_locked(&xmbx->lock));
 	if (!xmbx->mailbox)
@@ -683,6 +1216,10 @@ static void xmgmt_mailbox_unreg_listener(struct xmgmt_mailbox *xmbx)
 	WARN_ON(!mutex_is_locked(&xmbx->lock));
 	WARN_ON(!xmbx->mailbox);
 	xleaf_call(xmbx->mailbox, XRT_MAILBOX_LISTEN, &listen);
+
+	/* Stream cut off by listener going away won't get its last call. */
+	xmgmt_mailbox_xclbin_free(xmbx->xclbin);
+	xmbx->xclbin = NULL;
 }
 
 void xmgmt_mailbox_event_cb(struct xrt_device *xdev, void *arg)
@@ -692,6 +1229,10 @@ void xmgmt_mailbox_event_cb(struct xrt_device *xdev, void *arg)
 	enum xrt_events e = evt->xe_evt;
 	enum xrt_subdev_id id = evt->xe_subdev.xevt_subdev_id;
 
+	/* Peer data is read from leaves, any of them coming or going changes it. */
+	if (e == XRT_EVENT_POST_CREATION || e == XRT_EVENT_PRE_REMOVAL)
+		xmgmt_mailbox_cache_invalidate(xmbx);
+
 	if (id != XRT_SUBDEV_MAILBOX)
 		return;
 
@@ -840,8 +1381,20 @@ static ssize_t peer_msg_store(struct device *dev,
 /* Message test i/f. */
 static DEVICE_ATTR_RW(peer_msg);
 
+static ssize_t peer_data_cache_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct xrt_device *xdev = to_xrt_dev(dev);
+	struct xmgmt_mailbox *xmbx = xdev2mbx(xdev);
+
+	return sprintf(buf, "hits %lld misses %lld coalesced %lld\n",
+		       atomic64_read(&xmbx->cache_hits), atomic64_read(&xmbx->cache_misses),
+		       atomic64_read(&xmbx->cache_coalesced));
+}
+static DEVICE_ATTR_RO(peer_data_cache);
+
 static struct attribute *xmgmt_mailbox_attrs[] = {
 	&dev_attr_peer_msg.attr,
+	&dev_attr_peer_data_cache.attr,
 	NULL,
 };
 
@@ -859,6 +1412,7 @@ void *xmgmt_mailbox_probe(struct xrt_device *xdev)
 		return NULL;
 	xmbx->xdev = xdev;
 	mutex_init(&xmbx->lock);
+	xmgmt_mailbox_cache_init(xmbx);
 
 	ret = sysfs_create_group(&DEV(xdev)->kobj, &xmgmt_mailbox_attrgroup);
 	if (ret) {
@@ -879,6 +1433,16 @@ void xmgmt_mailbox_remove(void *handle)
 		xleaf_put_leaf(xdev, xmbx->mailbox);
 	if (xmbx->test_msg)
 		vfree(xmbx->test_msg);
+	xmgmt_mailbox_xclbin_free(xmbx->xclbin);
+	xmgmt_mailbox_cache_fini(xmbx);
+}
+
+void xmgmt_mailbox_peer_data_changed(void *handle)
+{
+	struct xmgmt_mailbox *xmbx = (struct xmgmt_mailbox *)handle;
+
+	if (xmbx)
+		xmgmt_mailbox_cache_invalidate(xmbx);
 }
 
 void xmgmt_peer_notify_state(void *handle, bool online)
@@ -897,5 +1461,8 @@ void xmgmt_peer_notify_state(void *handle, bool online)
 	st->state_flags = online ? XCL_MB_STATE_ONLINE : XCL_MB_STATE_OFFLINE;
 	mutex_lock(&xmbx->lock);
 	xmgmt_mailbox_notify(xmbx, false, req, reqlen);
+	/* Peer won't talk to us once it knows we are gone, fail what's in flight. */
+	if (!online && xmbx->mailbox)
+		xleaf_call(xmbx->mailbox, XRT_MAILBOX_PEER_DOWN, NULL);
 	mutex_unlock(&xmbx->lock);
 }
@@ -22,6 +22,7 @@
 #include "xrt-mgr.h"
 #include "xleaf/icap.h"
 #include "xleaf/axigate.h"
+#include "xleaf/clock.h"
 #include "xleaf/pcie-firewall.h"
 #include "xmgmt.h"
 
@@ -712,6 +713,8 @@ static int xmgmt_bitstream_axlf_fpga_mgr(struct xmgmt_main *xmm, void *axlf, siz
 	ret = xmgmt_process_xclbin(xmm->xdev, xmm->fmgr, axlf, XMGMT_ULP);
 	if (ret == 0)
 		xmm->firmware_ulp = axlf;
+	/* ULP uuid, clocks and calibration may all have changed. */
+	xmgmt_mailbox_peer_data_changed(xmm->mailbox_hdl);
 
 	return ret;
 }
@@ -743,6 +746,114 @@ int bitstream_axlf_mailbox(struct xrt_device *xdev, const void *axlf)
 	return ret;
 }
 
+/*
+ * Same as bitstream_axlf_mailbox(), but takes over the vmalloc'ed xclbin
+ * instead of copying it. The xclbin is freed on failure.
+ */
+int bitstream_axlf_mailbox_buf(struct xrt_device *xdev, void *axlf)
+{
+	struct xmgmt_main *xmm = xrt_get_drvdata(xdev);
+	const struct axlf *xclbin_obj = axlf;
+	int ret;
+
+	mutex_lock(&xmm->lock);
+	ret = xmgmt_bitstream_axlf_fpga_mgr(xmm, axlf, xclbin_obj->header.length);
+	mutex_unlock(&xmm->lock);
+	if (ret)
+		vfree(axlf);
+	return ret;
+}
+
+/*
+ * Set ULP clocks as requested by peer, 0 in freqs[] leaves the clock alone.
+ * All clocks are changed within one freeze of ULP gate, then verified against
+ * clock counters. Measured freqs in kHz are returned in measured[].
+ */
+int xmgmt_reclock(struct xrt_device *xdev, const u16 *freqs, u32 *measured)
+{
+	struct xrt_device *clks[XMGMT_RECLOCK_NUM] = { NULL };
+	struct xmgmt_main *xmm = xrt_get_drvdata(xdev);
+	struct xrt_clock_get get = { 0 };
+	struct xrt_device *gate;
+	const char *ep_name;
+	int ret = 0;
+	int rc;
+	int i;
+
+	mutex_lock(&xmm->lock);
+
+	/* Find all clocks before touching any of them. */
+	for (i = 0; i < XMGMT_RECLOCK_NUM; i++) {
+		if (!freqs[i])
+			continue;
+		ep_name = xrt_clock_type2epname(CT_DATA + i);
+		clks[i] = ep_name ? xleaf_get_leaf_by_epname(xdev, ep_name) : NULL;
+		if (!clks[i]) {
+			xrt_err(xdev, "clock %d is not available", CT_DATA + i);
+			ret = -ENOENT;
+			goto done;
+		}
+	}
+
+	gate = xleaf_get_leaf_by_epname(xdev, XRT_MD_NODE_GATE_ULP);
+	if (!gate) {
+		xrt_err(xdev, "can't find ULP gate");
+		ret = -ENOENT;
+		goto done;
+	}
+
+	ret = xleaf_call(gate, XRT_AXIGATE_CLOSE, NULL);
+	for (i = 0; !ret && i < XMGMT_RECLOCK_NUM; i++) {
+		if (clks[i])
+			ret = xleaf_call(clks[i], XRT_CLOCK_SET, (void *)(uintptr_t)freqs[i]);
+	}
+	/* Never leave ULP frozen. */
+	rc = xleaf_call(gate, XRT_AXIGATE_OPEN, NULL);
+	xleaf_put_leaf(xdev, gate);
+	if (!ret)
+		ret = rc;
+	if (ret) {
+		xrt_err(xdev, "failed to set clocks: %d", ret);
+		goto done;
+	}
+
+	for (i = 0; i < XMGMT_RECLOCK_NUM; i++) {
+		if (!clks[i])
+			continue;
+		ret = xleaf_call(clks[i], XRT_CLOCK_VERIFY, NULL);
+		if (!ret)
+			ret = xleaf_call(clks[i], XRT_CLOCK_GET, &get);
+		if (ret) {
+			xrt_err(xdev, "failed to verify clock %d: %d", CT_DATA + i, ret);
+			break;
+		}
+		measured[i] = get.freq_cnter;
+	}
+
+done:
+	for (i = 0; i < XMGMT_RECLOCK_NUM; i++) {
+		if (clks[i])
+			xleaf_put_leaf(xdev, clks[i]);
+	}
+	mutex_unlock(&xmm->lock);
+
+	/* Clock freqs are part of ICAP peer data. */
+	xmgmt_mailbox_peer_data_changed(xmm->mailbox_hdl);
+	return ret;
+}
+
+/* Sanity check of xclbin header before the rest of it is looked at. */
+int xmgmt_check_xclbin_header(const struct axlf *xclbin)
+{
+	if (memcmp(xclbin->magic, XCLBIN_VERSION2, sizeof(XCLBIN_VERSION2)))
+		return -EINVAL;
+	if (xclbin->header.length > XCLBIN_MAX_SIZE || xclbin->header.length < sizeof(*xclbin))
+		return -EINVAL;
+	if (xclbin->header.version_major != XMGMT_SUPP_XCLBIN_MAJOR)
+		return -EINVAL;
+	return 0;
+}
+
 static int bitstream_axlf_ioctl(struct xmgmt_main *xmm, const void __user *arg)
 {
 	struct xmgmt_ioc_bitstream_axlf ioc_obj = { 0 };
@@ -757,14 +868,10 @@ static int bitstream_axlf_ioctl(struct xmgmt_main *xmm, const void __user *arg)
 	xclbin = (const void __user *)ioc_obj.xclbin;
 	if (copy_from_user((void *)&xclbin_obj, xclbin, sizeof(xclbin_obj)))
 		return -EFAULT;
-	if (memcmp(xclbin_obj.magic, XCLBIN_VERSION2, sizeof(XCLBIN_VERSION2)))
+	if (xmgmt_check_xclbin_header(&xclbin_obj))
 		return -EINVAL;
 
 	copy_buffer_size = xclbin_obj.header.length;
-	if (copy_buffer_size > XCLBIN_MAX_SIZE || copy_buffer_size < sizeof(xclbin_obj))
-		return -EINVAL;
-	if (xclbin_obj.header.version_major != XMGMT_SUPP_XCLBIN_MAJOR)
-		return -EINVAL;
 
 	copy_buffer = vmalloc(copy_buffer_size);
 	if (!copy_buffer)
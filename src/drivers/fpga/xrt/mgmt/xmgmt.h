@@ -20,8 +20,14 @@ int xmgmt_process_xclbin(struct xrt_device *xdev,
 void xmgmt_region_cleanup_all(struct xrt_device *xdev);
 
 int bitstream_axlf_mailbox(struct xrt_device *xdev, const void *xclbin);
+int bitstream_axlf_mailbox_buf(struct xrt_device *xdev, void *xclbin);
+int xmgmt_check_xclbin_header(const struct axlf *xclbin);
 int xmgmt_hot_reset(struct xrt_device *xdev);
 
+/* Data, kernel and system clock of ULP. */
+#define XMGMT_RECLOCK_NUM	(CT_SYSTEM - CT_DATA + 1)
+int xmgmt_reclock(struct xrt_device *xdev, const u16 *freqs, u32 *measured);
+
 /* Getting dtb for specified group. Caller should vfree returned dtb. */
 char *xmgmt_get_dtb(struct xrt_device *xdev, enum provider_kind kind);
 char *xmgmt_get_vbnv(struct xrt_device *xdev);
@@ -32,6 +38,7 @@ void *xmgmt_xdev2mailbox(struct xrt_device *xdev);
 void *xmgmt_mailbox_probe(struct xrt_device *xdev);
 void xmgmt_mailbox_remove(void *handle);
 void xmgmt_peer_notify_state(void *handle, bool online);
+void xmgmt_mailbox_peer_data_changed(void *handle);
 void xmgmt_mailbox_event_cb(struct xrt_device *xdev, void *arg);
 
 int xmgmt_register_leaf(void);
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ *  Copyright (C) 2021, Xilinx Inc
+ *
+ */
+
+/**
+ * DOC: Background flash update thru flash device node
+ * Besides write(), an image can be programmed to flash by a job running in
+ * the background. Job is submitted by XRT_FLASH_IOC_UPDATE and programs the
+ * image one erase block at a time, reading back each block to verify it.
+ * Only one job runs at a time. Its progress can be polled on the device node
+ * (POLLIN when there is progress since last XRT_FLASH_IOC_STATUS on the same
+ * open file) or read from sysfs node update_status, which does not affect
+ * POLLIN. write() fails with EBUSY while it runs. Submitting or cancelling a
+ * job needs the device node opened for write, otherwise EBADF is returned.
+ *
+ * =========== ============================== ==================================
+ * Functionality           ioctl request code           data format
+ * =========== ============================== ==================================
+ * 1 Submit update job     XRT_FLASH_IOC_UPDATE       xrt_flash_ioc_update
+ * 2 Get job progress      XRT_FLASH_IOC_STATUS       xrt_flash_ioc_status
+ * 3 Cancel job            XRT_FLASH_IOC_CANCEL       job ID as arg
+ * =========== ============================== ==================================
+ */
+
+#ifndef _XRT_FLASH_IOCTL_H_
+#define _XRT_FLASH_IOCTL_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define XRT_FLASH_IOC_MAGIC	'F'
+
+/* Job states. */
+#define XRT_FLASH_JOB_NONE	0
+#define XRT_FLASH_JOB_RUNNING	1
+#define XRT_FLASH_JOB_DONE	2
+#define XRT_FLASH_JOB_FAILED	3
+#define XRT_FLASH_JOB_CANCELLED	4
+
+/*
+ * Image is made of two halves of the same size, first one goes to flash 0
+ * and second one to flash 1, both at flash_offset. Both flashes are erased
+ * and programmed at the same time.
+ */
+#define XRT_FLASH_UPDATE_DUAL	0x1
+
+/**
+ * struct xrt_flash_ioc_update - submit a background flash update
+ * used with XRT_FLASH_IOC_UPDATE ioctl
+ *
+ * @buf:	Pointer to image in user memory, used when @fd is negative
+ * @fd:		File to read image from, or -1
+ * @flags:	XRT_FLASH_UPDATE_* or 0
+ * @size:	Size of image in bytes
+ * @src_offset:	Offset of image in @fd
+ * @flash_offset: Offset on flash to program image to
+ * @job_id:	ID of the job on return, never 0
+ * @padding:	Must be 0
+ *
+ * Image in user memory is copied in when job is submitted, image in a file
+ * is read by the job as it goes.
+ */
+struct xrt_flash_ioc_update {
+	__u64 buf;
+	__s32 fd;
+	__u32 flags;
+	__u64 size;
+	__u64 src_offset;
+	__u64 flash_offset;
+	__u32 job_id;
+	__u32 padding;
+};
+
+/**
+ * struct xrt_flash_ioc_status - progress of a background flash update
+ * used with XRT_FLASH_IOC_STATUS ioctl
+ *
+ * @job_id:	ID of the job to query, or 0 for the last one submitted
+ * @state:	XRT_FLASH_JOB_* on return
+ * @error:	0 or -errno the job has failed with
+ * @padding:	Must be 0
+ * @total:	Size of image in bytes
+ * @done:	Bytes of image handled so far
+ * @erased:	Bytes erased so far
+ * @programmed:	Bytes programmed so far
+ * @verified:	Bytes read back and verified so far
+ * @eta_ms:	Estimated time to completion, in ms
+ */
+struct xrt_flash_ioc_status {
+	__u32 job_id;
+	__u32 state;
+	__s32 error;
+	__u32 padding;
+	__u64 total;
+	__u64 done;
+	__u64 erased;
+	__u64 programmed;
+	__u64 verified;
+	__u64 eta_ms;
+};
+
+#define XRT_FLASH_IOC_UPDATE	_IOWR(XRT_FLASH_IOC_MAGIC, 1, struct xrt_flash_ioc_update)
+#define XRT_FLASH_IOC_STATUS	_IOWR(XRT_FLASH_IOC_MAGIC, 2, struct xrt_flash_ioc_status)
+#define XRT_FLASH_IOC_CANCEL	_IO(XRT_FLASH_IOC_MAGIC, 3)
+
+#endif
@@ -284,6 +284,13 @@ enum xcl_subdev_return_code {
 	XRT_MSG_SUBDEV_RTN_PENDINGPLP,
 };
 
+/*
+ * SUBDEV response carries blob data at @offset. @size is the whole blob size,
+ * @checksum changes whenever the blob does. Blob is fetched in chunks by
+ * bumping offset in request until rtncode is XRT_MSG_SUBDEV_RTN_COMPLETE. A
+ * request with offset out of the blob or no room for data gets the header
+ * only, with rtncode XRT_MSG_SUBDEV_RTN_PARTIAL.
+ */
 struct xcl_subdev {
 	uint32_t ver;
 	enum xcl_subdev_return_code rtncode;
@@ -297,6 +304,7 @@ struct xcl_subdev {
  * struct mailbox_subdev_peer - MAILBOX_REQ_PEER_DATA payload type
  * @kind: data group
  * @size: buffer size for receiving response
+ * @offset: where to start in data, honored for SUBDEV only
  */
 struct xcl_mailbox_peer_data {
 	enum xcl_group_kind kind;
@@ -306,18 +314,35 @@ struct xcl_mailbox_peer_data {
 	uint64_t offset;
 };
 
+/*
+ * Optional mailbox features, negotiated thru MAILBOX_REQ_USER_PROBE. User pf
+ * tells what it supports in struct xcl_mailbox_conn, mgmt pf answers with what
+ * both ends will use in struct xcl_mailbox_conn_resp. A peer not knowing about
+ * caps leaves them as 0 and gets none of the features.
+ */
+#define XCL_MB_CAP_PREEMPT		BIT(0) /* PKT_MSG_START_PREEMPT */
+#define XCL_MB_CAP_COMPACT_HDR		BIT(1) /* PKT_MSG_BODY_COMPACT */
+#define XCL_MB_CAP_LZ4			BIT(2) /* LZ4 compressed msg on HW channel */
+#define XCL_MB_CAP_RECLOCK_FREQS	BIT(3) /* RECLOCK answers with measured freqs */
+#define XCL_MB_CAP_HEARTBEAT		BIT(4) /* PKT_PING and PKT_PONG */
+#define XCL_MB_CAP_CSUM			BIT(5) /* crc32c of msg in start packet */
+
 /**
  * struct mailbox_conn - MAILBOX_REQ_USER_PROBE payload type
  * @kaddr: KVA of the verification data buffer
  * @paddr: physical address of the verification data buffer
  * @crc32: CRC value of the verification data buffer
  * @version: protocol version supported by peer
+ * @caps: XCL_MB_CAP_* supported by peer, not sent by old peer
+ * @reserved: must be 0
  */
 struct xcl_mailbox_conn {
 	uint64_t kaddr;
 	uint64_t paddr;
 	uint32_t crc32;
 	uint32_t version;
+	uint32_t caps;
+	uint32_t reserved;
 };
 
 #define XCL_COMM_ID_SIZE		2048
@@ -326,13 +351,14 @@ struct xcl_mailbox_conn {
 /**
  * struct mailbox_conn_resp - MAILBOX_REQ_USER_PROBE response payload type
  * @version: protocol version should be used
+ * @caps: XCL_MB_CAP_* to be used from now on, 0 from old peer
  * @conn_flags: connection status
  * @chan_switch: bitmap to indicate SW / HW channel for each OP code msg
  * @comm_id: user defined cookie
  */
 struct xcl_mailbox_conn_resp {
 	uint32_t version;
-	uint32_t reserved;
+	uint32_t caps;
 	uint64_t conn_flags;
 	uint64_t chan_switch;
 	char comm_id[XCL_COMM_ID_SIZE];
@@ -359,13 +385,29 @@ struct xcl_mailbox_bitstream_kaddr {
 /**
  * struct mailbox_clock_freqscaling - MAILBOX_REQ_RECLOCK payload type
  * @region: region of clock
- * @target_freqs: array of target clock frequencies (max clocks: 16)
+ * @target_freqs: array of target clock frequencies in MHz (max clocks: 16),
+ *	indexed from data clock, then kernel and system clock. 0 leaves the
+ *	clock alone
  */
 struct xcl_mailbox_clock_freqscaling {
 	unsigned int region;
 	unsigned short target_freqs[16];
 };
 
+/**
+ * struct mailbox_clock_freqscaling_resp - MAILBOX_REQ_RECLOCK response type,
+ * sent in place of int result when XCL_MB_CAP_RECLOCK_FREQS is agreed on
+ * @ret: result of the request, 0 or -errno
+ * @padding: must be 0
+ * @freqs: frequencies in kHz measured by clock counters after the change,
+ *	same index as target_freqs, 0 for clocks left alone
+ */
+struct xcl_mailbox_clock_freqscaling_resp {
+	int32_t ret;
+	uint32_t padding;
+	uint32_t freqs[16];
+};
+
 /**
  * struct mailbox_req - mailbox request message header
  * @req: opcode
@@ -9,6 +9,8 @@
 #ifndef _XCL_MB_TRANSPORT_H_
 #define _XCL_MB_TRANSPORT_H_
 
+#include <linux/ioctl.h>
+
 /*
  * This header file contains data structures used in mailbox transport layer
  * b/w mgmt and user pfs. Any changes made here should maintain backward
@@ -35,6 +37,80 @@ struct xcl_sw_chan {
 	char data[1]; /* variable length of payload */
 };
 
+/*
+ * Space taken by a msg of sz bytes of payload in a buffer holding multiple
+ * msgs for read() or write() in batch mode, so that next one is 8B aligned.
+ */
+#define XCL_SW_CHAN_REC_SIZE(sz)	\
+	((sizeof(struct xcl_sw_chan) + (sz) + 7) & ~(uint64_t)7)
+
+/*
+ * Besides read() and write(), daemon can exchange msgs with mailbox driver
+ * thru a pair of rings shared via mmap() on mailbox device node. The TX ring
+ * carries msgs from driver to daemon (to be sent to peer) and the RX ring
+ * carries msgs from daemon to driver (received from peer). Msgs which do not
+ * fit in a ring slot still go thru read() and write().
+ */
+#define XCL_MB_IOC_MAGIC		'M'
+#define XCL_MB_IOC_RING_SETUP		_IOWR(XCL_MB_IOC_MAGIC, 1, struct xcl_sw_ring_setup)
+#define XCL_MB_IOC_RING_KICK		_IO(XCL_MB_IOC_MAGIC, 2)
+/*
+ * Enable (arg != 0) or disable batch mode, where read() and write() can move
+ * multiple struct xcl_sw_chan in one call. Off by default for each open.
+ */
+#define XCL_MB_IOC_SW_BATCH		_IO(XCL_MB_IOC_MAGIC, 3)
+
+/* Size of ring header, slots start right after it. */
+#define XCL_SW_RING_HDR_SIZE		4096
+
+/**
+ * struct xcl_sw_ring - header of a software channel ring. Each ring has one
+ *                      producer and one consumer. Indices are free running
+ *                      and wrap at 2^32, the slot of an index is index modulo
+ *                      @nr_slots. Producer fills the slot, then publishes it
+ *                      by advancing @producer. Consumer releases the slot by
+ *                      advancing @consumer after it is done with the content.
+ * @producer: index of next slot to be filled, only written by producer
+ * @consumer: index of next slot to be consumed, only written by consumer
+ * @nr_slots: number of slots in the ring, power of 2
+ * @slot_size: size of each slot in bytes. A slot holds one struct
+ *             xcl_sw_chan followed by its payload
+ */
+struct xcl_sw_ring {
+	uint32_t producer;
+	uint32_t rsvd0[15];
+	uint32_t consumer;
+	uint32_t rsvd1[15];
+	uint32_t nr_slots;
+	uint32_t slot_size;
+	uint32_t rsvd2[14];
+};
+
+/**
+ * struct xcl_sw_ring_setup - argument of XCL_MB_IOC_RING_SETUP. The rings
+ *                            are mapped by mmap() on the same fd with offset
+ *                            0 and size of @mmap_size.
+ * @nr_slots: (in) number of slots in each ring, power of 2
+ * @slot_size: (in) size of each slot in bytes, multiple of 8
+ * @eventfd: (in) eventfd to be signaled when TX ring has new msg or RX ring
+ *           has free slot, -1 if daemon relies on poll() only
+ * @tx_offset: (out) offset of TX ring in the mapping
+ * @rx_offset: (out) offset of RX ring in the mapping
+ * @mmap_size: (out) size of the mapping
+ *
+ * After producing msgs in RX ring or consuming msgs from TX ring, daemon
+ * issues XCL_MB_IOC_RING_KICK once for the whole batch.
+ */
+struct xcl_sw_ring_setup {
+	uint32_t nr_slots;
+	uint32_t slot_size;
+	int32_t eventfd;
+	uint32_t rsvd;
+	uint64_t tx_offset;
+	uint64_t rx_offset;
+	uint64_t mmap_size;
+};
+
 /**
  * A packet transport by mailbox hardware channel.
  * When extending, only add new data structure to body. Choose to add new flag
@@ -44,7 +120,26 @@ enum packet_type {
 	PKT_INVALID = 0,
 	PKT_TEST,
 	PKT_MSG_START,
-	PKT_MSG_BODY
+	PKT_MSG_BODY,
+	/*
+	 * Same as PKT_MSG_START, but the msg is interleaved into an unfinished
+	 * one, which should be put aside and resumed after end of this msg.
+	 * Only sent when peer is known to understand it.
+	 */
+	PKT_MSG_START_PREEMPT,
+	/*
+	 * Same as PKT_MSG_BODY, but payload size is kept in type and payload
+	 * starts right after it, carrying 4 more bytes. Only sent when peer
+	 * has agreed on XCL_MB_CAP_COMPACT_HDR.
+	 */
+	PKT_MSG_BODY_COMPACT,
+	/*
+	 * Liveness probe and its answer, without payload. Can show up between
+	 * any two packets, also in the middle of a msg, and is not part of it.
+	 * Only sent when peer has agreed on XCL_MB_CAP_HEARTBEAT.
+	 */
+	PKT_PING,
+	PKT_PONG,
 };
 
 #define PACKET_SIZE	16 /* Number of DWORD. */
@@ -52,6 +147,8 @@ enum packet_type {
 /* Lower 8 bits for type, the rest for flags. Total packet size is 64 bytes */
 #define PKT_TYPE_MASK		0xff
 #define PKT_TYPE_MSG_END	BIT(31)
+#define PKT_COMPACT_SIZE_SHIFT	8
+#define PKT_COMPACT_SIZE(type)	(((type) >> PKT_COMPACT_SIZE_SHIFT) & 0xff)
 struct mailbox_pkt {
 	struct {
 		u32		type;